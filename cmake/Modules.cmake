@@ -12,6 +12,7 @@ endfunction()
 function(add_shards_module MODULE_NAME)
   set(OPTS
     EXPERIMENTAL # This disables the module by default when not building with SHARDS_WITH_EVERYTHING=ON
+    INLINE_FUSION # The module provides activateShardsFused to fuse runs of its inline shards
   )
   set(ARGS)
   set(MULTI_ARGS
@@ -88,6 +89,10 @@ function(add_shards_module MODULE_NAME)
     set_property(TARGET ${MODULE_TARGET} APPEND PROPERTY SHARDS_MODULE_INLINE_MODULES ${MODULE_ID})
   endif()
 
+  if(MODULE_INLINE_FUSION)
+    set_property(TARGET ${MODULE_TARGET} PROPERTY SHARDS_MODULE_INLINE_FUSION TRUE)
+  endif()
+
   if(MODULE_REGISTER_SHARDS)
     message(VERBOSE "  REGISTER_SHARDS = ${MODULE_REGISTER_SHARDS}")
 
@@ -249,6 +254,12 @@ function(shards_generate_union UNION_TARGET_NAME)
       list(APPEND MODULES_WITH_INLINE_IDS "${MODULE_ID}")
     endif()
 
+    get_property(INLINE_FUSION TARGET ${MODULE_TARGET} PROPERTY SHARDS_MODULE_INLINE_FUSION)
+
+    if(INLINE_FUSION)
+      list(APPEND MODULES_WITH_INLINE_FUSION "${MODULE_ID}")
+    endif()
+
     get_property(INLINE_SOURCES TARGET ${MODULE_TARGET} PROPERTY SHARDS_MODULE_INLINE_SOURCES)
 
     if(INLINE_SOURCES)
@@ -340,6 +351,30 @@ function(shards_generate_union UNION_TARGET_NAME)
     "  return false;\n"
     "}\n\n")
 
+  # Fused activation declaration (when not inlining)
+  if(NOT SHARDS_INLINE_EVERYTHING)
+    foreach(MODULE_ID ${MODULES_WITH_INLINE_FUSION})
+      file(APPEND ${GENERATED_TEMP}
+        "ALWAYS_INLINE uint32_t activateShardsFused_${MODULE_ID}(Shard *const *, size_t, SHContext*, const SHVar&, SHVar&);\n"
+      )
+    endforeach()
+
+    file(APPEND ${GENERATED_TEMP} "\n")
+  endif()
+
+  file(APPEND ${GENERATED_TEMP}
+    "ALWAYS_INLINE uint32_t activateShardsFused(Shard *const *shards, size_t len, SHContext *context, const SHVar &input, SHVar &output) {\n")
+
+  foreach(MODULE_ID ${MODULES_WITH_INLINE_FUSION})
+    file(APPEND ${GENERATED_TEMP}
+      "  if (auto fused = activateShardsFused_${MODULE_ID}(shards, len, context, input, output))\n"
+      "    return fused;\n")
+  endforeach()
+
+  file(APPEND ${GENERATED_TEMP}
+    "  return 0;\n"
+    "}\n\n")
+
   file(APPEND ${GENERATED_TEMP} "}\n")
   file(COPY_FILE ${GENERATED_TEMP} ${GENERATED_INLINE_SOURCE} ONLY_IF_DIFFERENT)
 
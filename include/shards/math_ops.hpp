@@ -198,6 +198,27 @@ template <> struct enum_range<shards::Math::DispatchType> {
 namespace shards::Math {
 constexpr bool hasDispatchType(DispatchType a, DispatchType b) { return (uint8_t(a) & uint8_t(b)) != 0; }
 
+// True if dispatchType<DispatchType> handles type
+constexpr bool isDispatchedType(DispatchType dispatch, SHType type) {
+  switch (type) {
+  case SHType::Int:
+  case SHType::Int2:
+  case SHType::Int3:
+  case SHType::Int4:
+  case SHType::Int8:
+  case SHType::Int16:
+  case SHType::Color:
+    return hasDispatchType(dispatch, DispatchType::IntTypes);
+  case SHType::Float:
+  case SHType::Float2:
+  case SHType::Float3:
+  case SHType::Float4:
+    return hasDispatchType(dispatch, DispatchType::FloatTypes);
+  default:
+    return false;
+  }
+}
+
 template <DispatchType DispatchType, typename T, typename... TArgs> void dispatchType(SHType type, T v, TArgs &&...args) {
   if constexpr (hasDispatchType(DispatchType, DispatchType::IntTypes)) {
     switch (type) {
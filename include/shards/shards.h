@@ -590,6 +590,9 @@ struct SHVarPayload {
 // this marks the variable as a foreign variable, to prevent destruction
 // when used inside seq and table
 #define SHVAR_FLAGS_FOREIGN (1 << 4)
+// this marks the variable memory as owned by a wire iteration arena,
+// it is released in bulk and never destroyed individually
+#define SHVAR_FLAGS_ARENA (1 << 5)
 
 struct SHVar {
   struct SHVarPayload payload;
@@ -1112,6 +1112,7 @@ public:
   Wire &looped(bool looped);
   Wire &unsafe(bool unsafe);
   Wire &stackSize(size_t size);
+  Wire &arena(bool enabled);
   Wire &name(std::string_view name);
 
   SHWire *operator->() { return _wire.get(); }
@@ -287,6 +287,20 @@ template <class T> struct ShardWrapper {
   }
 };
 
+// Activation bound at compile time to a member of T, usually a template instantiated for the types compose settled on.
+// Installed from compose like OVERRIDE_ACTIVATE, but usable from dispatch helpers since T is explicit, e.g.
+//   data.shard->activate = specializedActivation<MyShard, &MyShard::template activateTyped<SHType::Float>>();
+template <typename T, SHVar (T::*Fn)(SHContext *, const SHVar &)> SHActivateProc specializedActivation() {
+  return static_cast<SHActivateProc>([](Shard *b, SHContext *ctx, const SHVar *v) {
+    try {
+      return (reinterpret_cast<ShardWrapper<T> *>(b)->shard.*Fn)(ctx, *v);
+    } catch (const std::exception &e) {
+      shards::abortWire(ctx, e.what());
+      return SHVar{};
+    }
+  });
+}
+
 #define REGISTER_SHARD(__name__, __type__)                                                                             \
   ::shards::ShardWrapper<__type__>::name = __name__;                                                                   \
   ::shards::ShardWrapper<__type__>::crc = ::shards::constant<::shards::crc32(__name__ SHARDS_CURRENT_ABI_STR)>::value; \
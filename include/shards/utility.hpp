@@ -448,6 +448,9 @@ public:
     }
   }
 
+  // References held on obj, 1 when only its creator holds it
+  uint32_t RefCount(E *obj) const { return reinterpret_cast<ObjectRef *>(obj)->refcount; }
+
   SHVar Get(E *obj) {
     SHVar res;
     res.valueType = SHType::Object;
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#ifndef SH_CORE_ARENA
+#define SH_CORE_ARENA
+
+#include <shards/shards.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <vector>
+
+namespace shards {
+// Bump allocator for the scratch and output values of a wire iteration.
+// Everything allocated lives until the wire starts its next iteration, the same lifetime a shard's member output has.
+// Values built here carry SHVAR_FLAGS_ARENA, destroyVar just forgets them.
+// Chunks are kept across iterations, the ones an iteration didn't need are freed so spikes don't stick.
+// A shard activated in a loop allocates again on every activation, so callers check fits() against the
+// per-iteration Budget and fall back to their own buffers past it.
+struct IterationArena {
+  static constexpr size_t ChunkSize = 64 * 1024;
+  static constexpr size_t Alignment = 16;
+  static constexpr size_t Budget = 16 * ChunkSize;
+
+  IterationArena() = default;
+  IterationArena(const IterationArena &) = delete;
+  IterationArena &operator=(const IterationArena &) = delete;
+
+  ~IterationArena() {
+    for (auto &chunk : _chunks)
+      ::operator delete[](chunk.mem, std::align_val_t{Alignment});
+  }
+
+  static constexpr size_t aligned(size_t size) { return (size + Alignment - 1) & ~(Alignment - 1); }
+
+  uint8_t *alloc(size_t size) {
+    size = aligned(size);
+    _used += size;
+    if (_current < _chunks.size() && _offset + size <= _chunks[_current].size) {
+      auto res = _chunks[_current].mem + _offset;
+      _offset += size;
+      return res;
+    }
+    return allocSlow(size);
+  }
+
+  // Called as the wire begins an iteration, invalidates every value of the previous one
+  void reset() {
+    // chunks past the last one used were not needed by this iteration
+    const auto used = std::min(_current + 1, _chunks.size());
+    for (size_t i = used; i < _chunks.size(); i++)
+      ::operator delete[](_chunks[i].mem, std::align_val_t{Alignment});
+    _chunks.resize(used);
+    _current = 0;
+    _offset = 0;
+    _used = 0;
+  }
+
+  // Bytes handed out since the iteration began
+  size_t used() const { return _used; }
+  // True if size more bytes stay within the iteration budget
+  bool fits(size_t size) const { return _used + size <= Budget; }
+
+  size_t capacity() const {
+    size_t res = 0;
+    for (auto &chunk : _chunks)
+      res += chunk.size;
+    return res;
+  }
+
+  SHVar string(std::string_view str) {
+    SHVar res{};
+    res.valueType = SHType::String;
+    res.flags = SHVAR_FLAGS_ARENA;
+    auto mem = (char *)alloc(str.size() + 1);
+    memcpy(mem, str.data(), str.size());
+    mem[str.size()] = 0;
+    res.payload.stringValue = mem;
+    res.payload.stringLen = uint32_t(str.size());
+    return res;
+  }
+
+  SHVar bytes(const uint8_t *data, uint32_t size) {
+    SHVar res{};
+    res.valueType = SHType::Bytes;
+    res.flags = SHVAR_FLAGS_ARENA;
+    res.payload.bytesValue = alloc(size);
+    res.payload.bytesSize = size;
+    if (size > 0)
+      memcpy(res.payload.bytesValue, data, size);
+    return res;
+  }
+
+  // A sequence of len zeroed elements, they can be filled with arena values or blittable ones
+  SHVar seq(uint32_t len) {
+    SHVar res{};
+    res.valueType = SHType::Seq;
+    res.flags = SHVAR_FLAGS_ARENA;
+    if (len == 0)
+      return res;
+    res.payload.seqValue.elements = (SHVar *)alloc(sizeof(SHVar) * len);
+    memset(res.payload.seqValue.elements, 0x0, sizeof(SHVar) * len);
+    res.payload.seqValue.len = len;
+    res.payload.seqValue.cap = len;
+    return res;
+  }
+
+private:
+  struct Chunk {
+    uint8_t *mem;
+    size_t size;
+  };
+
+  uint8_t *allocSlow(size_t size) {
+    // move on to the next chunk big enough, allocate one if none
+    while (++_current < _chunks.size()) {
+      if (size <= _chunks[_current].size)
+        break;
+    }
+    if (_current >= _chunks.size()) {
+      const auto chunkSize = std::max(ChunkSize, size);
+      _chunks.push_back(Chunk{new (std::align_val_t{Alignment}) uint8_t[chunkSize], chunkSize});
+      _current = _chunks.size() - 1;
+    }
+    _offset = size;
+    return _chunks[_current].mem;
+  }
+
+  std::vector<Chunk> _chunks;
+  size_t _current{0};
+  size_t _offset{0};
+  size_t _used{0};
+};
+} // namespace shards
+
+#endif
@@ -2,6 +2,178 @@
 
 #if HAS_ASYNC_SUPPORT
 namespace shards {
+namespace {
+// the pool and worker the current thread belongs to, if any
+thread_local TidePool *tidePoolOwner{};
+thread_local size_t tidePoolWorker{};
+} // namespace
+
+TidePool::TidePool() {
+  std::scoped_lock lock(_workersMutex);
+  for (size_t i = 0; i < NumWorkers; ++i) {
+    spawnWorker();
+  }
+}
+
+TidePool::~TidePool() {
+  {
+    std::scoped_lock lock(_parkMutex);
+    _running = false;
+  }
+  _parkCv.notify_all();
+
+  // no worker can be spawned past this point, join without holding the lock as workers might be signaling
+  {
+    std::scoped_lock lock(_workersMutex);
+  }
+  for (auto &worker : _workers) {
+    if (worker.thread.joinable())
+      worker.thread.join();
+  }
+}
+
+void TidePool::schedule(Work *work) {
+  Job job{work, Clock::now()};
+  while (true) {
+    size_t index;
+    if (tidePoolOwner == this) {
+      // keep work scheduled from a worker local, others will steal it if needed
+      index = tidePoolWorker;
+    } else {
+      index = _nextWorker++ % std::max<size_t>(_active, 1);
+    }
+
+    auto &worker = _workers[index];
+    std::scoped_lock lock(worker.mutex);
+    // the worker retired while we were picking it, pick again
+    if (worker.closed)
+      continue;
+    worker.jobs.push_back(job);
+    break;
+  }
+  _pending++;
+
+  signal();
+}
+
+// Wakes a parked worker, or spawns a new one if all of them are busy
+void TidePool::signal() {
+  if (_idle > 0) {
+    {
+      std::scoped_lock lock(_parkMutex);
+    }
+    _parkCv.notify_one();
+  } else if (_active < MaxWorkers) {
+    std::scoped_lock lock(_workersMutex);
+    if (_idle == 0 && _active < MaxWorkers && _running)
+      spawnWorker();
+  }
+}
+
+// Requires _workersMutex
+void TidePool::spawnWorker() {
+  const auto index = _active.load();
+  auto &worker = _workers[index];
+  // a retired worker might still be on its way out
+  if (worker.thread.joinable())
+    worker.thread.join();
+  {
+    std::scoped_lock lock(worker.mutex);
+    worker.closed = false;
+  }
+  worker.thread = std::thread([this, index]() { workerLoop(index); });
+  _active++;
+  // SHLOG_DEBUG("TidePool: worker added, count: {}", _active);
+}
+
+bool TidePool::tryRetire(size_t index) {
+  std::scoped_lock lock(_workersMutex);
+  // only the last worker retires so the active ones stay contiguous
+  if (index + 1 != _active)
+    return false;
+
+  auto &worker = _workers[index];
+  std::scoped_lock workerLock(worker.mutex);
+  if (!worker.jobs.empty())
+    return false;
+
+  worker.closed = true;
+  _active--;
+  // SHLOG_DEBUG("TidePool: worker removed, count: {}", _active);
+  return true;
+}
+
+bool TidePool::popOrSteal(size_t index, Job &job) {
+  {
+    auto &own = _workers[index];
+    std::scoped_lock lock(own.mutex);
+    if (!own.jobs.empty()) {
+      job = own.jobs.front();
+      own.jobs.pop_front();
+      _pending--;
+      return true;
+    }
+  }
+
+  const auto active = _active.load();
+  for (size_t i = 1; i < active; i++) {
+    auto &victim = _workers[(index + i) % active];
+    std::scoped_lock lock(victim.mutex);
+    if (!victim.jobs.empty()) {
+      job = victim.jobs.back();
+      victim.jobs.pop_back();
+      _pending--;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void TidePool::run(const Job &job) {
+  const auto start = Clock::now();
+  const uint64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(start - job.scheduled).count();
+  _waitNs += wait;
+  auto maxWait = _maxWaitNs.load();
+  while (wait > maxWait && !_maxWaitNs.compare_exchange_weak(maxWait, wait)) {
+  }
+
+  // SHLOG_DEBUG("TidePool: calling {}", (void*)job.work);
+  job.work->call();
+
+  _runNs += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+  _completed++;
+}
+
+void TidePool::workerLoop(size_t index) {
+  tidePoolOwner = this;
+  tidePoolWorker = index;
+
+  auto lastWork = Clock::now();
+  while (_running) {
+    Job job;
+    if (popOrSteal(index, job)) {
+      // more work waiting, get someone else on it before blocking in the call
+      if (_pending > 0)
+        signal();
+      run(job);
+      lastWork = Clock::now();
+      continue;
+    }
+
+    std::unique_lock lock(_parkMutex);
+    _idle++;
+    _parkCv.wait_for(lock, IdleTimeout / 5, [this]() { return _pending > 0 || !_running; });
+    _idle--;
+    lock.unlock();
+
+    if (_pending == 0 && index >= NumWorkers && Clock::now() - lastWork > IdleTimeout) {
+      if (tryRetire(index))
+        return;
+    }
+  }
+}
+
 TidePool &getTidePool() {
   static TidePool tidePool;
   return tidePool;
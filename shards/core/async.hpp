@@ -1,11 +1,15 @@
 #ifndef F80CEE03_D5CE_4787_8D65_FB8CC200104A
 #define F80CEE03_D5CE_4787_8D65_FB8CC200104A
 
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <thread>
 #include "foundation.hpp"
 #include "runtime.hpp"
-#include <boost/lockfree/queue.hpp>
 
 #if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
 #define HAS_ASYNC_SUPPORT 0
@@ -17,23 +21,20 @@ namespace shards {
 #if HAS_ASYNC_SUPPORT
 
 /*
- * The TidePool class is a simple C++ thread pool implementation designed to manage
- * worker threads and distribute tasks to them. The class supports dynamic adjustment
- * of the number of worker threads based on the current workload.
+ * TidePool is the thread pool running the blocking calls of await/awaitne.
  *
  * Features:
  * - Abstract Work struct representing tasks to be executed by the worker threads.
- * - Dynamic adjustment of the number of worker threads based on the number of tasks in the queue.
- * - Lock-free queue for efficient task scheduling.
- * - Configurable minimum, initial, and maximum number of worker threads.
- * - Asynchronous controller thread that manages worker threads.
- * - Simple scheduling function for adding tasks to the queue.
+ * - Every worker owns a deque, work scheduled from outside the pool is spread round-robin
+ *   and idle workers steal from the other deques before parking.
+ * - Parked workers sleep on a condition variable and are woken as soon as work is scheduled.
+ * - When every worker is busy a new one is spawned right away (up to MaxWorkers),
+ *   workers above NumWorkers retire after being idle for IdleTimeout.
+ * - metrics() reports the queue depth, wait time and run time of the scheduled work.
  *
  * Usage:
  * - Derive custom work classes from the Work struct and implement the call() function.
- * - Create an instance of TidePool.
- * - Schedule tasks using the schedule() function.
- * - The pool will automatically adjust the number of worker threads based on the workload.
+ * - Schedule tasks using the schedule() function, the Work must stay alive until call() returns.
  */
 
 struct TidePool {
@@ -41,81 +42,77 @@ struct TidePool {
     virtual void call() = 0;
   };
 
+  using Clock = std::chrono::steady_clock;
+
+  struct Job {
+    Work *work;
+    Clock::time_point scheduled;
+  };
+
   struct Worker {
-    Worker(boost::lockfree::queue<Work *> &queue, std::atomic_size_t &counter) : _queue(queue), _counter(counter) {
-      _running = true;
-      _future = std::async(std::launch::async, [this]() {
-        while (_running) {
-          Work *work{};
-          if (_queue.pop(work)) {
-            // SHLOG_DEBUG("TidePool: calling {}", (void*)work);
-            work->call();
-            _counter--;
-          } else {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-          }
-        }
-      });
-    }
+    std::mutex mutex;
+    std::deque<Job> jobs;
+    // set when the worker retired, nothing can be pushed to a closed worker
+    bool closed{true};
+    std::thread thread;
+  };
 
-    std::future<void> _future;
-    std::atomic_bool _running;
-    boost::lockfree::queue<Work *> &_queue;
-    std::atomic_size_t &_counter;
+  struct Metrics {
+    // scheduled but not started yet
+    size_t queued;
+    size_t workers;
+    size_t idle;
+    uint64_t completed;
+    // time between schedule() and the start of the call
+    std::chrono::nanoseconds totalWait;
+    std::chrono::nanoseconds maxWait;
+    std::chrono::nanoseconds totalRun;
   };
 
-  static constexpr size_t LowWater = 4;
   static constexpr size_t NumWorkers = 8;
   static constexpr size_t MaxWorkers = 32;
-
-  std::atomic_size_t _scheduledCounter;
-  std::atomic_bool _running;
-  std::future<void> _controller;
-  boost::lockfree::queue<Work *> _queue{NumWorkers};
-  std::deque<Worker> _workers;
-
-  TidePool() {
-    _running = true;
-    _controller = std::async(std::launch::async, [this]() { controllerWorker(); });
+  static constexpr std::chrono::milliseconds IdleTimeout{500};
+
+  std::array<Worker, MaxWorkers> _workers;
+  std::mutex _workersMutex;
+  std::atomic_size_t _active{0};
+  std::atomic_size_t _nextWorker{0};
+
+  std::mutex _parkMutex;
+  std::condition_variable _parkCv;
+  std::atomic_size_t _idle{0};
+  std::atomic_size_t _pending{0};
+  std::atomic_bool _running{true};
+
+  std::atomic_uint64_t _completed{0};
+  std::atomic_uint64_t _waitNs{0};
+  std::atomic_uint64_t _maxWaitNs{0};
+  std::atomic_uint64_t _runNs{0};
+
+  TidePool();
+  ~TidePool();
+
+  void schedule(Work *work);
+
+  Metrics metrics() const {
+    return Metrics{
+        _pending.load(),
+        _active.load(),
+        _idle.load(),
+        _completed.load(),
+        std::chrono::nanoseconds(_waitNs.load()),
+        std::chrono::nanoseconds(_maxWaitNs.load()),
+        std::chrono::nanoseconds(_runNs.load()),
+    };
   }
 
-  ~TidePool() {
-    _running = false;
-    _controller.wait();
-  }
-
-  void schedule(Work *work) {
-    _scheduledCounter++;
-    _queue.push(work);
-  }
-
-  void controllerWorker() {
-    // spawn workers first
-    for (size_t i = 0; i < NumWorkers; ++i) {
-      _workers.emplace_back(_queue, _scheduledCounter);
-    }
-
-    while (_running) {
-      assert(_workers.size() >= NumWorkers);
-
-      if (_scheduledCounter < LowWater && _workers.size() > NumWorkers) {
-        // we have less than LowWater scheduled and we have more than NumWorkers workers
-        _workers.back()._running = false;
-        _workers.pop_back();
-        // SHLOG_DEBUG("TidePool: worker removed, count: {}", _workers.size());
-      } else if (_scheduledCounter > _workers.size() && _workers.size() < MaxWorkers) {
-        // we have more scheduled than workers
-        _workers.emplace_back(_queue, _scheduledCounter);
-        // SHLOG_DEBUG("TidePool: worker added, count: {}", _workers.size());
-      }
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
-
-    for (auto &worker : _workers) {
-      worker._running = false;
-      worker._future.wait();
-    }
-  }
+private:
+  void signal();
+  void spawnWorker();
+  bool tryRetire(size_t index);
+  bool popOrSteal(size_t index, Job &job);
+  void run(const Job &job);
+  void workerLoop(size_t index);
 };
 
 TidePool &getTidePool();
@@ -135,19 +132,52 @@ struct SharedThreadPoolConcurrency {
 };
 #endif
 
+#if HAS_ASYNC_SUPPORT
+// Completion state shared by a blocking call and the wire awaiting it.
+// Wires ticked as mesh flows are parked by the mesh until the worker wakes them up,
+// others (e.g. stepped wires) fall back to checking on every tick.
+struct AwaitCompletion {
+  // weak, a parked frame must not keep a dropped mesh alive
+  std::weak_ptr<SHMesh> mesh;
+  SHWire *wire{};
+  std::atomic_bool complete{false};
+
+  AwaitCompletion(SHContext *context) {
+    auto flowWire = context->flow ? context->flow->wire : nullptr;
+    if (flowWire && flowWire->meshFlow) {
+      mesh = flowWire->mesh;
+      wire = flowWire;
+    }
+  }
+
+  // Called by the worker, the awaiting side might be gone as soon as complete is set
+  void notify() {
+    auto wakeMesh = mesh.lock();
+    auto wakeWire = wire;
+    complete = true;
+    if (wakeMesh)
+      wakeMesh->wakeAwaiting(wakeWire);
+  }
+
+  SHWireState suspend(SHContext *context) {
+    // infinite means parked until woken by notify()
+    return shards::suspend(context, wire ? std::numeric_limits<double>::infinity() : 0.0);
+  }
+};
+#endif
+
 template <typename FUNC, typename CANCELLATION>
 inline SHVar awaitne(SHContext *context, FUNC &&func, CANCELLATION &&cancel) noexcept {
 #if !HAS_ASYNC_SUPPORT
   return func();
 #else
-  struct BlockingCall : TidePool::Work {
-    BlockingCall(FUNC &&func) : func(std::move(func)), exp(), res(), complete(false) {}
+  struct BlockingCall : TidePool::Work, AwaitCompletion {
+    BlockingCall(SHContext *context, FUNC &&func) : AwaitCompletion(context), func(std::move(func)), exp(), res() {}
 
     FUNC &&func;
 
     std::exception_ptr exp;
     SHVar res;
-    std::atomic_bool complete;
 
     virtual void call() {
       try {
@@ -155,14 +185,14 @@ inline SHVar awaitne(SHContext *context, FUNC &&func, CANCELLATION &&cancel) noe
       } catch (...) {
         exp = std::current_exception();
       }
-      complete = true;
+      notify();
     }
-  } call{std::forward<FUNC>(func)};
+  } call{context, std::forward<FUNC>(func)};
 
   getTidePool().schedule(&call);
 
   while (!call.complete && context->shouldContinue()) {
-    if (shards::suspend(context, 0) != SHWireState::Continue)
+    if (call.suspend(context) != SHWireState::Continue)
       break;
   }
 
@@ -191,13 +221,12 @@ template <typename FUNC, typename CANCELLATION> inline void await(SHContext *con
 #if !HAS_ASYNC_SUPPORT
   func();
 #else
-  struct BlockingCall : TidePool::Work {
-    BlockingCall(FUNC &&func) : func(std::move(func)), exp(), complete(false) {}
+  struct BlockingCall : TidePool::Work, AwaitCompletion {
+    BlockingCall(SHContext *context, FUNC &&func) : AwaitCompletion(context), func(std::move(func)), exp() {}
 
     FUNC &&func;
 
     std::exception_ptr exp;
-    std::atomic_bool complete;
 
     virtual void call() {
       try {
@@ -205,14 +234,14 @@ template <typename FUNC, typename CANCELLATION> inline void await(SHContext *con
       } catch (...) {
         exp = std::current_exception();
       }
-      complete = true;
+      notify();
     }
-  } call{std::forward<FUNC>(func)};
+  } call{context, std::forward<FUNC>(func)};
 
   getTidePool().schedule(&call);
 
   while (!call.complete && context->shouldContinue()) {
-    if (shards::suspend(context, 0) != SHWireState::Continue)
+    if (call.suspend(context) != SHWireState::Continue)
       break;
   }
 
@@ -18,6 +18,7 @@
 #include "spdlog/spdlog.h"
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
 #include <deque>
@@ -29,6 +30,7 @@
 #include <set>
 #include <sstream>
 #include <type_traits>
+#include <unordered_map>
 #include <unordered_set>
 #include <variant>
 
@@ -47,8 +49,10 @@
 #include <boost/align/aligned_allocator.hpp>
 
 #include "untracked_collections.hpp"
+#include "indexed_map.hpp"
+#include "arena.hpp"
 
-// TODO make it into a run-time param
+// Default coroutine stack size, overridable at run-time by Globals::StackSize, SHMesh::stackSize and SHWire::stackSize
 #ifndef NDEBUG
 #define SH_BASE_STACK_SIZE 1024 * 1024
 #else
@@ -131,6 +135,14 @@ SHWireState activateShards(Shards shards, SHContext *context, const SHVar &wireI
 SHWireState activateShards2(Shards shards, SHContext *context, const SHVar &wireInput, SHVar &output, SHVar &outHash) noexcept;
 SHVar *referenceGlobalVariable(SHContext *ctx, std::string_view name);
 SHVar *referenceVariable(SHContext *ctx, std::string_view name);
+// Index of a variable in the wire flat table of resolved variables
+struct VariableSlot {
+  SHWire *wire{nullptr};
+  uint32_t index{0};
+};
+// Same as referenceVariable but resolves by index after the first lookup in the current wire,
+// other shards referencing the same name will hit the resolved slot instead of walking the wire stack
+SHVar *referenceVariable(SHContext *ctx, std::string_view name, VariableSlot &slot);
 SHVar *referenceWireVariable(SHWire *wire, std::string_view name);
 void releaseVariable(SHVar *variable);
 void setSharedVariable(std::string_view name, const SHVar &value);
@@ -263,13 +275,23 @@ struct SHAlignedMap : public boost::container::flat_map<
                           boost::container::stable_vector<std::pair<const K, V>,
                                                           boost::alignment::aligned_allocator<std::pair<const K, V>, 16>>> {};
 
-struct SHTableImpl : public SHAlignedMap<shards::OwnedVar, shards::OwnedVar> {
+// Hash indexed for lookups, still iterates sorted by key like it used to so hashing and serialization stay canonical
+struct SHTableImpl : public shards::IndexedMap<shards::OwnedVar, shards::OwnedVar, std::hash<SHVar>, std::equal_to<SHVar>,
+                                               std::less<SHVar>> {
 #if SHARDS_TRACKING
   SHTableImpl() {}
   ~SHTableImpl() {}
 #endif
 };
 
+// A coroutine stack, usually coming from and going back to the global stack pool
+struct SHStack {
+  uint8_t *mem{nullptr};
+  size_t size{0};
+  // mem is preceded by a no access guard page and pages are committed on first touch
+  bool guarded{false};
+};
+
 #ifndef __EMSCRIPTEN__
 struct SHStackAllocator {
   size_t size{SH_BASE_STACK_SIZE};
@@ -357,6 +379,13 @@ struct SHWire : public std::enable_shared_from_this<SHWire> {
   SHVar composedHash{};
   bool warmedUp{false};
   bool isRoot{false};
+  // set by SHMesh::schedule, true if the composed wire neither requires nor exposes global variables
+  // such wires can be ticked concurrently by a mesh with workers
+  bool meshIsolated{false};
+  // the mesh worker thread this wire's flow is pinned to, -1 if ticked by the mesh thread
+  int32_t meshWorker{-1};
+  // true while the wire is ticked as a flow of its mesh, which then can wake it up (e.g. when an await completes)
+  bool meshFlow{false};
   std::unordered_set<void *> wireUsers;
 
   // we need to clone this, as might disappear, since outside wire
@@ -378,14 +407,23 @@ struct SHWire : public std::enable_shared_from_this<SHWire> {
 
   SHAlignedMap<std::string, SHVar> variables;
 
+  // flat table of resolved variables, see referenceVariable with VariableSlot
+  // indices are stable for the wire lifetime, pointers are reset on cleanup
+  std::unordered_map<std::string, uint32_t> variableSlotIndices;
+  std::vector<SHVar *> variableSlots;
+
   // variables with lifetime managed externally
   std::unordered_map<std::string, SHVar *> externalVariables;
   // used only in the case of external variables
   std::unordered_map<uint64_t, shards::TypeInfo> typesCache;
 
-  // this is the eventual coroutine stack memory buffer
-  uint8_t *stackMem{nullptr};
-  size_t stackSize{SH_BASE_STACK_SIZE};
+  // this is the eventual coroutine stack, returned to the stack pool when the wire stops
+  SHStack stack;
+  // 0 means inherit from the mesh, or Globals::StackSize
+  size_t stackSize{0};
+
+  // opt-in scratch memory for shards, reset as each iteration begins, see shards::iterationArena
+  std::unique_ptr<shards::IterationArena> arena;
 
   static std::shared_ptr<SHWire> &sharedFromRef(SHWireRef ref) {
     assert(ref && "sharedFromRef - ref was nullptr");
@@ -453,12 +491,62 @@ using SHHashSetIt = SHHashSet::iterator;
 using SHMap = SHTableImpl;
 using SHMapIt = SHMap::iterator;
 
+// Events of a single ID, double buffered: Send writes the back buffer, Update swaps it with the front one
+// Receive reads. Slots are allocated once and keep their memory across frames, values are cloned into them.
+struct EventBuffer {
+  std::array<std::vector<SHVar>, 2> slots;
+  // events sent to each buffer, past the capacity the oldest are overwritten
+  std::array<size_t, 2> sent{};
+  uint8_t back{0};
+  // events overwritten since the buffer was created
+  uint64_t dropped{0};
+
+  EventBuffer(size_t capacity);
+  ~EventBuffer();
+  EventBuffer(const EventBuffer &) = delete;
+  EventBuffer &operator=(const EventBuffer &) = delete;
+
+  size_t capacity() const { return slots[0].size(); }
+
+  void push(const SHVar &event) {
+    auto &buffer = slots[back];
+    auto &count = sent[back];
+    cloneVar(buffer[count % buffer.size()], event);
+    count++;
+  }
+
+  // O(1) unless the back buffer wrapped around, which needs the oldest event moved first
+  void swap();
+
+  // The events of the last frame, valid until the next swap
+  SHVar front() {
+    const auto idx = back ^ 1;
+    SHVar res{};
+    res.valueType = SHType::Seq;
+    res.payload.seqValue.elements = slots[idx].data();
+    res.payload.seqValue.len = uint32_t(std::min(sent[idx], slots[idx].size()));
+    return res;
+  }
+};
+
 struct EventDispatcher {
-  entt::dispatcher dispatcher;
+  static constexpr size_t DefaultCapacity = 1024;
+
   std::string name;
   SHTypeInfo type;
+  // how many events a frame holds for each ID
+  size_t capacity{DefaultCapacity};
+  // bumped on every update, so that receivers output a frame only once
+  uint64_t frame{0};
+
+  // Compose time, created on first use, entt::null for events without ID
+  EventBuffer &buffer(entt::id_type id);
+  // Starts a new frame, what was sent becomes what is received
+  void update();
 
-  entt::dispatcher *operator->() { return &dispatcher; }
+private:
+  std::mutex _mutex;
+  std::unordered_map<entt::id_type, EventBuffer> _buffers;
 };
 
 struct Globals {
@@ -486,6 +574,10 @@ public:
   std::string RootPath;
   std::string ExePath;
 
+  // coroutine stack defaults, wires and meshes can override the size
+  size_t StackSize{SH_BASE_STACK_SIZE};
+  bool GuardedStacks{false};
+
   UntrackedUnorderedMap<uint32_t, SHOptionalString> *CompressedStrings{nullptr};
 
   entt::registry Registry;
@@ -613,6 +705,16 @@ public:
 Globals &GetGlobals();
 EventDispatcher &getEventDispatcher(const std::string &name);
 
+// Var payload and array buffers allocated by the current thread, sampled by the shard profiler.
+// Only counted while some profiler is enabled, so the hot allocation paths don't pay for it otherwise.
+extern thread_local uint64_t varAllocations;
+extern std::atomic<uint32_t> enabledProfilers;
+
+inline void countVarAllocation() {
+  if (unlikely(enabledProfilers.load(std::memory_order_relaxed) > 0))
+    varAllocations++;
+}
+
 template <typename T> inline void arrayGrow(T &arr, size_t addlen, size_t min_cap = 4) {
   // safety check to make sure this is not a borrowed foreign array!
   assert((arr.cap == 0 && arr.elements == nullptr) || (arr.cap > 0 && arr.elements != nullptr));
@@ -632,6 +734,7 @@ template <typename T> inline void arrayGrow(T &arr, size_t addlen, size_t min_ca
 
   // TODO investigate realloc
   auto newbuf = new (std::align_val_t{16}) uint8_t[sizeof(arr.elements[0]) * min_cap];
+  countVarAllocation();
   if (arr.elements) {
     memcpy(newbuf, arr.elements, sizeof(arr.elements[0]) * arr.len);
     ::operator delete[](arr.elements, std::align_val_t{16});
@@ -898,9 +1001,21 @@ namespace shards {
 NO_INLINE void _destroyVarSlow(SHVar &var);
 NO_INLINE void _cloneVarSlow(SHVar &dst, const SHVar &src);
 
+// Backing memory of String/Path/ContextVar and Bytes payloads.
+// Small buffers are recycled through per thread caches, size is rounded up to the size class actually allocated.
+uint8_t *allocVarBuffer(uint32_t &size);
+void freeVarBuffer(void *buffer, uint32_t size);
+
 ALWAYS_INLINE inline void destroyVar(SHVar &var) {
-  // if var.flags contains SHVAR_FLAGS_FOREIGN, then the var should not be destroyed
-  if ((var.flags & SHVAR_FLAGS_FOREIGN) == SHVAR_FLAGS_FOREIGN) {
+  if (unlikely((var.flags & (SHVAR_FLAGS_FOREIGN | SHVAR_FLAGS_ARENA)) != 0)) {
+    // if var.flags contains SHVAR_FLAGS_FOREIGN, then the var should not be destroyed
+    if ((var.flags & SHVAR_FLAGS_FOREIGN) == SHVAR_FLAGS_FOREIGN)
+      return;
+
+    // arena memory is released in bulk, just forget it
+    var.flags &= ~SHVAR_FLAGS_ARENA;
+    memset(&var.payload, 0x0, sizeof(SHVarPayload));
+    var.valueType = SHType::None;
     return;
   }
 
@@ -0,0 +1,416 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#ifndef SH_CORE_INDEXED_MAP
+#define SH_CORE_INDEXED_MAP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace shards {
+// A hash map with stable entries and a deterministic iteration order.
+// Lookups go through an open addressing index (linear probing, backward shift deletion),
+// small maps skip the index and scan their few entries comparing cached hashes instead.
+// Iteration is either sorted by key (the default, sorting happens lazily before iterating)
+// or in insertion order. Entries never move, pointers to values stay valid until erased.
+template <typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>, typename Less = std::less<K>>
+struct IndexedMap {
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = std::pair<const K, V>;
+  using size_type = size_t;
+
+  // up to this many entries lookups are linear scans
+  static constexpr size_t SmallSize = 8;
+
+private:
+  struct Node {
+    template <typename KK, typename... VV>
+    Node(size_t hash, KK &&k, VV &&...v)
+        : kv(std::piecewise_construct, std::forward_as_tuple(std::forward<KK>(k)), std::forward_as_tuple(std::forward<VV>(v)...)),
+          hash(hash) {}
+
+    value_type kv;
+    size_t hash;
+    // position in _order, kept up to date when reordering
+    size_t pos;
+  };
+
+  template <typename MapT, typename ValueT> struct Iterator {
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = IndexedMap::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = ValueT *;
+    using reference = ValueT &;
+
+    Iterator() = default;
+    Iterator(MapT *map, Node *node) : _map(map), _node(node) {}
+    // const_iterator from iterator
+    template <typename OM, typename OV> Iterator(const Iterator<OM, OV> &other) : _map(other._map), _node(other._node) {}
+
+    reference operator*() const { return _node->kv; }
+    pointer operator->() const { return &_node->kv; }
+
+    Iterator &operator++() {
+      _node = _map->nextNode(_node->pos + 1);
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      auto res = *this;
+      ++(*this);
+      return res;
+    }
+
+    template <typename OM, typename OV> bool operator==(const Iterator<OM, OV> &other) const { return _node == other._node; }
+    template <typename OM, typename OV> bool operator!=(const Iterator<OM, OV> &other) const { return _node != other._node; }
+
+  private:
+    template <typename, typename> friend struct Iterator;
+    friend struct IndexedMap;
+
+    MapT *_map{nullptr};
+    Node *_node{nullptr};
+  };
+
+public:
+  using iterator = Iterator<const IndexedMap, value_type>;
+  using const_iterator = Iterator<const IndexedMap, const value_type>;
+
+  IndexedMap() = default;
+
+  IndexedMap(const IndexedMap &other) : _insertionOrder(other._insertionOrder) { copyFrom(other); }
+
+  IndexedMap(IndexedMap &&other) noexcept { swap(other); }
+
+  IndexedMap &operator=(const IndexedMap &other) {
+    if (this != &other) {
+      clear();
+      _insertionOrder = other._insertionOrder;
+      copyFrom(other);
+    }
+    return *this;
+  }
+
+  IndexedMap &operator=(IndexedMap &&other) noexcept {
+    if (this != &other) {
+      clear();
+      swap(other);
+    }
+    return *this;
+  }
+
+  ~IndexedMap() {
+    clear();
+    for (auto chunk : _chunks)
+      ::operator delete(chunk, std::align_val_t{alignof(Node)});
+  }
+
+  // Iterate in insertion order instead of sorting by key, only allowed while empty
+  void setInsertionOrder(bool enabled) {
+    assert(empty());
+    _insertionOrder = enabled;
+  }
+
+  bool insertionOrder() const { return _insertionOrder; }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  iterator begin() {
+    prepareIteration();
+    return iterator(this, nextNode(0));
+  }
+  iterator end() { return iterator(this, nullptr); }
+  const_iterator begin() const {
+    prepareIteration();
+    return const_iterator(this, nextNode(0));
+  }
+  const_iterator end() const { return const_iterator(this, nullptr); }
+  const_iterator cbegin() const { return begin(); }
+  const_iterator cend() const { return end(); }
+
+  iterator find(const K &key) { return iterator(this, findNode(key, Hash{}(key))); }
+  const_iterator find(const K &key) const { return const_iterator(this, findNode(key, Hash{}(key))); }
+
+  size_t count(const K &key) const { return findNode(key, Hash{}(key)) ? 1 : 0; }
+  bool contains(const K &key) const { return findNode(key, Hash{}(key)) != nullptr; }
+
+  V &at(const K &key) {
+    auto node = findNode(key, Hash{}(key));
+    if (!node)
+      throw std::out_of_range("IndexedMap::at");
+    return node->kv.second;
+  }
+
+  const V &at(const K &key) const {
+    auto node = findNode(key, Hash{}(key));
+    if (!node)
+      throw std::out_of_range("IndexedMap::at");
+    return node->kv.second;
+  }
+
+  V &operator[](const K &key) { return try_emplace(key).first->second; }
+
+  template <typename KK, typename... VV> std::pair<iterator, bool> try_emplace(KK &&key, VV &&...value) {
+    const auto hash = Hash{}(key);
+    if (auto node = findNode(key, hash))
+      return {iterator(this, node), false};
+    return {iterator(this, insertNode(hash, std::forward<KK>(key), std::forward<VV>(value)...)), true};
+  }
+
+  template <typename KK, typename... VV> std::pair<iterator, bool> emplace(KK &&key, VV &&...value) {
+    // the key might come in any form convertible to K, hash it as a K
+    if constexpr (std::is_same_v<std::decay_t<KK>, K>) {
+      return try_emplace(std::forward<KK>(key), std::forward<VV>(value)...);
+    } else {
+      return try_emplace(K(std::forward<KK>(key)), std::forward<VV>(value)...);
+    }
+  }
+
+  std::pair<iterator, bool> insert(const value_type &value) { return try_emplace(value.first, value.second); }
+
+  template <typename VV> std::pair<iterator, bool> insert_or_assign(const K &key, VV &&value) {
+    auto res = try_emplace(key);
+    res.first->second = std::forward<VV>(value);
+    return res;
+  }
+
+  size_t erase(const K &key) {
+    auto node = findNode(key, Hash{}(key));
+    if (!node)
+      return 0;
+    eraseNode(node);
+    return 1;
+  }
+
+  iterator erase(const_iterator it) {
+    auto node = it._node;
+    auto next = nextNode(node->pos + 1);
+    eraseNode(node);
+    return iterator(this, next);
+  }
+
+  void clear() {
+    for (auto node : _order) {
+      if (node)
+        destroyNode(node);
+    }
+    _order.clear();
+    _slots.clear();
+    _size = 0;
+    _unsorted.store(false, std::memory_order_relaxed);
+  }
+
+  void reserve(size_t count) {
+    _order.reserve(count);
+    if (count > SmallSize)
+      rehash(slotsFor(count));
+  }
+
+  void swap(IndexedMap &other) noexcept {
+    std::swap(_order, other._order);
+    std::swap(_slots, other._slots);
+    std::swap(_chunks, other._chunks);
+    std::swap(_free, other._free);
+    std::swap(_size, other._size);
+    std::swap(_nextChunkSize, other._nextChunkSize);
+    std::swap(_insertionOrder, other._insertionOrder);
+    auto unsorted = _unsorted.load(std::memory_order_relaxed);
+    _unsorted.store(other._unsorted.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    other._unsorted.store(unsorted, std::memory_order_relaxed);
+  }
+
+private:
+  static size_t slotsFor(size_t count) {
+    // keep the load factor under 3/4
+    size_t slots = 16;
+    while (slots * 3 < count * 4)
+      slots *= 2;
+    return slots;
+  }
+
+  Node *nextNode(size_t pos) const {
+    while (pos < _order.size()) {
+      if (_order[pos])
+        return _order[pos];
+      pos++;
+    }
+    return nullptr;
+  }
+
+  template <typename KK> Node *findNode(const KK &key, size_t hash) const {
+    if (_slots.empty()) {
+      for (auto node : _order) {
+        if (node && node->hash == hash && Eq{}(node->kv.first, key))
+          return node;
+      }
+      return nullptr;
+    }
+
+    const auto mask = _slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      auto node = _slots[i];
+      if (!node)
+        return nullptr;
+      if (node->hash == hash && Eq{}(node->kv.first, key))
+        return node;
+    }
+  }
+
+  void indexNode(Node *node) {
+    const auto mask = _slots.size() - 1;
+    size_t i = node->hash & mask;
+    while (_slots[i])
+      i = (i + 1) & mask;
+    _slots[i] = node;
+  }
+
+  void rehash(size_t slots) {
+    if (slots <= _slots.size())
+      return;
+    _slots.assign(slots, nullptr);
+    for (auto node : _order) {
+      if (node)
+        indexNode(node);
+    }
+  }
+
+  template <typename KK, typename... VV> Node *insertNode(size_t hash, KK &&key, VV &&...value) {
+    auto node = new (allocateNode()) Node(hash, std::forward<KK>(key), std::forward<VV>(value)...);
+
+    // drop erased holes before they outnumber live entries
+    if (_order.size() >= 2 * (_size + 1))
+      compact();
+
+    if (!_insertionOrder && !_unsorted.load(std::memory_order_relaxed)) {
+      // appending in key order is common (e.g. copying a table), stay sorted if we can
+      auto last = _order.empty() ? nullptr : _order.back();
+      if (last && !Less{}(last->kv.first, node->kv.first))
+        _unsorted.store(true, std::memory_order_relaxed);
+    }
+
+    node->pos = _order.size();
+    _order.push_back(node);
+    _size++;
+
+    if (_slots.empty() ? _size > SmallSize : _slots.size() * 3 < _size * 4)
+      rehash(slotsFor(_size));
+    else if (!_slots.empty())
+      indexNode(node);
+
+    return node;
+  }
+
+  void eraseNode(Node *node) {
+    if (!_slots.empty()) {
+      const auto mask = _slots.size() - 1;
+      size_t i = node->hash & mask;
+      while (_slots[i] != node)
+        i = (i + 1) & mask;
+      // backward shift, move later entries of the same probe run into the hole
+      size_t j = i;
+      while (true) {
+        j = (j + 1) & mask;
+        auto next = _slots[j];
+        if (!next)
+          break;
+        const auto home = next->hash & mask;
+        // next can fill the hole only if its home is not cyclically within (i, j]
+        if ((j > i && (home <= i || home > j)) || (j < i && (home <= i && home > j))) {
+          _slots[i] = next;
+          i = j;
+        }
+      }
+      _slots[i] = nullptr;
+    }
+
+    _order[node->pos] = nullptr;
+    // no holes at the back, insertNode checks sortedness against it
+    while (!_order.empty() && !_order.back())
+      _order.pop_back();
+    _size--;
+    destroyNode(node);
+  }
+
+  void compact() {
+    size_t pos = 0;
+    for (auto node : _order) {
+      if (node) {
+        node->pos = pos;
+        _order[pos++] = node;
+      }
+    }
+    _order.resize(pos);
+  }
+
+  // Sorts the entries if needed, iterators only keep nodes so they survive this
+  void prepareIteration() const {
+    if (!_unsorted.load(std::memory_order_acquire))
+      return;
+
+    // tables are often read from multiple threads, only one must sort
+    std::scoped_lock lock(_sortMutex);
+    if (!_unsorted.load(std::memory_order_relaxed))
+      return;
+
+    auto self = const_cast<IndexedMap *>(this);
+    self->compact();
+    std::sort(self->_order.begin(), self->_order.end(), [](Node *a, Node *b) { return Less{}(a->kv.first, b->kv.first); });
+    for (size_t i = 0; i < _order.size(); i++)
+      _order[i]->pos = i;
+    _unsorted.store(false, std::memory_order_release);
+  }
+
+  void *allocateNode() {
+    if (!_free.empty()) {
+      auto mem = _free.back();
+      _free.pop_back();
+      return mem;
+    }
+
+    // nodes come from geometrically growing chunks, freed nodes are recycled
+    auto chunkSize = _nextChunkSize;
+    auto chunk = (Node *)::operator new(sizeof(Node) * chunkSize, std::align_val_t{alignof(Node)});
+    _chunks.push_back(chunk);
+    _nextChunkSize = std::min<size_t>(chunkSize * 2, 256);
+    for (size_t i = chunkSize; i > 1; i--)
+      _free.push_back(&chunk[i - 1]);
+    return &chunk[0];
+  }
+
+  void destroyNode(Node *node) {
+    node->~Node();
+    _free.push_back(node);
+  }
+
+  void copyFrom(const IndexedMap &other) {
+    reserve(other.size());
+    for (auto node : other._order) {
+      if (node)
+        insertNode(node->hash, node->kv.first, node->kv.second);
+    }
+  }
+
+  std::vector<Node *> _order;
+  std::vector<Node *> _slots;
+  std::vector<Node *> _chunks;
+  std::vector<void *> _free;
+  size_t _size{0};
+  size_t _nextChunkSize{4};
+  bool _insertionOrder{false};
+  mutable std::atomic_bool _unsorted{false};
+  mutable std::mutex _sortMutex;
+};
+} // namespace shards
+
+#endif /* SH_CORE_INDEXED_MAP */
@@ -6,6 +6,10 @@
 namespace shards {
 ALWAYS_INLINE FLATTEN void setInlineShardId(Shard *shard, std::string_view name);
 ALWAYS_INLINE FLATTEN bool activateShardInline(Shard *blk, SHContext *context, const SHVar &input, SHVar &output);
+// Activates a run of adjacent inline shards as a single step, returns how many shards were consumed (0 if none),
+// a run stops at the first shard leaving the context in a non Continue state, which is the last one consumed
+ALWAYS_INLINE FLATTEN uint32_t activateShardsFused(Shard *const *shards, size_t len, SHContext *context, const SHVar &input,
+                                                   SHVar &output);
 }
 
 #endif /* F0D8A2DF_0D50_48F6_8E6E_C50BD8188B71 */
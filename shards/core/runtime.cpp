@@ -16,6 +16,7 @@
 #include <boost/asio/thread_pool.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/stacktrace.hpp>
+#include <condition_variable>
 #include <csignal>
 #include <cstdarg>
 #include <mutex>
@@ -23,11 +24,16 @@
 #include <shared_mutex>
 #include <stdexcept>
 #include <string.h>
+#include <thread>
 #include <unordered_set>
 #include <log/log.hpp>
 #include <shared_mutex>
 #include <boost/atomic/atomic_ref.hpp>
 #include <boost/container/small_vector.hpp>
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 namespace fs = boost::filesystem;
 
@@ -245,6 +251,240 @@ Shard *createShard(std::string_view name) {
   return shard;
 }
 
+std::shared_ptr<SHWire> WireCloner::clone(const std::shared_ptr<SHWire> &wire) {
+  auto it = _wires.find(wire.get());
+  if (it != _wires.end())
+    return it->second;
+
+  auto copy = SHWire::make(wire->name);
+  // register before cloning shards, recursive references must resolve to this same copy
+  _wires.emplace(wire.get(), copy);
+  copy->looped = wire->looped;
+  copy->unsafe = wire->unsafe;
+  copy->pure = wire->pure;
+  copy->stackSize = wire->stackSize;
+  if (wire->arena)
+    copy->arena = std::make_unique<IterationArena>();
+  for (auto shard : wire->shards) {
+    auto shardCopy = clone(shard);
+    copy->addShard(shardCopy);
+    // shard's owner is now the wire
+    decRef(shardCopy);
+  }
+  return copy;
+}
+
+ShardPtr WireCloner::clone(ShardPtr shard) {
+  auto name = shard->name(shard);
+  auto copy = createShard(name);
+  if (!copy) {
+    throw SHException(fmt::format("Shard not found! name: {}", name));
+  }
+  copy->setup(copy);
+
+  // only transfer what differs from the defaults, same as serialization does
+  auto params = shard->parameters(shard);
+  for (uint32_t i = 0; i < params.len; i++) {
+    auto idx = int32_t(i);
+    auto pval = shard->getParam(shard, idx);
+    if (pval == copy->getParam(copy, idx))
+      continue;
+    SHVar tmp{};
+    clone(pval, tmp);
+    copy->setParam(copy, idx, &tmp);
+    destroyVar(tmp);
+  }
+
+  if (shard->getState && copy->setState) {
+    SHVar state{};
+    clone(shard->getState(shard), state);
+    copy->setState(copy, &state);
+    destroyVar(state);
+  }
+
+  copy->line = shard->line;
+  copy->column = shard->column;
+  incRef(copy);
+  return copy;
+}
+
+void WireCloner::clone(const SHVar &input, SHVar &output) {
+  switch (input.valueType) {
+  case SHType::ShardRef:
+    destroyVar(output);
+    output.valueType = SHType::ShardRef;
+    output.payload.shardValue = clone(input.payload.shardValue);
+    break;
+  case SHType::Wire: {
+    destroyVar(output);
+    auto copy = clone(SHWire::sharedFromRef(input.payload.wireValue));
+    output.valueType = SHType::Wire;
+    output.payload.wireValue = copy->newRef();
+  } break;
+  case SHType::Seq: {
+    destroyVar(output);
+    output.valueType = SHType::Seq;
+    auto &src = input.payload.seqValue;
+    auto &dst = output.payload.seqValue;
+    arrayResize(dst, src.len);
+    for (uint32_t i = 0; i < src.len; i++) {
+      dst.elements[i] = SHVar{};
+      clone(src.elements[i], dst.elements[i]);
+    }
+  } break;
+  case SHType::Table: {
+    destroyVar(output);
+    output.valueType = SHType::Table;
+    output.payload.tableValue.api = &GetGlobals().TableInterface;
+    auto map = new SHMap();
+    output.payload.tableValue.opaque = map;
+
+    auto &t = input.payload.tableValue;
+    SHTableIterator tit;
+    t.api->tableGetIterator(t, &tit);
+    SHVar k;
+    SHVar v;
+    while (t.api->tableNext(t, &tit, &k, &v)) {
+      SHVar tmp{};
+      clone(v, tmp);
+      (*map)[k] = tmp;
+      destroyVar(tmp);
+    }
+  } break;
+  default:
+    cloneVar(output, input);
+    break;
+  }
+}
+
+namespace {
+struct StackPool {
+  // beyond this stacks are freed on release instead of cached
+  static constexpr size_t MaxCachedBytes = 64 * 1024 * 1024;
+
+  std::mutex mutex;
+  std::unordered_map<size_t, std::vector<SHStack>> free[2];
+  size_t cachedBytes{0};
+
+  static size_t pageSize() {
+#if defined(_WIN32) || defined(__EMSCRIPTEN__)
+    return 4096;
+#else
+    static const size_t size = size_t(sysconf(_SC_PAGESIZE));
+    return size;
+#endif
+  }
+
+  static SHStack allocate(size_t size, bool guarded) {
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    if (guarded) {
+      const auto page = pageSize();
+      // reserve only, pages get committed as the stack grows into them
+      auto base = (uint8_t *)mmap(nullptr, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                  -1, 0);
+      if (base == MAP_FAILED)
+        throw std::bad_alloc();
+      // stacks grow down, an overflow hits the guard and faults instead of corrupting the heap
+      if (mprotect(base, page, PROT_NONE) != 0) {
+        munmap(base, size + page);
+        throw std::bad_alloc();
+      }
+      return SHStack{base + page, size, true};
+    }
+#endif
+    return SHStack{new (std::align_val_t{16}) uint8_t[size], size, false};
+  }
+
+  static void deallocate(const SHStack &stack) {
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    if (stack.guarded) {
+      const auto page = pageSize();
+      munmap(stack.mem - page, stack.size + page);
+      return;
+    }
+#endif
+    ::operator delete[](stack.mem, std::align_val_t{16});
+  }
+
+  SHStack acquire(size_t size, bool guarded) {
+    if (guarded) {
+      const auto page = pageSize();
+      size = (size + page - 1) & ~(page - 1);
+    }
+    {
+      std::scoped_lock lock(mutex);
+      auto it = free[guarded].find(size);
+      if (it != free[guarded].end() && !it->second.empty()) {
+        auto stack = it->second.back();
+        it->second.pop_back();
+        cachedBytes -= stack.size;
+        return stack;
+      }
+    }
+    return allocate(size, guarded);
+  }
+
+  void release(const SHStack &stack) {
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+    if (stack.guarded) {
+      // give the touched pages back to the OS, they are recommitted lazily on reuse
+#ifdef MADV_FREE
+      madvise(stack.mem, stack.size, MADV_FREE);
+#else
+      madvise(stack.mem, stack.size, MADV_DONTNEED);
+#endif
+    }
+#endif
+    {
+      std::scoped_lock lock(mutex);
+      if (cachedBytes + stack.size <= MaxCachedBytes) {
+        free[stack.guarded][stack.size].push_back(stack);
+        cachedBytes += stack.size;
+        return;
+      }
+    }
+    deallocate(stack);
+  }
+
+  size_t trim() {
+    std::scoped_lock lock(mutex);
+    auto res = cachedBytes;
+    for (auto &buckets : free) {
+      for (auto &[_, stacks] : buckets) {
+        for (auto &stack : stacks)
+          deallocate(stack);
+      }
+      buckets.clear();
+    }
+    cachedBytes = 0;
+    return res;
+  }
+};
+
+StackPool &getStackPool() {
+  // leaked on purpose, wires might be destroyed during static destruction
+  static StackPool *pool = new StackPool();
+  return *pool;
+}
+} // namespace
+
+SHStack acquireStack(size_t size, bool guarded) { return getStackPool().acquire(size, guarded); }
+
+void releaseStack(SHStack &stack) {
+  getStackPool().release(stack);
+  stack = SHStack{};
+}
+
+size_t trimStackPool() { return getStackPool().trim(); }
+
+size_t wireStackSize(SHWire *wire) {
+  if (wire->stackSize)
+    return wire->stackSize;
+  if (auto mesh = wire->mesh.lock(); mesh && mesh->stackSize)
+    return mesh->stackSize;
+  return GetGlobals().StackSize;
+}
+
 inline void setupRegisterLogging() {
 #if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
   logging::setupDefaultLoggerConditional();
@@ -543,6 +783,35 @@ create:
   return &cv;
 }
 
+SHVar *referenceVariable(SHContext *ctx, std::string_view name, VariableSlot &slot) {
+  auto wire = ctx->currentWire();
+  if (unlikely(slot.wire != wire)) {
+    static thread_local std::string nameStr;
+    nameStr.clear();
+    nameStr.append(name.data(), name.size());
+
+    auto [it, inserted] = wire->variableSlotIndices.emplace(nameStr, uint32_t(wire->variableSlots.size()));
+    if (inserted) {
+      wire->variableSlots.push_back(nullptr);
+    }
+    slot.wire = wire;
+    slot.index = it->second;
+  }
+
+  auto &resolved = wire->variableSlots[slot.index];
+  if (resolved) {
+    // same bookkeeping as referenceVariable
+    if ((resolved->flags & SHVAR_FLAGS_EXTERNAL) == 0) {
+      resolved->refcount++;
+      resolved->flags |= SHVAR_FLAGS_REF_COUNTED;
+    }
+    return resolved;
+  }
+
+  resolved = referenceVariable(ctx, name);
+  return resolved;
+}
+
 void releaseVariable(SHVar *variable) {
   if (!variable)
     return;
@@ -614,6 +883,8 @@ void hash_update(const SHVar &var, void *state);
 SH_WIRE_SET_STACK(gathering);
 SH_WIRE_SET_STACK(hashing);
 
+ALWAYS_INLINE inline bool profiling(SHContext *context) { return context->profiler && context->profiler->enabled(); }
+
 template <typename T, bool HANDLES_RETURN, bool HASHED>
 ALWAYS_INLINE SHWireState shardsActivation(T &shards, SHContext *context, const SHVar &wireInput, SHVar &output,
                                            SHVar *outHash = nullptr) noexcept {
@@ -673,11 +944,37 @@ ALWAYS_INLINE SHWireState shardsActivation(T &shards, SHContext *context, const
         hash_update(param, &hashState);
       }
 
-      output = activateShard(blk, context, input);
+      output = unlikely(profiling(context)) ? context->profiler->activate(blk, context, input)
+                                            : activateShard(blk, context, input);
       SHLOG_TRACE("Hashing output {}", output);
       hash_update(output, &hashState);
+    } else if constexpr (std::is_same<T, Shards>::value || std::is_same<T, std::vector<ShardPtr>>::value) {
+      if (unlikely(profiling(context))) {
+        // profiled runs go shard by shard, so that each one gets its own entry
+        output = context->profiler->activate(blk, context, input);
+      } else {
+#ifdef TRACY_ENABLE
+        // no fusion, every shard keeps its own zone
+        output = activateShard(blk, context, input);
+#else
+        // fused runs count as a single activation, skip the shards they consumed
+        ShardPtr *run;
+        if constexpr (std::is_same<T, Shards>::value)
+          run = shards.elements + i;
+        else
+          run = shards.data() + i;
+        if (const auto fused = activateShardsFused(run, len - i, context, input, output)) {
+          i += fused - 1;
+          // a failed run stops at the shard that failed, report that one
+          blk = run[fused - 1];
+        } else {
+          output = activateShard(blk, context, input);
+        }
+#endif
+      }
     } else {
-      output = activateShard(blk, context, input);
+      output = unlikely(profiling(context)) ? context->profiler->activate(blk, context, input)
+                                            : activateShard(blk, context, input);
     }
 
     // Deal with aftermath of activation
@@ -735,6 +1032,131 @@ SHWireState activateShards2(Shards shards, SHContext *context, const SHVar &wire
   return shardsActivation<Shards, true, true>(shards, context, wireInput, output, &outHash);
 }
 
+// Dedicated threads rather than a work-stealing pool, coroutines rely on thread locals (wire stacks,
+// variable caches) so a flow must be resumed by the same thread every tick
+struct MeshExecutor {
+  MeshExecutor(size_t workers) : queues(workers) {
+    for (size_t i = 0; i < workers; i++)
+      threads.emplace_back([this, i]() { run(i); });
+  }
+
+  ~MeshExecutor() {
+    {
+      std::scoped_lock lock(mutex);
+      quit = true;
+    }
+    cv.notify_all();
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  void tick(const std::vector<SHFlow *> &flows, SHDuration tickTime) {
+    for (auto &queue : queues)
+      queue.clear();
+    for (auto flow : flows)
+      queues[size_t(flow->wire->meshWorker) % queues.size()].push_back(flow);
+
+    dispatch(tickTime);
+  }
+
+  // Runs fn on the given worker and waits for it, rethrowing what it threw
+  void call(size_t worker, const std::function<void()> &fn) {
+    for (auto &queue : queues)
+      queue.clear();
+
+    task = &fn;
+    taskWorker = worker % queues.size();
+    taskError = nullptr;
+    DEFER(task = nullptr);
+
+    dispatch(now);
+
+    if (taskError)
+      std::rethrow_exception(taskError);
+  }
+
+  void dispatch(SHDuration tickTime) {
+    {
+      std::scoped_lock lock(mutex);
+      now = tickTime;
+      pending = queues.size();
+      generation++;
+    }
+    cv.notify_all();
+
+    std::unique_lock lock(mutex);
+    doneCv.wait(lock, [this]() { return pending == 0; });
+  }
+
+  void run(size_t index) {
+    uint64_t seen = 0;
+    while (true) {
+      SHDuration tickTime;
+      {
+        std::unique_lock lock(mutex);
+        cv.wait(lock, [&]() { return quit || generation != seen; });
+        if (quit)
+          return;
+        seen = generation;
+        tickTime = now;
+      }
+
+      if (task && taskWorker == index) {
+        try {
+          (*task)();
+        } catch (...) {
+          taskError = std::current_exception();
+        }
+      }
+
+      for (auto flow : queues[index]) {
+        try {
+          shards::tick(flow->wire, tickTime);
+        } catch (const std::exception &e) {
+          SHLOG_ERROR("Concurrent tick of wire {} failed: {}", flow->wire->name, e.what());
+        }
+      }
+
+      std::scoped_lock lock(mutex);
+      if (--pending == 0)
+        doneCv.notify_one();
+    }
+  }
+
+  std::vector<std::thread> threads;
+  // flows of this tick, by worker, only touched by the ticking thread between ticks
+  std::vector<std::vector<SHFlow *>> queues;
+  // work for a single worker (see call), same ownership as queues
+  const std::function<void()> *task{nullptr};
+  size_t taskWorker{0};
+  std::exception_ptr taskError;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::condition_variable doneCv;
+  uint64_t generation{0};
+  size_t pending{0};
+  SHDuration now{};
+  bool quit{false};
+};
+
+std::shared_ptr<MeshExecutor> makeMeshExecutor(size_t workers) {
+  SHLOG_DEBUG("Creating mesh executor with {} workers", workers);
+  return std::make_shared<MeshExecutor>(workers);
+}
+
+void tickConcurrently(MeshExecutor &executor, const std::vector<SHFlow *> &flows, SHDuration now) {
+  ZoneScoped;
+
+  // every flow goes to the worker it is pinned to, see SHWire::meshWorker
+  executor.tick(flows, now);
+}
+
+void runOnWorker(MeshExecutor &executor, int32_t worker, const std::function<void()> &fn) {
+  ZoneScoped;
+
+  executor.call(size_t(worker), fn);
+}
+
 // Lazy and also avoid windows Loader (Dead)Lock
 // https://docs.microsoft.com/en-us/windows/win32/dlls/dynamic-link-library-best-practices?redirectedfrom=MSDN
 Shared<boost::asio::thread_pool, SharedThreadPoolConcurrency> SharedThreadPool{};
@@ -1758,6 +2180,14 @@ Wire &Wire::stackSize(size_t stackSize) {
   return *this;
 }
 
+Wire &Wire::arena(bool enabled) {
+  if (enabled && !_wire->arena)
+    _wire->arena = std::make_unique<IterationArena>();
+  else if (!enabled)
+    _wire->arena.reset();
+  return *this;
+}
+
 Wire &Wire::name(std::string_view name) {
   _wire->name = name;
   return *this;
@@ -1795,10 +2225,205 @@ SHWireRef Wire::weakRef() const { return SHWire::weakRef(_wire); }
 
 Var::Var(const Wire &wire) : Var(wire.weakRef()) {}
 
+namespace {
+std::atomic<uint64_t> nextProfilerId{1};
+
+// last tree used by this thread, keyed by profiler id as addresses get reused
+struct LocalProfilerTree {
+  uint64_t id;
+  ShardProfiler::Tree *tree;
+};
+thread_local LocalProfilerTree localProfilerTree{};
+
+inline uint64_t profilerNow() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// collapsed stacks separate frames with ';' and the value with a space
+std::string profilerFrameName(std::string_view name) {
+  std::string res(name);
+  for (auto &c : res) {
+    if (c == ';' || c == ' ')
+      c = '_';
+  }
+  return res;
+}
+} // namespace
+
+ShardProfiler::ShardProfiler() : _id(nextProfilerId++) {}
+
+ShardProfiler::Tree *ShardProfiler::localTree() {
+  if (likely(localProfilerTree.id == _id))
+    return localProfilerTree.tree;
+
+  std::scoped_lock lock(_mutex);
+  auto &tree = _trees[std::this_thread::get_id()];
+  if (!tree)
+    tree = std::make_unique<Tree>();
+  localProfilerTree = {_id, tree.get()};
+  return tree.get();
+}
+
+uint32_t ShardProfiler::rootOf(Tree *tree, SHContext *context) {
+  auto name = context->main ? profilerFrameName(context->main->name) : std::string("<anonymous>");
+  auto it = tree->roots.find(name);
+  if (it != tree->roots.end())
+    return it->second;
+
+  const auto index = uint32_t(tree->nodes.size());
+  tree->nodes.push_back(Node{name, index});
+  tree->roots.emplace(std::move(name), index);
+  return index;
+}
+
+uint32_t ShardProfiler::child(Tree *tree, uint32_t parent, Shard *shard) {
+  for (auto &[key, index] : tree->nodes[parent].children) {
+    if (key == shard)
+      return index;
+  }
+
+  const auto index = uint32_t(tree->nodes.size());
+  tree->nodes.push_back(Node{profilerFrameName(shard->name(shard)), parent});
+  tree->nodes[parent].children.emplace_back(shard, index);
+  return index;
+}
+
+// The wire moved to another thread, find the same path in that thread's tree
+void ShardProfiler::rebind(Stack &stack, Tree *tree, SHContext *context) {
+  std::scoped_lock lock(tree->mutex);
+  stack.tree = tree;
+  stack.root = rootOf(tree, context);
+  auto parent = stack.root;
+  for (auto &frame : stack.frames) {
+    frame.node = child(tree, parent, frame.shard);
+    parent = frame.node;
+  }
+}
+
+void ShardProfiler::enter(Stack &stack, Shard *shard, SHContext *context) {
+  auto tree = localTree();
+  if (stack.tree != tree)
+    rebind(stack, tree, context);
+
+  uint32_t node;
+  {
+    std::scoped_lock lock(tree->mutex);
+    node = child(tree, stack.frames.empty() ? stack.root : stack.frames.back().node, shard);
+  }
+  stack.frames.push_back(Frame{shard, node, tree, profilerNow(), varAllocations, 0, 0});
+}
+
+void ShardProfiler::leave(Stack &stack, SHContext *context) {
+  const auto end = profilerNow();
+  auto tree = localTree();
+  if (stack.tree != tree)
+    rebind(stack, tree, context);
+
+  auto frame = stack.frames.back();
+  stack.frames.pop_back();
+
+  const auto elapsed = end - frame.start;
+  // the allocation counter is per thread, can't tell what happened if the wire moved meanwhile
+  const auto allocations = frame.origin == tree ? varAllocations - frame.allocations : 0;
+  if (!stack.frames.empty()) {
+    auto &parent = stack.frames.back();
+    parent.childNs += elapsed;
+    parent.childAllocations += allocations;
+  }
+
+  std::scoped_lock lock(tree->mutex);
+  auto &node = tree->nodes[frame.node];
+  node.calls++;
+  node.inclusiveNs += elapsed;
+  node.exclusiveNs += elapsed > frame.childNs ? elapsed - frame.childNs : 0;
+  node.allocations += allocations > frame.childAllocations ? allocations - frame.childAllocations : 0;
+}
+
+SHVar ShardProfiler::activate(Shard *shard, SHContext *context, const SHVar &input) {
+  auto &stack = context->profileStack;
+  if (stack.suppressed > 0 ||
+      (stack.frames.empty() && (stack.ticks++ % _sampleEvery.load(std::memory_order_relaxed)) != 0)) {
+    // not sampled, nested activations must not be recorded either
+    stack.suppressed++;
+    DEFER(stack.suppressed--);
+    return activateShard(shard, context, input);
+  }
+
+  enter(stack, shard, context);
+  DEFER(leave(stack, context));
+  return activateShard(shard, context, input);
+}
+
+void ShardProfiler::reset() {
+  std::scoped_lock lock(_mutex);
+  for (auto &[_, tree] : _trees) {
+    std::scoped_lock treeLock(tree->mutex);
+    for (auto &node : tree->nodes) {
+      node.calls = 0;
+      node.inclusiveNs = 0;
+      node.exclusiveNs = 0;
+      node.allocations = 0;
+    }
+  }
+}
+
+std::map<std::string, ShardProfiler::Totals> ShardProfiler::merge() {
+  std::map<std::string, Totals> totals;
+  std::scoped_lock lock(_mutex);
+  for (auto &[_, tree] : _trees) {
+    std::scoped_lock treeLock(tree->mutex);
+    // parents always come before their children
+    std::vector<std::string> paths(tree->nodes.size());
+    for (size_t i = 0; i < tree->nodes.size(); i++) {
+      auto &node = tree->nodes[i];
+      paths[i] = node.parent == i ? node.name : paths[node.parent] + ";" + node.name;
+      if (node.calls == 0)
+        continue;
+
+      auto &total = totals[paths[i]];
+      total.shard = node.name;
+      total.calls += node.calls;
+      total.inclusiveNs += node.inclusiveNs;
+      total.exclusiveNs += node.exclusiveNs;
+      total.allocations += node.allocations;
+    }
+  }
+  return totals;
+}
+
+void ShardProfiler::results(SeqVar &output) {
+  output.clear();
+  for (auto &[path, total] : merge()) {
+    TableVar entry;
+    entry[Var("Path")] = Var(path);
+    entry[Var("Shard")] = Var(total.shard);
+    entry[Var("Calls")] = Var(int64_t(total.calls));
+    entry[Var("InclusiveNs")] = Var(int64_t(total.inclusiveNs));
+    entry[Var("ExclusiveNs")] = Var(int64_t(total.exclusiveNs));
+    entry[Var("Allocations")] = Var(int64_t(total.allocations));
+    output.push_back(entry);
+  }
+}
+
+std::string ShardProfiler::collapsed() {
+  std::string res;
+  for (auto &[path, total] : merge()) {
+    res += path;
+    res += ' ';
+    res += std::to_string(total.exclusiveNs);
+    res += '\n';
+  }
+  return res;
+}
+
 SHRunWireOutput runWire(SHWire *wire, SHContext *context, const SHVar &wireInput) {
   ZoneScoped;
   ZoneName(wire->name.c_str(), wire->name.size());
 
+  // values of the previous iteration are dead past this point, unless this is a re-entrant run
+  if (wire->arena && wire->state != SHWire::State::Iterating)
+    wire->arena->reset();
+
   memset(&wire->previousOutput, 0x0, sizeof(SHVar));
   wire->currentInput = wireInput;
   wire->state = SHWire::State::Iterating;
@@ -1876,6 +2501,9 @@ void run(SHWire *wire, SHFlow *flow, SHCoro *coro)
     context.wireStack.push_back(wire);
   }
 
+  if (auto mesh = wire->mesh.lock())
+    context.profiler = mesh->profiler;
+
   // also populate context in wire
   wire->context = &context;
 
@@ -2011,34 +2639,142 @@ EventDispatcher &getEventDispatcher(const std::string &name) {
   }
 }
 
+EventBuffer::EventBuffer(size_t capacity) {
+  for (auto &buffer : slots)
+    buffer.resize(std::max(size_t(1), capacity));
+}
+
+EventBuffer::~EventBuffer() {
+  for (auto &buffer : slots) {
+    for (auto &slot : buffer)
+      destroyVar(slot);
+  }
+}
+
+void EventBuffer::swap() {
+  auto &buffer = slots[back];
+  const auto count = sent[back];
+  if (count > buffer.size()) {
+    // wrapped around, put the oldest event first so that the frame reads in order
+    dropped += count - buffer.size();
+    std::rotate(buffer.begin(), buffer.begin() + (count % buffer.size()), buffer.end());
+  }
+  back ^= 1;
+  // the slots keep their memory, the next frame clones over them
+  sent[back] = 0;
+}
+
+EventBuffer &EventDispatcher::buffer(entt::id_type id) {
+  std::scoped_lock lock(_mutex);
+  return _buffers.try_emplace(id, capacity).first->second;
+}
+
+void EventDispatcher::update() {
+  std::scoped_lock lock(_mutex);
+  for (auto &[_, buffer] : _buffers)
+    buffer.swap();
+  frame++;
+}
+
+namespace {
+// Payloads are freely memcpy'd around (seq growth, tables, the C ABI), storing them inside the SHVar itself
+// would leave dangling self pointers, so small buffers are recycled instead
+struct VarBufferCache {
+  static constexpr uint32_t MinClass = 16;
+  static constexpr uint32_t NumClasses = 4; // 16, 32, 64, 128
+  static constexpr uint32_t MaxCached = 128;
+
+  uint8_t *free[NumClasses][MaxCached];
+  uint32_t count[NumClasses];
+  bool initialized;
+  bool dead;
+
+  static uint32_t classOf(uint32_t size) {
+    uint32_t index = 0;
+    uint32_t classSize = MinClass;
+    while (classSize < size) {
+      classSize <<= 1;
+      index++;
+    }
+    return index;
+  }
+
+  void flush() {
+    for (uint32_t i = 0; i < NumClasses; i++) {
+      while (count[i] > 0)
+        delete[] free[i][--count[i]];
+    }
+  }
+};
+
+// trivially destructible so it can still be reached by vars destroyed during thread exit
+thread_local VarBufferCache varBufferCache;
+
+struct VarBufferCacheGuard {
+  ~VarBufferCacheGuard() {
+    varBufferCache.flush();
+    varBufferCache.dead = true;
+  }
+};
+
+VarBufferCache *getVarBufferCache() {
+  auto &cache = varBufferCache;
+  if (!cache.initialized) {
+    if (cache.dead)
+      return nullptr;
+    static thread_local VarBufferCacheGuard guard;
+    (void)guard;
+    cache.initialized = true;
+  }
+  return &cache;
+}
+} // namespace
+
+thread_local uint64_t varAllocations{0};
+std::atomic<uint32_t> enabledProfilers{0};
+
+uint8_t *allocVarBuffer(uint32_t &size) {
+  countVarAllocation();
+
+  constexpr auto MaxClassSize = VarBufferCache::MinClass << (VarBufferCache::NumClasses - 1);
+  if (size > MaxClassSize)
+    return new uint8_t[size];
+
+  const auto index = VarBufferCache::classOf(size);
+  size = VarBufferCache::MinClass << index;
+  auto cache = getVarBufferCache();
+  if (cache && cache->count[index] > 0)
+    return cache->free[index][--cache->count[index]];
+  return new uint8_t[size];
+}
+
+void freeVarBuffer(void *buffer, uint32_t size) {
+  constexpr auto MaxClassSize = VarBufferCache::MinClass << (VarBufferCache::NumClasses - 1);
+  // only exact class sizes came from allocVarBuffer's cacheable path
+  if (size >= VarBufferCache::MinClass && size <= MaxClassSize && (size & (size - 1)) == 0) {
+    const auto index = VarBufferCache::classOf(size);
+    auto cache = getVarBufferCache();
+    if (cache && cache->count[index] < VarBufferCache::MaxCached) {
+      cache->free[index][cache->count[index]++] = (uint8_t *)buffer;
+      return;
+    }
+  }
+  delete[] (uint8_t *)buffer;
+}
+
 NO_INLINE void _destroyVarSlow(SHVar &var) {
   switch (var.valueType) {
   case SHType::String:
   case SHType::Path:
   case SHType::ContextVar:
-#if 0
-    assert(var.payload.stringCapacity >= 7 && "string capacity is too small, it should be at least 7");
-    if (var.payload.stringCapacity > 7) {
+    // capacity doesn't include the 0 terminator
+    if (var.payload.stringCapacity > 0)
+      freeVarBuffer((void *)var.payload.stringValue, var.payload.stringCapacity + 1);
+    else
       delete[] var.payload.stringValue;
-    } else {
-      memset(var.shortString, 0, 7);
-      assert(var.shortString[7] == 0 && "0 terminator should be 0 always");
-    }
-#else
-    delete[] var.payload.stringValue;
-#endif
     break;
   case SHType::Bytes:
-#if 0
-    assert(var.payload.bytesCapacity >= 8 && "bytes capacity is too small, it should be at least 8");
-    if (var.payload.bytesCapacity > 8) {
-      delete[] var.payload.bytesValue;
-    } else {
-      memset(var.shortBytes, 0, 8);
-    }
-#else
-    delete[] var.payload.bytesValue;
-#endif
+    freeVarBuffer(var.payload.bytesValue, var.payload.bytesCapacity);
     break;
   case SHType::Seq: {
     // notice we use .cap! because we make sure to 0 new empty elements
@@ -2074,6 +2810,9 @@ NO_INLINE void _destroyVarSlow(SHVar &var) {
 
 NO_INLINE void _cloneVarSlow(SHVar &dst, const SHVar &src) {
   assert((dst.flags & SHVAR_FLAGS_FOREIGN) != SHVAR_FLAGS_FOREIGN && "cannot clone into a foreign var");
+  // arena memory can't be grown nor reused
+  if (unlikely((dst.flags & SHVAR_FLAGS_ARENA) == SHVAR_FLAGS_ARENA))
+    destroyVar(dst);
   switch (src.valueType) {
   case SHType::Seq: {
     uint32_t srcLen = src.payload.seqValue.len;
@@ -2102,19 +2841,10 @@ NO_INLINE void _cloneVarSlow(SHVar &dst, const SHVar &src) {
     if (dst.valueType != src.valueType || dst.payload.stringCapacity < srcSize) {
       destroyVar(dst);
       dst.valueType = src.valueType;
-#if 0
-      if (srcSize <= 7) {
-        // short string, no need to allocate
-        // capacity is 8 but last is 0 terminator
-        dst.payload.stringValue = dst.shortString;
-        dst.payload.stringCapacity = 7; // this also marks it as short string, lucky 7
-      } else
-#endif
-      {
-        // allocate a 0 terminator too
-        dst.payload.stringValue = new char[srcSize + 1];
-        dst.payload.stringCapacity = srcSize;
-      }
+      // allocate a 0 terminator too
+      uint32_t size = srcSize + 1;
+      dst.payload.stringValue = (char *)allocVarBuffer(size);
+      dst.payload.stringCapacity = size - 1;
     } else {
       if (src.payload.stringValue == dst.payload.stringValue && src.payload.stringLen == dst.payload.stringLen)
         return;
@@ -2268,17 +2998,9 @@ NO_INLINE void _cloneVarSlow(SHVar &dst, const SHVar &src) {
     if (dst.valueType != SHType::Bytes || dst.payload.bytesCapacity < src.payload.bytesSize) {
       destroyVar(dst);
       dst.valueType = SHType::Bytes;
-#if 0
-      if (src.payload.bytesSize <= 8) {
-        // small bytes are stored directly in the payload
-        dst.payload.bytesValue = dst.shortBytes;
-        dst.payload.bytesCapacity = 8;
-      } else
-#endif
-      {
-        dst.payload.bytesValue = new uint8_t[src.payload.bytesSize];
-        dst.payload.bytesCapacity = src.payload.bytesSize;
-      }
+      uint32_t size = src.payload.bytesSize;
+      dst.payload.bytesValue = allocVarBuffer(size);
+      dst.payload.bytesCapacity = size;
     } else {
       if (src.payload.bytesValue == dst.payload.bytesValue && src.payload.bytesSize == dst.payload.bytesSize)
         return;
@@ -2715,8 +3437,8 @@ void SHWire::destroy() {
     n->visitedWires.erase(this);
   }
 
-  if (stackMem) {
-    ::operator delete[](stackMem, std::align_val_t{16});
+  if (stack.mem) {
+    releaseStack(stack);
   }
 }
 
@@ -2801,6 +3523,8 @@ void SHWire::cleanup(bool force) {
       }
     }
     variables.clear();
+    // resolved slots might point to the variables we just cleared, resolve again on next warmup
+    std::fill(variableSlots.begin(), variableSlots.end(), nullptr);
 
     // finally reset the mesh
     auto n = mesh.lock();
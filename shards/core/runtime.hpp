@@ -16,11 +16,18 @@
 #include "foundation.hpp"
 #include "inline.hpp"
 
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <list>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -118,6 +125,100 @@ const unsigned __tsan_switch_to_fiber_no_sync = 1 << 0;
   if (_suspend_state != SHWireState::Continue)                \
   return shards::Var::Empty
 
+namespace shards {
+// Per shard call counts, inclusive/exclusive times and var allocations aggregated by call path.
+// Owned by a mesh and switched at run-time, when disabled activations only pay an atomic load.
+// Times are wall clock, a shard suspending its wire includes the time spent suspended.
+struct ShardProfiler {
+  struct Node {
+    std::string name;
+    uint32_t parent;
+    uint64_t calls{};
+    uint64_t inclusiveNs{};
+    uint64_t exclusiveNs{};
+    uint64_t allocations{};
+    std::vector<std::pair<const void *, uint32_t>> children;
+  };
+
+  // One call tree per thread, so recording never contends, merged by path when reporting
+  struct Tree {
+    std::mutex mutex;
+    std::vector<Node> nodes;
+    std::unordered_map<std::string, uint32_t> roots;
+  };
+
+  struct Frame {
+    Shard *shard;
+    uint32_t node;
+    Tree *origin;
+    uint64_t start;
+    uint64_t allocations;
+    uint64_t childNs;
+    uint64_t childAllocations;
+  };
+
+  // Lives in each SHContext, coroutines interleave wires on a thread so the path can't be thread local
+  struct Stack {
+    std::vector<Frame> frames;
+    Tree *tree{};
+    uint32_t root{};
+    uint32_t suppressed{};
+    uint64_t ticks{};
+  };
+
+  ShardProfiler();
+  ~ShardProfiler() { enable(false); }
+
+  // sampleEvery > 1 only records one every N top level activations of a context
+  void enable(bool enabled, uint32_t sampleEvery = 1) {
+    _sampleEvery = std::max<uint32_t>(sampleEvery, 1);
+    if (_enabled.exchange(enabled, std::memory_order_acq_rel) != enabled) {
+      // allocations are only counted while some profiler needs them
+      if (enabled)
+        enabledProfilers.fetch_add(1, std::memory_order_relaxed);
+      else
+        enabledProfilers.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+  // Zeroes every counter, paths already seen are kept
+  void reset();
+
+  SHVar activate(Shard *shard, SHContext *context, const SHVar &input);
+
+  // A sequence of tables, one per call path: Path, Shard, Calls, InclusiveNs, ExclusiveNs, Allocations
+  void results(SeqVar &output);
+
+  // Collapsed stacks ("wire;Shard;Shard exclusiveNs" lines), as consumed by flamegraph tools
+  std::string collapsed();
+
+private:
+  Tree *localTree();
+  void rebind(Stack &stack, Tree *tree, SHContext *context);
+  uint32_t child(Tree *tree, uint32_t parent, Shard *shard);
+  uint32_t rootOf(Tree *tree, SHContext *context);
+  void enter(Stack &stack, Shard *shard, SHContext *context);
+  void leave(Stack &stack, SHContext *context);
+
+  struct Totals {
+    std::string shard;
+    uint64_t calls{};
+    uint64_t inclusiveNs{};
+    uint64_t exclusiveNs{};
+    uint64_t allocations{};
+  };
+  std::map<std::string, Totals> merge();
+
+  const uint64_t _id;
+  std::atomic_bool _enabled{false};
+  std::atomic<uint32_t> _sampleEvery{1};
+  std::mutex _mutex;
+  std::unordered_map<std::thread::id, std::unique_ptr<Tree>> _trees;
+};
+} // namespace shards
+
 struct SHContext {
   SHContext(
 #ifndef __EMSCRIPTEN__
@@ -144,6 +245,10 @@ struct SHContext {
 
   std::unordered_map<std::string, std::weak_ptr<entt::any>> anyStorage;
 
+  // the profiler of the mesh running this context, if any
+  std::shared_ptr<shards::ShardProfiler> profiler;
+  shards::ShardProfiler::Stack profileStack;
+
 // Used within the coro& stack! (suspend, etc)
 #ifndef __EMSCRIPTEN__
   SHCoro &&continuation;
@@ -151,6 +256,8 @@ struct SHContext {
   SHCoro *continuation{nullptr};
 #endif
   SHDuration next{};
+  // set while suspended with a deadline that wakeAwaiting can also cut short (e.g. waiting on a channel with a timeout)
+  bool wakeable{false};
 
   SHWire *currentWire() const { return wireStack.back(); }
 
@@ -261,6 +368,12 @@ FLATTEN ALWAYS_INLINE inline SHVar activateShard(Shard *blk, SHContext *context,
   return output;
 }
 
+// Scratch memory of the running wire iteration, nullptr unless the wire opted in (SHWire::arena)
+inline IterationArena *iterationArena(SHContext *context) {
+  auto wire = context->currentWire();
+  return wire ? wire->arena.get() : nullptr;
+}
+
 SHRunWireOutput runWire(SHWire *wire, SHContext *context, const SHVar &wireInput);
 
 inline SHRunWireOutput runSubWire(SHWire *wire, SHContext *context, const SHVar &input) {
@@ -285,6 +398,14 @@ void tracyInit();
 UntrackedVector<SHWire *> &getCoroWireStack();
 #endif
 
+// Global pool recycling coroutine stacks across wire start/stop, stacks are bucketed by size
+SHStack acquireStack(size_t size, bool guarded);
+void releaseStack(SHStack &stack);
+// Frees every cached stack, returns the amount of bytes released
+size_t trimStackPool();
+// The effective stack size of a wire: its own, its mesh's or the global default
+size_t wireStackSize(SHWire *wire);
+
 inline void prepare(SHWire *wire, SHFlow *flow) {
   if (wire->coro)
     return;
@@ -292,14 +413,14 @@ inline void prepare(SHWire *wire, SHFlow *flow) {
   TracyCoroEnter(wire);
 
 #ifndef __EMSCRIPTEN__
-  if (!wire->stackMem) {
-    wire->stackMem = new (std::align_val_t{16}) uint8_t[wire->stackSize];
+  if (!wire->stack.mem) {
+    wire->stack = acquireStack(wireStackSize(wire), GetGlobals().GuardedStacks);
   }
   wire->coro =
-      boost::context::callcc(std::allocator_arg, SHStackAllocator{wire->stackSize, wire->stackMem},
+      boost::context::callcc(std::allocator_arg, SHStackAllocator{wire->stack.size, wire->stack.mem},
                              [wire, flow](boost::context::continuation &&sink) { return run(wire, flow, std::move(sink)); });
 #else
-  wire->coro.emplace(wire->stackSize);
+  wire->coro.emplace(wireStackSize(wire));
   wire->coro->init([=]() { run(wire, flow, &(*wire->coro)); });
   wire->coro->resume();
 #endif
@@ -350,6 +471,12 @@ inline bool stop(SHWire *wire, SHVar *result = nullptr) {
 
     // delete also the coro ptr
     wire->coro.reset();
+
+#ifndef __EMSCRIPTEN__
+    // nothing runs on the stack anymore, let other wires use it while we are stopped
+    if (wire->stack.mem)
+      releaseStack(wire->stack);
+#endif
   } else {
     // if we had a coro this will run inside it!
     wire->cleanup(true);
@@ -454,6 +581,14 @@ inline void sleep(double seconds = -1.0, bool runCallbacks = true) {
     FrameMarkNamed("Main Shards Yield");
 }
 
+// Worker threads used by meshes ticking isolated wires concurrently
+struct MeshExecutor;
+std::shared_ptr<MeshExecutor> makeMeshExecutor(size_t workers);
+// Ticks all the flows using the executor workers, returns when all of them yielded back
+void tickConcurrently(MeshExecutor &executor, const std::vector<SHFlow *> &flows, SHDuration now);
+// Runs fn on the given executor worker, returns when done, must not overlap with tickConcurrently
+void runOnWorker(MeshExecutor &executor, int32_t worker, const std::function<void()> &fn);
+
 struct RuntimeCallbacks {
   // TODO, turn them into filters maybe?
   virtual void registerShard(const char *fullName, SHShardConstructor constructor) = 0;
@@ -522,6 +657,15 @@ struct SHMesh : public std::enable_shared_from_this<SHMesh> {
   void schedule(Observer observer, const std::shared_ptr<SHWire> &wire, SHVar input = shards::Var::Empty, bool compose = true) {
     ZoneScoped;
 
+    if (_tickingConcurrently) {
+      // we are being called from a worker thread (e.g. Detach or Spawn inside an isolated wire)
+      // compose/prepare touch mesh state so do it on the ticking thread once workers are done
+      std::scoped_lock<std::mutex> lock(_deferredMutex);
+      _deferredSchedules.emplace_back(
+          [this, observer, wire, input = shards::OwnedVar(input), compose]() { schedule(observer, wire, input, compose); });
+      return;
+    }
+
     SHLOG_TRACE("Scheduling wire {}", wire->name);
 
     if (wire->warmedUp) {
@@ -556,23 +700,43 @@ struct SHMesh : public std::enable_shared_from_this<SHMesh> {
             }
           },
           this, data);
+      wire->meshIsolated = isIsolated(validation, wire.get());
       shards::arrayFree(validation.exposedInfo);
       shards::arrayFree(validation.requiredInfo);
       shards::freeDerivedInfo(data.inputType);
 
       SHLOG_TRACE("Wire {} composed", wire->name);
     } else {
+      // we know nothing about what this wire shares, keep it serial
+      wire->meshIsolated = false;
       SHLOG_TRACE("Wire {} skipped compose", wire->name);
     }
 
+    // coroutines rely on thread locals, so an isolated flow is pinned to a single worker
+    // which warms it up, ticks it and cleans it up (unless stopped from another wire)
+    wire->meshWorker = (_executor && wire->meshIsolated) ? int32_t(_nextWorker++ % _workers) : -1;
+
+    // a stale flow might still be sleeping if the wire was stopped externally and recycled (e.g. Spawn)
+    if (auto it = _dormantFlows.find(wire.get()); it != _dormantFlows.end()) {
+      _dormantPool.erase(it->second.it);
+      _dormantFlows.erase(it);
+    }
+
     observer.before_prepare(wire.get());
     // create a flow as well
     auto &flow = _flowPool.emplace_back();
     flow.wire = wire.get();
-    shards::prepare(wire.get(), &flow);
+    wire->meshFlow = true;
+    onFlowThread(wire.get(), [&]() {
+      shards::prepare(wire.get(), &flow);
+
+      observer.before_start(wire.get());
+      shards::start(wire.get(), input);
+    });
 
-    observer.before_start(wire.get());
-    shards::start(wire.get(), input);
+    // get notified if stopped from outside, so we can wake up its flow if dormant
+    wire->dispatcher.sink<SHWire::OnStopEvent>().disconnect<&SHMesh::onWireStopped>(this);
+    wire->dispatcher.sink<SHWire::OnStopEvent>().connect<&SHMesh::onWireStopped>(this);
 
     scheduled.insert(wire);
 
@@ -595,10 +759,33 @@ struct SHMesh : public std::enable_shared_from_this<SHMesh> {
       terminate();
     } else {
       SHDuration now = SHClock::now().time_since_epoch();
+
+      wakeDormantFlows(now);
+
+      if (_executor) {
+        // tick isolated wires first, all together on the workers
+        _concurrentFlows.clear();
+        for (auto &flow : _flowPool) {
+          if (flow.wire->meshWorker >= 0) {
+            observer.before_tick(flow.wire);
+            _concurrentFlows.push_back(&flow);
+          }
+        }
+
+        if (!_concurrentFlows.empty()) {
+          _tickingConcurrently = true;
+          shards::tickConcurrently(*_executor, _concurrentFlows, now);
+          _tickingConcurrently = false;
+          runDeferredSchedules();
+        }
+      }
+
       for (auto it = _flowPool.begin(); it != _flowPool.end();) {
         auto &flow = *it;
-        observer.before_tick(flow.wire);
-        shards::tick(flow.wire, now);
+        if (flow.wire->meshWorker < 0) {
+          observer.before_tick(flow.wire);
+          shards::tick(flow.wire, now);
+        }
         if (unlikely(!shards::isRunning(flow.wire))) {
           if (flow.wire->finishedError.size() > 0) {
             _errors.emplace_back(flow.wire->finishedError);
@@ -610,12 +797,29 @@ struct SHMesh : public std::enable_shared_from_this<SHMesh> {
           }
 
           observer.before_stop(flow.wire);
-          if (!shards::stop(flow.wire)) {
-            noErrors = false;
-          }
+          onFlowThread(flow.wire, [&]() {
+            if (!shards::stop(flow.wire)) {
+              noErrors = false;
+            }
+          });
 
+          flow.wire->dispatcher.sink<SHWire::OnStopEvent>().disconnect<&SHMesh::onWireStopped>(this);
+          flow.wire->meshFlow = false;
+          flow.wire->meshWorker = -1;
           flow.wire->mesh.reset();
           it = _flowPool.erase(it);
+        } else if (flow.wire->context && flow.wire->context->next > now) {
+          // suspended into the future (e.g. Pause), park it until its deadline
+          // or until woken, if waiting for async work to complete (see wakeAwaiting)
+          auto next = std::next(it);
+          const auto deadline = flow.wire->context->next;
+          _dormantFlows[flow.wire] = DormantFlow{it, deadline};
+          if (!std::isinf(deadline.count())) {
+            _wakeHeap.emplace_back(deadline, flow.wire);
+            std::push_heap(_wakeHeap.begin(), _wakeHeap.end(), std::greater<>{});
+          }
+          _dormantPool.splice(_dormantPool.end(), _flowPool, it);
+          it = next;
         } else {
           ++it;
         }
@@ -625,6 +829,47 @@ struct SHMesh : public std::enable_shared_from_this<SHMesh> {
     return noErrors;
   }
 
+  // Returns how long the mesh can sleep before a wire needs ticking again,
+  // 0 if there are active wires, negative if there is nothing to wait for,
+  // infinite if all the wires are waiting to be woken up.
+  SHDuration idleTime() const {
+    if (!_flowPool.empty())
+      return SHDuration(0);
+
+    {
+      std::scoped_lock<std::mutex> lock(_wakeMutex);
+      if (!_stoppedDormant.empty() || !_completedAwaits.empty())
+        return SHDuration(0);
+    }
+
+    if (_wakeHeap.empty()) {
+      return _dormantPool.empty() ? SHDuration(-1) : SHDuration(std::numeric_limits<double>::infinity());
+    }
+
+    SHDuration now = SHClock::now().time_since_epoch();
+    auto idle = _wakeHeap.front().first - now;
+    return idle.count() > 0.0 ? idle : SHDuration(0);
+  }
+
+  // Blocks until idleTime() elapsed or a wire is woken from another thread, waits at most maxWait.
+  void waitIdle(SHDuration maxWait) {
+    auto idle = std::min(idleTime(), maxWait);
+    if (idle.count() <= 0.0)
+      return;
+
+    std::unique_lock<std::mutex> lock(_wakeMutex);
+    _wakeCv.wait_for(lock, idle, [this]() { return !_stoppedDormant.empty() || !_completedAwaits.empty(); });
+  }
+
+  // Thread safe, resumes a wire parked until woken, used by workers completing async work (see awaitne)
+  void wakeAwaiting(SHWire *wire) {
+    {
+      std::scoped_lock<std::mutex> lock(_wakeMutex);
+      _completedAwaits.push_back(wire);
+    }
+    _wakeCv.notify_all();
+  }
+
   bool tick() {
     EmptyObserver obs;
     return tick(obs);
@@ -632,11 +877,27 @@ struct SHMesh : public std::enable_shared_from_this<SHMesh> {
 
   void terminate() {
     for (auto wire : scheduled) {
-      shards::stop(wire.get());
+      wire->dispatcher.sink<SHWire::OnStopEvent>().disconnect<&SHMesh::onWireStopped>(this);
+      wire->meshFlow = false;
+      onFlowThread(wire.get(), [&]() { shards::stop(wire.get()); });
+      wire->meshWorker = -1;
       wire->mesh.reset();
     }
 
     _flowPool.clear();
+    _dormantPool.clear();
+    _dormantFlows.clear();
+    _wakeHeap.clear();
+    {
+      std::scoped_lock<std::mutex> lock(_wakeMutex);
+      _stoppedDormant.clear();
+      _completedAwaits.clear();
+    }
+
+    {
+      std::scoped_lock<std::mutex> lock(_deferredMutex);
+      _deferredSchedules.clear();
+    }
 
     // release all wires
     scheduled.clear();
@@ -654,14 +915,46 @@ struct SHMesh : public std::enable_shared_from_this<SHMesh> {
   }
 
   void remove(const std::shared_ptr<SHWire> &wire) {
-    shards::stop(wire.get());
+    wire->dispatcher.sink<SHWire::OnStopEvent>().disconnect<&SHMesh::onWireStopped>(this);
+    wire->meshFlow = false;
+    onFlowThread(wire.get(), [&]() { shards::stop(wire.get()); });
+    wire->meshWorker = -1;
     _flowPool.remove_if([wire](auto &flow) { return flow.wire == wire.get(); });
+    _dormantPool.remove_if([wire](auto &flow) { return flow.wire == wire.get(); });
+    _dormantFlows.erase(wire.get()); // heap entry is lazily discarded
     wire->mesh.reset();
     visitedWires.erase(wire.get());
     scheduled.erase(wire);
   }
 
-  bool empty() { return _flowPool.empty(); }
+  bool empty() { return _flowPool.empty() && _dormantPool.empty(); }
+
+  // Opt-in multi-threaded ticking.
+  // Wires that neither require nor expose global variables, nor reach other wires, are ticked concurrently
+  // by a pool of worker threads, each flow always on the same one, all the others keep ticking serially on
+  // the caller thread. 0 or 1 means serial ticking (default). Can't change while wires are running.
+  void setWorkers(size_t workers) {
+    if (workers == _workers)
+      return;
+
+    if (!_flowPool.empty() || !_dormantPool.empty())
+      throw shards::SHException("Mesh workers can't change while wires are running");
+
+    _workers = workers;
+    if (_workers > 1) {
+      _executor = shards::makeMeshExecutor(_workers);
+    } else {
+      _executor.reset();
+    }
+  }
+
+  size_t workers() const { return _workers; }
+
+  // coroutine stack size for scheduled wires not specifying their own, 0 uses Globals::StackSize
+  size_t stackSize{0};
+
+  // per shard profiling of every wire run by this mesh, disabled by default
+  std::shared_ptr<shards::ShardProfiler> profiler{std::make_shared<shards::ShardProfiler>()};
 
   const std::vector<std::string> &errors() { return _errors; }
 
@@ -684,9 +977,142 @@ struct SHMesh : public std::enable_shared_from_this<SHMesh> {
 private:
   SHMesh() = default;
 
+  static bool isIsolated(const SHComposeResult &result, const SHWire *wire) {
+    // anything required comes from outside the wire, likely the mesh
+    if (result.requiredInfo.len > 0)
+      return false;
+
+    for (auto &exposed : result.exposedInfo) {
+      if (exposed.global)
+        return false;
+    }
+
+    std::vector<shards::ShardInfo> shardsInfo;
+    shards::gatherShards(wire, shardsInfo);
+    for (auto &info : shardsInfo) {
+      // reaching another wire (Do, Dispatch, Detach...) means sharing it with whoever else runs it
+      if (info.wire != wire)
+        return false;
+
+      // so does taking a wire by variable (Stop, Wait, Step...)
+      auto shard = const_cast<Shard *>(info.shard);
+      auto params = shard->parameters(shard);
+      for (uint32_t i = 0; i < params.len; i++) {
+        for (auto &type : params.elements[i].valueTypes) {
+          if (type.basicType == SHType::Wire ||
+              (type.basicType == SHType::ContextVar && type.contextVarTypes.len > 0 &&
+               type.contextVarTypes.elements[0].basicType == SHType::Wire))
+            return false;
+        }
+      }
+
+      // process wide state, e.g. event dispatchers
+      auto properties = shard->properties ? shard->properties(shard) : nullptr;
+      if (properties && properties->api->tableContains(*properties, shards::Var("shared")))
+        return false;
+    }
+
+    return true;
+  }
+
+  // Runs fn on the worker the wire is pinned to, or right here if ticked serially
+  template <typename F> void onFlowThread(SHWire *wire, F &&fn) {
+    if (_executor && wire->meshWorker >= 0) {
+      shards::runOnWorker(*_executor, wire->meshWorker, fn);
+    } else {
+      fn();
+    }
+  }
+
+  struct DormantFlow {
+    std::list<SHFlow>::iterator it;
+    SHDuration deadline;
+  };
+
+  void onWireStopped(const SHWire::OnStopEvent &e) {
+    // might come from a worker thread, _dormantFlows belongs to the ticking thread
+    // so stopped wires not actually dormant are filtered out in wakeDormantFlows
+    {
+      std::scoped_lock<std::mutex> lock(_wakeMutex);
+      _stoppedDormant.push_back(const_cast<SHWire *>(e.wire));
+    }
+    _wakeCv.notify_all();
+  }
+
+  void wakeDormantFlows(SHDuration now) {
+    // stopped from outside while sleeping, wake them up so they get cleaned up this tick
+    {
+      std::scoped_lock<std::mutex> lock(_wakeMutex);
+      for (auto wire : _stoppedDormant) {
+        auto it = _dormantFlows.find(wire);
+        if (it != _dormantFlows.end()) {
+          _flowPool.splice(_flowPool.end(), _dormantPool, it->second.it);
+          _dormantFlows.erase(it);
+        }
+      }
+      _stoppedDormant.clear();
+
+      // async work completed, only wake wires still parked until woken (or flagged wakeable),
+      // late notifications might find the wire sleeping for other reasons (e.g. Pause)
+      for (auto wire : _completedAwaits) {
+        auto it = _dormantFlows.find(wire);
+        if (it != _dormantFlows.end() && (std::isinf(it->second.deadline.count()) || wire->context->wakeable)) {
+          wire->context->next = SHDuration(0);
+          _flowPool.splice(_flowPool.end(), _dormantPool, it->second.it);
+          _dormantFlows.erase(it);
+        }
+      }
+      _completedAwaits.clear();
+    }
+
+    while (!_wakeHeap.empty() && _wakeHeap.front().first <= now) {
+      auto [deadline, wire] = _wakeHeap.front();
+      std::pop_heap(_wakeHeap.begin(), _wakeHeap.end(), std::greater<>{});
+      _wakeHeap.pop_back();
+
+      auto it = _dormantFlows.find(wire);
+      // skip stale entries, removed or already woken and parked again
+      if (it == _dormantFlows.end() || it->second.deadline != deadline)
+        continue;
+
+      _flowPool.splice(_flowPool.end(), _dormantPool, it->second.it);
+      _dormantFlows.erase(it);
+    }
+  }
+
+  void runDeferredSchedules() {
+    std::vector<std::function<void()>> deferred;
+    {
+      std::scoped_lock<std::mutex> lock(_deferredMutex);
+      std::swap(deferred, _deferredSchedules);
+    }
+
+    for (auto &schedule : deferred) {
+      schedule();
+    }
+  }
+
+  // flows that need ticking
   std::list<SHFlow> _flowPool;
+  // flows suspended until a future deadline, spliced back into _flowPool when due
+  std::list<SHFlow> _dormantPool;
+  std::unordered_map<SHWire *, DormantFlow> _dormantFlows;
+  // min-heap of wake up deadlines
+  std::vector<std::pair<SHDuration, SHWire *>> _wakeHeap;
+  mutable std::mutex _wakeMutex;
+  std::condition_variable _wakeCv;
+  std::vector<SHWire *> _stoppedDormant;
+  std::vector<SHWire *> _completedAwaits;
   std::vector<std::string> _errors;
   std::vector<SHWire *> _failedWires;
+
+  size_t _workers{0};
+  size_t _nextWorker{0};
+  std::shared_ptr<shards::MeshExecutor> _executor;
+  std::vector<SHFlow *> _concurrentFlows;
+  std::atomic_bool _tickingConcurrently{false};
+  std::mutex _deferredMutex;
+  std::vector<std::function<void()>> _deferredSchedules;
 };
 
 namespace shards {
@@ -766,27 +1192,15 @@ struct Serialization {
       auto availBytes = recycle ? output.payload.bytesCapacity : 0;
       read((uint8_t *)&output.payload.bytesSize, sizeof(output.payload.bytesSize));
 
-#if 0
-      if (output.payload.bytesSize <= 8) {
-        // short array
-        output.payload.bytesValue = output.shortBytes;
-        output.payload.bytesCapacity = 8;
-      } else
-#endif
-      {
-        if (availBytes > 0 && availBytes < output.payload.bytesSize) {
-          // not enough space, ideally realloc, but for now just delete
-          delete[] output.payload.bytesValue;
-          // and re alloc
-          output.payload.bytesValue = new uint8_t[output.payload.bytesSize];
-        } else if (availBytes == 0) {
-          // just alloc
-          output.payload.bytesValue = new uint8_t[output.payload.bytesSize];
-        } // else got enough space to recycle!
-
-        // record actualSize for further recycling usage
-        output.payload.bytesCapacity = std::max(availBytes, output.payload.bytesSize);
-      }
+      if (availBytes == 0 || availBytes < output.payload.bytesSize) {
+        // not enough space, ideally realloc, but for now just free
+        if (availBytes > 0)
+          freeVarBuffer(output.payload.bytesValue, availBytes);
+        // and re alloc, recording actual size for further recycling usage
+        uint32_t size = output.payload.bytesSize;
+        output.payload.bytesValue = allocVarBuffer(size);
+        output.payload.bytesCapacity = size;
+      } // else got enough space to recycle!
 
       read((uint8_t *)output.payload.bytesValue, output.payload.bytesSize);
       break;
@@ -805,26 +1219,15 @@ struct Serialization {
       auto availChars = recycle ? output.payload.stringCapacity : 0;
       read((uint8_t *)&output.payload.stringLen, sizeof(uint32_t));
 
-#if 0
-      if (output.payload.stringLen <= 7) {
-        // small string, just use the stack
-        output.payload.stringValue = output.shortString;
-        output.payload.stringCapacity = 7;
-      } else
-#endif
-      {
-        if (availChars > 0 && availChars < output.payload.stringLen) {
-          // we need more chars then what we have, realloc
-          delete[] output.payload.stringValue;
-          output.payload.stringValue = new char[output.payload.stringLen + 1];
-        } else if (availChars == 0) {
-          // just alloc
-          output.payload.stringValue = new char[output.payload.stringLen + 1];
-        } // else recycling
-
-        // record actualSize
-        output.payload.stringCapacity = std::max(availChars, output.payload.stringLen);
-      }
+      if (availChars == 0 || availChars < output.payload.stringLen) {
+        // we need more chars then what we have, realloc
+        if (availChars > 0)
+          freeVarBuffer((void *)output.payload.stringValue, availChars + 1);
+        // record actual size, capacity doesn't include the 0 terminator
+        uint32_t size = output.payload.stringLen + 1;
+        output.payload.stringValue = (char *)allocVarBuffer(size);
+        output.payload.stringCapacity = size - 1;
+      } // else recycling
 
       read((uint8_t *)output.payload.stringValue, output.payload.stringLen);
       const_cast<char *>(output.payload.stringValue)[output.payload.stringLen] = 0;
@@ -1512,15 +1915,25 @@ struct Serialization {
   }
 };
 
+// Deep copies wires and their shards without going through a byte stream.
+// Parameters are transferred with getParam/setParam, nested shards and wires are cloned as well,
+// a wire referenced multiple times within the same clone operation is cloned only once.
+struct WireCloner {
+  std::shared_ptr<SHWire> clone(const std::shared_ptr<SHWire> &wire);
+  ShardPtr clone(ShardPtr shard);
+  // output is owned by the caller and must be destroyed with destroyVar
+  void clone(const SHVar &input, SHVar &output);
+
+private:
+  std::unordered_map<const SHWire *, std::shared_ptr<SHWire>> _wires;
+};
+
 template <typename T> struct WireDoppelgangerPool {
-  WireDoppelgangerPool(SHWireRef master) {
+  // clones made by a single prewarm call, keeps the cost spread over activations
+  static constexpr size_t PrewarmBatch = 2;
+
+  WireDoppelgangerPool(SHWireRef master) : _master(SHWire::sharedFromRef(master)) {
     // Never call this from setParam or earlier...
-    auto vwire = shards::Var(master);
-    std::stringstream stream;
-    Writer w(stream);
-    Serialization serializer;
-    serializer.serialize(vwire, w);
-    _wireStr = stream.str();
   }
 
   // notice users should stop wires themselves, we might want wires to persist
@@ -1532,17 +1945,32 @@ template <typename T> struct WireDoppelgangerPool {
     }
   }
 
+  // Tops up towards count spare clones, at most PrewarmBatch per call, so acquire doesn't stall on cloning.
+  // Runs on the owning thread, cloning reads the master shards which that thread may be activating or composing.
+  // Prewarmed clones are composed when handed out.
+  void prewarm(size_t count) {
+    for (size_t i = 0; i < PrewarmBatch && _prewarmed.size() < count; i++) {
+      auto wire = cloneMaster();
+      if (!wire)
+        return;
+      _prewarmed.emplace_back(std::move(wire));
+    }
+  }
+
   template <class Composer, typename Anything> T *acquire(Composer &composer, Anything *anything) {
     ZoneScoped;
 
     if (_avail.size() == 0) {
-      Serialization serializer;
-      std::stringstream stream(_wireStr);
-      Reader r(stream);
-      SHVar vwire{};
-      serializer.deserialize(r, vwire);
-      auto wire = SHWire::sharedFromRef(vwire.payload.wireValue);
-      destroyVar(vwire);
+      std::shared_ptr<SHWire> wire;
+      if (!_prewarmed.empty()) {
+        wire = std::move(_prewarmed.back());
+        _prewarmed.pop_back();
+      }
+      if (!wire)
+        wire = cloneMaster();
+      if (!wire)
+        throw shards::SHException("WireDoppelgangerPool: master wire expired");
+
       auto &fresh = _pool.emplace_back(std::make_shared<T>());
       fresh->wire = wire;
       composer.compose(wire.get(), anything, false);
@@ -1563,24 +1991,23 @@ template <typename T> struct WireDoppelgangerPool {
 private:
   WireDoppelgangerPool() = delete;
 
-  struct Writer {
-    std::stringstream &stream;
-    Writer(std::stringstream &stream) : stream(stream) {}
-    void operator()(const uint8_t *buf, size_t size) { stream.write((const char *)buf, size); }
-  };
+  std::shared_ptr<SHWire> cloneMaster() {
+    auto master = _master.lock();
+    if (!master)
+      return nullptr;
+    WireCloner cloner;
+    return cloner.clone(master);
+  }
 
-  struct Reader {
-    std::stringstream &stream;
-    Reader(std::stringstream &stream) : stream(stream) {}
-    void operator()(uint8_t *buf, size_t size) { stream.read((char *)buf, size); }
-  };
+  std::weak_ptr<SHWire> _master;
 
   // keep our pool in a deque in order to keep them alive
   // so users don't have to worry about lifetime
   // just release when possible
   std::deque<std::shared_ptr<T>> _pool;
   std::unordered_set<T *> _avail;
-  std::string _wireStr;
+
+  std::vector<std::shared_ptr<SHWire>> _prewarmed;
 };
 
 #ifdef __EMSCRIPTEN__
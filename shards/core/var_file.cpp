@@ -0,0 +1,326 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#include "var_file.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#elif !defined(__EMSCRIPTEN__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace shards {
+using namespace varfile;
+
+FileHeader VarFileEncoder::header() { return FileHeader{Magic, Version, uint16_t(sizeof(SHVar)), 0}; }
+
+void VarFileEncoder::align() { _buffer.resize((_buffer.size() + Alignment - 1) & ~(Alignment - 1), 0); }
+
+const std::vector<uint8_t> &VarFileEncoder::record(const SHVar &var) {
+  _buffer.clear();
+  put(RecordHeader{});
+  encode(var);
+  align();
+  reinterpret_cast<RecordHeader *>(_buffer.data())->size = _buffer.size() - sizeof(RecordHeader);
+  return _buffer;
+}
+
+void VarFileEncoder::encode(const SHVar &var) {
+  switch (var.valueType) {
+  case SHType::String:
+  case SHType::Path:
+  case SHType::ContextVar: {
+    const auto len = var.payload.stringLen > 0 || var.payload.stringValue == nullptr ? var.payload.stringLen
+                                                                                     : uint32_t(strlen(var.payload.stringValue));
+    put(Node{var.valueType, Encoding::Blob, 0, len});
+    align();
+    put((const uint8_t *)var.payload.stringValue, len);
+    put(uint8_t(0));
+  } break;
+  case SHType::Bytes: {
+    put(Node{var.valueType, Encoding::Blob, 0, var.payload.bytesSize});
+    align();
+    put(var.payload.bytesValue, var.payload.bytesSize);
+  } break;
+  case SHType::Image: {
+    const auto &image = var.payload.imageValue;
+    const auto size = uint32_t(image.channels * image.height * image.width * getPixelSize(var));
+    put(Node{var.valueType, Encoding::Blob, 0, size});
+    auto meta = image;
+    meta.data = nullptr;
+    put(meta);
+    align();
+    put(image.data, size);
+  } break;
+  case SHType::Array: {
+    const auto &array = var.payload.arrayValue;
+    put(Node{var.valueType, Encoding::Blob, 0, array.len});
+    put(var.innerType);
+    align();
+    put((const uint8_t *)array.elements, array.len * sizeof(SHVarPayload));
+  } break;
+  case SHType::Seq: {
+    const auto &seq = var.payload.seqValue;
+    bool flat = seq.len > 0;
+    for (uint32_t i = 0; flat && i < seq.len; i++) {
+      flat = seq.elements[i].valueType < SHType::EndOfBlittableTypes;
+    }
+
+    if (flat) {
+      put(Node{var.valueType, Encoding::FlatSeq, 0, seq.len});
+      align();
+      for (uint32_t i = 0; i < seq.len; i++) {
+        SHVar element{};
+        element.valueType = seq.elements[i].valueType;
+        element.payload = seq.elements[i].payload;
+        element.flags = SHVAR_FLAGS_FOREIGN;
+        put(element);
+      }
+    } else {
+      put(Node{var.valueType, Encoding::NestedSeq, 0, seq.len});
+      for (uint32_t i = 0; i < seq.len; i++) {
+        encode(seq.elements[i]);
+      }
+    }
+  } break;
+  default:
+    if (var.valueType < SHType::EndOfBlittableTypes) {
+      put(Node{var.valueType, Encoding::Inline, 0, 0});
+      put(var.payload);
+    } else {
+      const auto nodePos = _buffer.size();
+      put(Node{var.valueType, Encoding::Serialized, 0, 0});
+      auto writer = [&](const uint8_t *data, size_t size) { put(data, size); };
+      _serial.reset();
+      const auto size = _serial.serialize(var, writer);
+      reinterpret_cast<Node *>(_buffer.data() + nodePos)->len = uint32_t(size);
+    }
+    break;
+  }
+}
+
+MappedVarFile::MappedVarFile(const std::string &path) : _path(path) {
+  map();
+
+  FileHeader header;
+  memcpy(&header, _data, sizeof(FileHeader));
+  if (header.magic != Magic) {
+    unmap();
+    throw SHException("Not a var file: " + path);
+  }
+  if (header.version != Version || header.varSize != sizeof(SHVar)) {
+    unmap();
+    throw SHException("Unsupported var file version or layout: " + path);
+  }
+
+  rewind();
+}
+
+MappedVarFile::~MappedVarFile() { unmap(); }
+
+void MappedVarFile::map() {
+#if defined(__EMSCRIPTEN__)
+  std::ifstream stream(_path, std::ios::binary | std::ios::ate);
+  if (!stream)
+    throw SHException("Failed to open var file: " + _path);
+  _contents.resize(size_t(stream.tellg()));
+  stream.seekg(0);
+  stream.read((char *)_contents.data(), _contents.size());
+  _data = _contents.data();
+  _size = _contents.size();
+#elif defined(_WIN32)
+  auto file = CreateFileA(_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+                          FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw SHException("Failed to open var file: " + _path);
+  DEFER(CloseHandle(file));
+
+  LARGE_INTEGER size;
+  GetFileSizeEx(file, &size);
+  _size = size_t(size.QuadPart);
+  if (_size >= sizeof(FileHeader)) {
+    // copy on write, decoded vars can be written to without touching the file
+    _mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (_mapping)
+      _data = (uint8_t *)MapViewOfFile(_mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (!_data)
+      throw SHException("Failed to map var file: " + _path);
+  }
+#else
+  auto fd = open(_path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw SHException("Failed to open var file: " + _path);
+  DEFER(close(fd));
+
+  struct stat st;
+  fstat(fd, &st);
+  _size = size_t(st.st_size);
+  if (_size >= sizeof(FileHeader)) {
+    // copy on write, decoded vars can be written to without touching the file
+    auto mem = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (mem == MAP_FAILED)
+      throw SHException("Failed to map var file: " + _path);
+    _data = (uint8_t *)mem;
+    madvise(_data, _size, MADV_SEQUENTIAL);
+  }
+#endif
+
+  if (_size < sizeof(FileHeader)) {
+    unmap();
+    throw SHException("Not a var file: " + _path);
+  }
+}
+
+void MappedVarFile::unmap() {
+#if defined(__EMSCRIPTEN__)
+  _contents.clear();
+#elif defined(_WIN32)
+  if (_data)
+    UnmapViewOfFile(_data);
+  if (_mapping)
+    CloseHandle(_mapping);
+  _mapping = nullptr;
+#else
+  if (_data)
+    munmap(_data, _size);
+#endif
+  _data = nullptr;
+  _size = 0;
+}
+
+const uint8_t *MappedVarFile::take(size_t size) {
+  if (_offset + size > _end)
+    throw SHException("Corrupted var file record: " + _path);
+  auto res = _data + _offset;
+  _offset += size;
+  return res;
+}
+
+void MappedVarFile::align() { _offset = (_offset + Alignment - 1) & ~(Alignment - 1); }
+
+bool MappedVarFile::next(SHVar &output) {
+  auto complete = [&]() {
+    if (_offset + sizeof(RecordHeader) > _size)
+      return false;
+    RecordHeader header;
+    memcpy(&header, _data + _offset, sizeof(RecordHeader));
+    return _offset + sizeof(RecordHeader) + header.size <= _size;
+  };
+
+  if (!complete()) {
+    // the file might have grown since we mapped it
+    boost::system::error_code ec;
+    const auto size = boost::filesystem::file_size(_path, ec);
+    if (ec || size <= _size)
+      return false;
+
+    const auto offset = _offset;
+    unmap();
+    map();
+    _offset = offset;
+    if (!complete())
+      return false;
+  }
+
+  // the header is bounded by the mapping, the record body by the header
+  _end = _size;
+  RecordHeader header;
+  memcpy(&header, take(sizeof(RecordHeader)), sizeof(RecordHeader));
+  _end = _offset + header.size;
+  decode(output);
+  _offset = _end;
+  return true;
+}
+
+void MappedVarFile::decode(SHVar &output) {
+  Node node;
+  memcpy(&node, take(sizeof(Node)), sizeof(Node));
+
+  // vars of previous records pointing into the mapping own nothing
+  if ((output.flags & SHVAR_FLAGS_FOREIGN) == SHVAR_FLAGS_FOREIGN)
+    memset(&output, 0x0, sizeof(SHVar));
+
+  switch (node.encoding) {
+  case Encoding::Inline:
+    if (output.valueType >= SHType::EndOfBlittableTypes)
+      destroyVar(output);
+    output.valueType = node.type;
+    memcpy(&output.payload, take(sizeof(SHVarPayload)), sizeof(SHVarPayload));
+    break;
+  case Encoding::Blob: {
+    destroyVar(output);
+    output.valueType = node.type;
+    output.flags = SHVAR_FLAGS_FOREIGN;
+    switch (node.type) {
+    case SHType::String:
+    case SHType::Path:
+    case SHType::ContextVar:
+      align();
+      output.payload.stringValue = (const char *)take(node.len + 1);
+      output.payload.stringLen = node.len;
+      output.payload.stringCapacity = 0;
+      break;
+    case SHType::Bytes:
+      align();
+      output.payload.bytesValue = const_cast<uint8_t *>(take(node.len));
+      output.payload.bytesSize = node.len;
+      output.payload.bytesCapacity = 0;
+      break;
+    case SHType::Image: {
+      SHImage image;
+      memcpy(&image, take(sizeof(SHImage)), sizeof(SHImage));
+      align();
+      image.data = const_cast<uint8_t *>(take(node.len));
+      output.payload.imageValue = image;
+    } break;
+    case SHType::Array:
+      memcpy(&output.innerType, take(sizeof(SHType)), sizeof(SHType));
+      align();
+      output.payload.arrayValue.elements = (SHVarPayload *)take(node.len * sizeof(SHVarPayload));
+      output.payload.arrayValue.len = node.len;
+      output.payload.arrayValue.cap = 0;
+      break;
+    default:
+      throw SHException("Corrupted var file record: " + _path);
+    }
+  } break;
+  case Encoding::FlatSeq:
+    destroyVar(output);
+    output.valueType = SHType::Seq;
+    output.flags = SHVAR_FLAGS_FOREIGN;
+    align();
+    output.payload.seqValue.elements = (SHVar *)take(node.len * sizeof(SHVar));
+    output.payload.seqValue.len = node.len;
+    output.payload.seqValue.cap = 0;
+    break;
+  case Encoding::NestedSeq:
+    if (output.valueType != SHType::Seq)
+      destroyVar(output);
+    output.valueType = SHType::Seq;
+    arrayResize(output.payload.seqValue, node.len);
+    for (uint32_t i = 0; i < node.len; i++) {
+      decode(output.payload.seqValue.elements[i]);
+    }
+    break;
+  case Encoding::Serialized: {
+    auto data = take(node.len);
+    size_t offset = 0;
+    auto reader = [&](uint8_t *buf, size_t size) {
+      if (offset + size > node.len)
+        throw SHException("Corrupted var file record: " + _path);
+      memcpy(buf, data + offset, size);
+      offset += size;
+    };
+    _serial.reset();
+    _serial.deserialize(reader, output);
+  } break;
+  default:
+    throw SHException("Corrupted var file record: " + _path);
+  }
+}
+} // namespace shards
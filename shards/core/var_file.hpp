@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#ifndef SH_CORE_VAR_FILE
+#define SH_CORE_VAR_FILE
+
+#include "runtime.hpp"
+#include <string>
+#include <vector>
+
+namespace shards {
+// Versioned container of vars laid out for zero-copy reads.
+//
+// A file is a FileHeader followed by records, each a RecordHeader and the node tree of one var.
+// Everything is in native byte order, the header records the layout it was written with.
+// Records and blob payloads (strings, bytes, images, arrays and seqs of blittable values) start 16 bytes aligned,
+// so a mapping of the file can be handed out directly as var payloads.
+// Types without a flat representation (tables, sets, objects, wires...) are embedded in the Serialization format.
+namespace varfile {
+constexpr uint32_t Magic = 'S' | ('H' << 8) | ('V' << 16) | ('F' << 24);
+constexpr uint16_t Version = 1;
+constexpr size_t Alignment = 16;
+
+struct FileHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t varSize;
+  uint64_t reserved;
+};
+
+struct RecordHeader {
+  // size of the node tree, padding included
+  uint64_t size;
+  uint64_t reserved;
+};
+
+enum class Encoding : uint8_t {
+  // payload follows the node
+  Inline,
+  // aligned string/bytes/image/array payload
+  Blob,
+  // aligned run of blittable vars
+  FlatSeq,
+  // len child nodes
+  NestedSeq,
+  // len bytes in the Serialization format
+  Serialized,
+};
+
+struct Node {
+  SHType type;
+  Encoding encoding;
+  uint16_t reserved;
+  uint32_t len;
+};
+
+static_assert(sizeof(FileHeader) % Alignment == 0);
+static_assert(sizeof(RecordHeader) % Alignment == 0);
+static_assert(sizeof(Node) == 8);
+} // namespace varfile
+
+// Encodes vars as records, the buffer is reused across calls
+struct VarFileEncoder {
+  // Header to write once at the beginning of a file
+  static varfile::FileHeader header();
+
+  // The whole record of var, valid until the next call
+  const std::vector<uint8_t> &record(const SHVar &var);
+
+private:
+  void encode(const SHVar &var);
+  void align();
+  template <typename T> void put(const T &value) { put((const uint8_t *)&value, sizeof(T)); }
+  void put(const uint8_t *data, size_t size) { _buffer.insert(_buffer.end(), data, data + size); }
+
+  std::vector<uint8_t> _buffer;
+  Serialization _serial;
+};
+
+// Memory maps a var file and decodes its records without copying blob payloads,
+// decoded vars point into the mapping and are flagged SHVAR_FLAGS_FOREIGN.
+// They are valid until the next call to next(), rewind() or the reader's destruction.
+// Throws SHException if the file can't be mapped or isn't a var file.
+struct MappedVarFile {
+  MappedVarFile(const std::string &path);
+  ~MappedVarFile();
+
+  MappedVarFile(const MappedVarFile &) = delete;
+  MappedVarFile &operator=(const MappedVarFile &) = delete;
+
+  // Decodes the next record into output, recycling what it already holds, false once there are no more.
+  // Records appended since the file was mapped are picked up when reaching the end.
+  bool next(SHVar &output);
+
+  void rewind() { _offset = sizeof(varfile::FileHeader); }
+
+  size_t size() const { return _size; }
+
+private:
+  void map();
+  void unmap();
+  const uint8_t *take(size_t size);
+  void align();
+  void decode(SHVar &output);
+
+  std::string _path;
+  uint8_t *_data{nullptr};
+  size_t _size{0};
+  size_t _offset{0};
+  size_t _end{0};
+#if defined(__EMSCRIPTEN__)
+  std::vector<uint8_t> _contents;
+#elif defined(_WIN32)
+  void *_mapping{nullptr};
+#endif
+  Serialization _serial;
+};
+} // namespace shards
+
+#endif
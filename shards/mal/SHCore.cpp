@@ -1912,7 +1912,10 @@ bool run(SHMesh *mesh, SHWire *wire, double sleepTime, int times, bool dec) {
       // cos during sleep some shards
       // swap states and invalidate stuff
       if (sleepTime <= 0.0) {
+        // don't spin if all wires are suspended, wait until the earliest one is due
+        // or woken up (e.g. an await completed), a bounded wait keeps signals responsive
         shards::sleep(-1.0);
+        mesh->waitIdle(SHDuration(1.0));
       } else {
         // remove the time we took to tick from sleep
         now = SHClock::now();
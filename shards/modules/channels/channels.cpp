@@ -2,13 +2,210 @@
 /* Copyright © 2020 Fragcolor Pte. Ltd. */
 
 #include "channels.hpp"
+#include <shards/core/async.hpp>
 #include <shards/core/runtime.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <memory>
 #include <mutex>
 #include <shared_mutex>
 
+ENUM_HELP(shards::channels::OverflowPolicy, shards::channels::OverflowPolicy::Block,
+          SHCCSTR("Suspend the producer until there is room in the channel."));
+ENUM_HELP(shards::channels::OverflowPolicy, shards::channels::OverflowPolicy::DropOldest,
+          SHCCSTR("Discard the oldest value in the channel to make room."));
+ENUM_HELP(shards::channels::OverflowPolicy, shards::channels::OverflowPolicy::DropNewest,
+          SHCCSTR("Discard the value being produced."));
+ENUM_HELP(shards::channels::OverflowPolicy, shards::channels::OverflowPolicy::Fail, SHCCSTR("Fail the producing wire."));
+
 namespace shards {
 namespace channels {
+DECL_ENUM_INFO(OverflowPolicy, ChannelOverflow, 'chOv');
+
+bool WaitList::add(SHContext *context, SHWire *&parked) {
+  auto wire = context->flow ? context->flow->wire : nullptr;
+  if (!wire || !wire->meshFlow)
+    return false;
+
+  std::scoped_lock lock(_mutex);
+  _waiters.push_back(Waiter{wire->mesh, wire});
+  _count++;
+  parked = wire;
+  return true;
+}
+
+void WaitList::remove(SHWire *wire) {
+  std::scoped_lock lock(_mutex);
+  for (auto it = _waiters.begin(); it != _waiters.end();) {
+    if (it->wire == wire) {
+      it = _waiters.erase(it);
+      _count--;
+    } else {
+      ++it;
+    }
+  }
+}
+
+void WaitList::wakeAllSlow() {
+  std::vector<Waiter> waiters;
+  {
+    std::scoped_lock lock(_mutex);
+    std::swap(waiters, _waiters);
+    _count = 0;
+  }
+  // a stale wire is ignored by the mesh, it only wakes wires parked until woken
+  for (auto &waiter : waiters) {
+    if (auto mesh = waiter.mesh.lock())
+      mesh->wakeAwaiting(waiter.wire);
+  }
+}
+
+// Suspends the wire until woken through list or timeout seconds passed, ready is checked again once registered
+// so that a wake up happening in between is not lost
+template <typename READY>
+SHWireState park(SHContext *context, WaitList &list, SHWire *&parked, READY &&ready,
+                 double timeout = std::numeric_limits<double>::infinity()) {
+  if (!list.add(context, parked))
+    return shards::suspend(context, 0);
+
+  if (ready()) {
+    list.remove(parked);
+    parked = nullptr;
+    return shards::suspend(context, 0);
+  }
+
+  context->wakeable = !std::isinf(timeout);
+  auto state = shards::suspend(context, timeout);
+  context->wakeable = false;
+  // woken lists drop their waiters already, this covers timeouts, stops and spurious resumes
+  list.remove(parked);
+  parked = nullptr;
+  return state;
+}
+
+// Rough memory footprint of a value, for byte limited batches
+size_t approximateSize(const SHVar &var) {
+  switch (var.valueType) {
+  case SHType::String:
+    return SHSTRLEN(var);
+  case SHType::Bytes:
+    return var.payload.bytesSize;
+  case SHType::Image:
+    return size_t(var.payload.imageValue.width) * var.payload.imageValue.height * var.payload.imageValue.channels *
+           getPixelSize(var);
+  case SHType::Audio:
+    return size_t(var.payload.audioValue.nsamples) * var.payload.audioValue.channels * sizeof(float);
+  case SHType::Seq: {
+    size_t total = 0;
+    for (uint32_t i = 0; i < var.payload.seqValue.len; i++)
+      total += approximateSize(var.payload.seqValue.elements[i]);
+    return total;
+  }
+  default:
+    return sizeof(SHVar);
+  }
+}
+
+// How long a blocking call waits on a shared ring before the wire checks its state again
+constexpr double SharedWaitSlice = 0.1;
+
+// Blocks on the shared ring off the mesh thread, false if the wire was stopped meanwhile
+template <typename WAIT> bool awaitShared(SHContext *context, SharedRing &ring, WAIT &&wait) {
+  await(context, std::forward<WAIT>(wait), [&]() { ring.wakeAll(); });
+  return context->shouldContinue();
+}
+
+// Shared memory records, blittable values are a raw payload copy,
+// anything else goes through the binary Serialization format
+struct SharedCodec {
+  enum Encoding : uint8_t { Raw, Serialized };
+
+  Serialization serial;
+  std::vector<uint8_t> buffer;
+
+  struct Writer {
+    std::vector<uint8_t> &_buffer;
+    Writer(std::vector<uint8_t> &stream) : _buffer(stream) {}
+    void operator()(const uint8_t *buf, size_t size) { _buffer.insert(_buffer.end(), buf, buf + size); }
+  };
+
+  struct Reader {
+    const std::vector<uint8_t> &_buffer;
+    size_t _offset;
+    Reader(const std::vector<uint8_t> &buffer, size_t offset) : _buffer(buffer), _offset(offset) {}
+    void operator()(uint8_t *buf, size_t size) {
+      if (_buffer.size() < _offset + size)
+        throw ActivationError("Truncated shared channel record");
+      memcpy(buf, _buffer.data() + _offset, size);
+      _offset += size;
+    }
+  };
+
+  const std::vector<uint8_t> &encode(const SHVar &var) {
+    buffer.clear();
+    if (var.valueType < SHType::EndOfBlittableTypes) {
+      buffer.resize(2 + sizeof(SHVarPayload));
+      buffer[0] = Raw;
+      buffer[1] = uint8_t(var.valueType);
+      memcpy(buffer.data() + 2, &var.payload, sizeof(SHVarPayload));
+    } else {
+      buffer.push_back(Serialized);
+      Writer w(buffer);
+      serial.serialize(var, w);
+    }
+    return buffer;
+  }
+
+  // Reuses the memory of output when possible
+  void decode(const std::vector<uint8_t> &record, SHVar &output) {
+    if (record.size() == 2 + sizeof(SHVarPayload) && record[0] == Raw) {
+      destroyVar(output);
+      output.valueType = SHType(record[1]);
+      memcpy(&output.payload, record.data() + 2, sizeof(SHVarPayload));
+    } else if (!record.empty() && record[0] == Serialized) {
+      Reader r(record, 1);
+      serial.reset();
+      serial.deserialize(r, output);
+    } else {
+      throw ActivationError("Invalid shared channel record");
+    }
+  }
+};
+
+// Values decoded from a shared ring, kept and recycled between activations
+struct SharedReader {
+  SharedCodec codec;
+  std::vector<uint8_t> record;
+  std::vector<SHVar> values;
+  size_t count{0};
+
+  ~SharedReader() {
+    for (auto &var : values)
+      destroyVar(var);
+  }
+
+  void clear() { count = 0; }
+
+  bool pop(SharedRing &ring) {
+    if (!ring.tryRead(record))
+      return false;
+    if (values.size() == count)
+      values.emplace_back();
+    codec.decode(record, values[count++]);
+    return true;
+  }
+
+  const SHVar &last() const { return values[count - 1]; }
+
+  SHVar seq() {
+    SHVar res{};
+    res.valueType = SHType::Seq;
+    res.payload.seqValue.elements = values.data();
+    res.payload.seqValue.len = uint32_t(count);
+    return res;
+  }
+};
 
 template <typename T> void verifyChannelType(T &channel, SHTypeInfo type, const char *name) {
   if (channel.type != type) {
@@ -69,25 +266,112 @@ struct Base {
   }
 };
 
-struct Produce : public Base {
+// Producers with a Capacity and an Overflow policy after the Base parameters
+struct BoundedProducer : public Base {
   std::shared_ptr<Channel> _channel;
-  MPMCChannel *_mpChannel;
+  int64_t _capacity{0};
+  OverflowPolicy _overflow{OverflowPolicy::Block};
+  SHWire *_parked{};
 
   static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
 
   static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
 
-  static SHParametersInfo parameters() { return producerParams; }
+  void setParam(int index, const SHVar &value) {
+    switch (index) {
+    case 2:
+      _capacity = std::max(int64_t(0), value.payload.intValue);
+      break;
+    case 3:
+      _overflow = OverflowPolicy(value.payload.enumValue);
+      break;
+    default:
+      Base::setParam(index, value);
+      break;
+    }
+  }
+
+  SHVar getParam(int index) {
+    switch (index) {
+    case 2:
+      return Var(_capacity);
+    case 3:
+      return Var::Enum(_overflow, ChannelOverflowEnumInfo::VendorId, ChannelOverflowEnumInfo::TypeId);
+    default:
+      return Base::getParam(index);
+    }
+  }
+};
+
+struct Produce : public BoundedProducer {
+  MPMCChannel *_mpChannel{};
+  SharedMemoryChannel *_shmChannel{};
+  SharedCodec _codec;
+
+  static inline Parameters produceParams{
+      producerParams,
+      {{"Capacity",
+        SHCCSTR("The maximum amount of values the channel can hold, 0 for unbounded. Every producer of a channel must agree on it. "
+                "For shm: channels this is the size of the ring in bytes, 0 for the default, only the first process sets it."),
+        {CoreInfo::IntType}},
+       {"Overflow", SHCCSTR("What to do when the channel is full."), {ChannelOverflowEnumInfo::Type}}}};
+
+  static SHParametersInfo parameters() { return produceParams; }
 
   SHTypeInfo compose(const SHInstanceData &data) {
     _channel = get(_name);
+    if (isShared(_name)) {
+      _shmChannel = &getAndInitChannel<SharedMemoryChannel>(_channel, data.inputType, _noCopy, _name.c_str());
+      _shmChannel->open(_name, size_t(_capacity), deriveTypeHash(data.inputType));
+      OVERRIDE_ACTIVATE(data, activateShared);
+      return data.inputType;
+    }
+
+    OVERRIDE_ACTIVATE(data, activate);
     _mpChannel = &getAndInitChannel<MPMCChannel>(_channel, data.inputType, _noCopy, _name.c_str());
+    if (_capacity > 0) {
+      if (_mpChannel->capacity != 0 && _mpChannel->capacity != size_t(_capacity))
+        throw ComposeError(fmt::format("Attempted to change channel capacity: {}", _name));
+      _mpChannel->capacity = size_t(_capacity);
+    }
     return data.inputType;
   }
 
+  void cleanup() {
+    if (_parked) {
+      _mpChannel->producers.remove(_parked);
+      _parked = nullptr;
+    }
+  }
+
   SHVar activate(SHContext *context, const SHVar &input) {
     assert(_mpChannel);
 
+    while (!_mpChannel->reserve()) {
+      switch (_overflow) {
+      case OverflowPolicy::Block: {
+        // a completed channel has no one left to make room
+        if (_mpChannel->closed)
+          return input;
+        const auto state = park(context, _mpChannel->producers, _parked,
+                                [&]() { return _mpChannel->size < _mpChannel->capacity || _mpChannel->closed; });
+        if (state != SHWireState::Continue)
+          return Var::Empty;
+      } break;
+      case OverflowPolicy::DropOldest: {
+        SHVar oldest{};
+        // full of values reserved but not pushed yet, give up on this value rather than spin
+        if (!_mpChannel->pop(oldest))
+          return input;
+        _mpChannel->recycle.push(oldest);
+      } break;
+      case OverflowPolicy::DropNewest:
+        return input;
+      case OverflowPolicy::Fail:
+        throw ActivationError(fmt::format("Channel {} is full", _name));
+      }
+    }
+
     SHVar tmp{};
 
     // try to get from recycle bin
@@ -104,70 +388,119 @@ struct Produce : public Base {
     }
 
     // enqueue for the stealing
-    _mpChannel->data.push(tmp);
+    _mpChannel->push(tmp);
+
+    return input;
+  }
+
+  // Always copies, NoCopy!! has no meaning across processes
+  SHVar activateShared(SHContext *context, const SHVar &input) {
+    assert(_shmChannel);
+    auto &ring = _shmChannel->ring;
+
+    const auto &record = _codec.encode(input);
+    if (record.size() > ring.maxRecordSize())
+      throw ActivationError(fmt::format("Value of {} bytes is too big for shared channel {}", record.size(), _name));
+
+    while (!ring.tryWrite(record.data(), record.size())) {
+      if (ring.closed())
+        return input;
+      switch (_overflow) {
+      case OverflowPolicy::Block:
+        // consumers in any process wake us up as they read
+        if (!awaitShared(context, ring, [&]() { ring.waitWritable(record.size(), SharedWaitSlice); }))
+          return Var::Empty;
+        break;
+      case OverflowPolicy::DropOldest:
+        // nothing left to drop, give up on this value rather than spin
+        if (!ring.dropOldest())
+          return input;
+        break;
+      case OverflowPolicy::DropNewest:
+        return input;
+      case OverflowPolicy::Fail:
+        throw ActivationError(fmt::format("Channel {} is full", _name));
+      }
+    }
 
     return input;
   }
 };
 
-struct Broadcast : public Base {
-  std::shared_ptr<Channel> _channel;
+struct Broadcast : public BoundedProducer {
   BroadcastChannel *_bChannel;
 
-  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static inline Parameters broadcastParams{
+      producerParams,
+      {{"Capacity",
+        SHCCSTR("How many messages the channel keeps for listeners falling behind, 0 for the default. Every broadcaster of a "
+                "channel must agree on it."),
+        {CoreInfo::IntType}},
+       {"Overflow",
+        SHCCSTR("What to do when the slowest listener is a whole capacity behind, DropOldest makes it skip the messages it "
+                "missed."),
+        {ChannelOverflowEnumInfo::Type}}}};
 
-  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+  Broadcast() { _overflow = OverflowPolicy::DropOldest; }
 
-  static SHParametersInfo parameters() { return producerParams; }
+  static SHParametersInfo parameters() { return broadcastParams; }
 
   SHTypeInfo compose(const SHInstanceData &data) {
+    if (isShared(_name))
+      throw ComposeError(fmt::format("Broadcast channels can't be shared across processes: {}", _name));
+
     _channel = get(_name);
     _bChannel = &getAndInitChannel<BroadcastChannel>(_channel, data.inputType, _noCopy, _name.c_str());
+    if (_capacity > 0)
+      _bChannel->setCapacity(size_t(_capacity));
     return data.inputType;
   }
 
-  SHVar activate(SHContext *context, const SHVar &input) {
-    assert(_bChannel);
-
-    // we need to support subscriptions during run-time
-    // so we need to lock this operation
-    // furthermore we allow multiple broadcasters so the erase needs this
-    // but we use suspend instead of kernel locking!
-
-    std::unique_lock<std::mutex> lock(_bChannel->subMutex, std::defer_lock);
-
-    // try to lock, if we can't we suspend
-    while (!lock.try_lock()) {
-      SH_SUSPEND(context, 0);
+  void cleanup() {
+    if (_parked) {
+      _bChannel->producers.remove(_parked);
+      _parked = nullptr;
     }
+  }
 
-    // we locked it!
-    for (auto it = _bChannel->subscribers.begin(); it != _bChannel->subscribers.end();) {
-      if (it->closed) {
-        it = _bChannel->subscribers.erase(it);
-      } else {
-        SHVar tmp{};
-
-        // try to get from recycle bin
-        // this might fail but we don't care//
-        // if it fails will just allocate a brand new
-        it->recycle.pop(tmp);
-
-        if (_noCopy) {
-          tmp = input;
-        } else {
-          // this internally will reuse memory
-          cloneVar(tmp, input);
-        }
+  bool full() const { return _bChannel->head() - _bChannel->minCursor() >= _bChannel->capacity(); }
 
-        // enqueue for the stealing
-        it->data.push(tmp);
+  SHVar activate(SHContext *context, const SHVar &input) {
+    assert(_bChannel);
 
-        ++it;
+    // no one to deliver to
+    if (!_bChannel->hasSubscribers())
+      return input;
+
+    if (_overflow != OverflowPolicy::DropOldest) {
+      while (full()) {
+        switch (_overflow) {
+        case OverflowPolicy::Block: {
+          if (_bChannel->closed)
+            return input;
+          // listeners wake us up as they read
+          const auto state = park(context, _bChannel->producers, _parked, [&]() { return !full() || _bChannel->closed; });
+          if (state != SHWireState::Continue)
+            return Var::Empty;
+        } break;
+        case OverflowPolicy::DropNewest:
+          return input;
+        case OverflowPolicy::Fail:
+          throw ActivationError(fmt::format("Broadcast channel {} is full", _name));
+        default:
+          break;
+        }
       }
     }
 
-    // we are done, exiting and going out of scope will unlock
+    // a single copy shared by every listener, reusing the memory of a recycled message
+    auto msg = _bChannel->acquire();
+    if (_noCopy) {
+      msg->value = input;
+    } else {
+      cloneVar(msg->value, input);
+    }
+    _bChannel->publish(msg);
 
     return input;
   }
@@ -190,6 +523,17 @@ struct BufferedConsumer {
 
   bool empty() { return buffer.size() == 0; }
 
+  size_t size() const { return buffer.size(); }
+
+  // A view of the buffer, even with a single value
+  SHVar seq() {
+    SHVar res{};
+    res.valueType = SHType::Seq;
+    res.payload.seqValue.elements = buffer.data();
+    res.payload.seqValue.len = uint32_t(buffer.size());
+    return res;
+  }
+
   operator SHVar() {
     auto len = buffer.size();
     assert(len > 0);
@@ -210,6 +554,7 @@ struct Consumers : public Base {
   BufferedConsumer _storage;
   int64_t _bufferSize = 1;
   int64_t _current = 1;
+  SHWire *_parked{};
   SHTypeInfo _outType{};
   SHTypeInfo _seqType{};
 
@@ -262,6 +607,48 @@ struct Consumers : public Base {
 
 struct Consume : public Consumers {
   MPMCChannel *_mpChannel{};
+  SharedMemoryChannel *_shmChannel{};
+  SharedReader _shmReader;
+  double _maxLatency{0.0};
+  int64_t _maxBytes{0};
+
+  static inline Parameters consumeParams{
+      consumerParams,
+      {{"MaxLatency",
+        SHCCSTR("Micro-batching, when above 0 the values that arrived within this many seconds from the first one are output "
+                "as a sequence of at most Buffer values. When 0 the output waits for exactly Buffer values."),
+        {CoreInfo::FloatType}},
+       {"MaxBytes", SHCCSTR("Micro-batching, stop adding values once the batch is about this big, 0 for no limit."),
+        {CoreInfo::IntType}}}};
+
+  static SHParametersInfo parameters() { return consumeParams; }
+
+  void setParam(int index, const SHVar &value) {
+    switch (index) {
+    case 3:
+      _maxLatency = std::max(0.0, value.payload.floatValue);
+      break;
+    case 4:
+      _maxBytes = std::max(int64_t(0), value.payload.intValue);
+      break;
+    default:
+      Consumers::setParam(index, value);
+      break;
+    }
+  }
+
+  SHVar getParam(int index) {
+    switch (index) {
+    case 3:
+      return Var(_maxLatency);
+    case 4:
+      return Var(_maxBytes);
+    default:
+      return Consumers::getParam(index);
+    }
+  }
+
+  bool batching() const { return _maxLatency > 0.0; }
 
   SHTypeInfo compose(const SHInstanceData &data) {
     if (_outType.basicType == SHType::None) {
@@ -269,9 +656,20 @@ struct Consume : public Consumers {
     }
 
     _channel = get(_name);
-    _mpChannel = &getAndInitChannel<MPMCChannel>(_channel, _outType, _noCopy, _name.c_str());
+    if (isShared(_name)) {
+      _shmChannel = &getAndInitChannel<SharedMemoryChannel>(_channel, _outType, _noCopy, _name.c_str());
+      _shmChannel->open(_name, 0, deriveTypeHash(_outType));
+      OVERRIDE_ACTIVATE(data, activateShared);
+    } else {
+      _mpChannel = &getAndInitChannel<MPMCChannel>(_channel, _outType, _noCopy, _name.c_str());
+      if (batching()) {
+        OVERRIDE_ACTIVATE(data, activateBatch);
+      } else {
+        OVERRIDE_ACTIVATE(data, activate);
+      }
+    }
 
-    if (_bufferSize == 1) {
+    if (_bufferSize == 1 && !batching()) {
       return _outType;
     } else {
       _seqType.basicType = SHType::Seq;
@@ -294,7 +692,7 @@ struct Consume : public Consumers {
     // everytime we are resumed we try to pop a value
     while (_current--) {
       SHVar output{};
-      while (!_mpChannel->data.pop(output)) {
+      while (!_mpChannel->pop(output)) {
         // check also for channel completion
         if (_mpChannel->closed) {
           if (!_storage.empty()) {
@@ -304,7 +702,11 @@ struct Consume : public Consumers {
             return Var::Empty;
           }
         }
-        SH_SUSPEND(context, 0);
+        // parked until a producer pushes or the channel completes
+        const auto state =
+            park(context, _mpChannel->consumers, _parked, [&]() { return _mpChannel->size > 0 || _mpChannel->closed; });
+        if (state != SHWireState::Continue)
+          return Var::Empty;
       }
 
       // keep for recycling
@@ -314,9 +716,101 @@ struct Consume : public Consumers {
     return _storage;
   }
 
+  // Waits as long as needed for a first value, then takes what arrives within the latency window
+  SHVar activateBatch(SHContext *context, const SHVar &input) {
+    assert(_mpChannel);
+
+    _storage.recycle(_mpChannel);
+
+    SHVar output{};
+    while (!_mpChannel->pop(output)) {
+      if (_mpChannel->closed) {
+        context->stopFlow(Var::Empty);
+        return Var::Empty;
+      }
+      const auto state =
+          park(context, _mpChannel->consumers, _parked, [&]() { return _mpChannel->size > 0 || _mpChannel->closed; });
+      if (state != SHWireState::Continue)
+        return Var::Empty;
+    }
+    _storage.add(output);
+
+    size_t bytes = _maxBytes > 0 ? approximateSize(output) : 0;
+    const auto deadline = SHClock::now() + std::chrono::duration_cast<SHClock::duration>(SHDuration(_maxLatency));
+    while (_storage.size() < size_t(std::max(int64_t(1), _bufferSize)) && (_maxBytes == 0 || bytes < size_t(_maxBytes))) {
+      if (_mpChannel->pop(output)) {
+        _storage.add(output);
+        if (_maxBytes > 0)
+          bytes += approximateSize(output);
+        continue;
+      }
+
+      const SHDuration remaining = deadline - SHClock::now();
+      if (_mpChannel->closed || remaining.count() <= 0.0)
+        break;
+
+      // woken by the next push, or when the window closes
+      const auto state = park(
+          context, _mpChannel->consumers, _parked, [&]() { return _mpChannel->size > 0 || _mpChannel->closed; },
+          remaining.count());
+      if (state != SHWireState::Continue)
+        return Var::Empty;
+    }
+
+    // a view of our buffer, values are recycled on the next activation
+    return _storage.seq();
+  }
+
+  // Same semantics as activate and activateBatch, waiting on the ring futex from a pool thread
+  SHVar activateShared(SHContext *context, const SHVar &input) {
+    assert(_shmChannel);
+    auto &ring = _shmChannel->ring;
+
+    _shmReader.clear();
+
+    const auto wanted = size_t(std::max(int64_t(1), _bufferSize));
+    size_t bytes = 0;
+    SHClock::time_point deadline{};
+    while (_shmReader.count < wanted && (!batching() || _maxBytes == 0 || bytes < size_t(_maxBytes))) {
+      if (_shmReader.pop(ring)) {
+        if (_maxBytes > 0)
+          bytes += approximateSize(_shmReader.last());
+        if (_shmReader.count == 1)
+          deadline = SHClock::now() + std::chrono::duration_cast<SHClock::duration>(SHDuration(_maxLatency));
+        continue;
+      }
+
+      if (ring.closed() && ring.empty()) {
+        if (_shmReader.count > 0)
+          break;
+        context->stopFlow(Var::Empty);
+        return Var::Empty;
+      }
+
+      auto timeout = SharedWaitSlice;
+      if (batching() && _shmReader.count > 0) {
+        const SHDuration remaining = deadline - SHClock::now();
+        if (remaining.count() <= 0.0)
+          break;
+        timeout = std::min(timeout, remaining.count());
+      }
+      if (!awaitShared(context, ring, [&]() { ring.waitReadable(timeout); }))
+        return Var::Empty;
+    }
+
+    if (_bufferSize == 1 && !batching())
+      return _shmReader.values[0];
+    return _shmReader.seq();
+  }
+
   void cleanup() {
     Consumers::cleanup();
 
+    if (_parked) {
+      _mpChannel->consumers.remove(_parked);
+      _parked = nullptr;
+    }
+
     // cleanup storage
     if (_mpChannel)
       _storage.recycle(_mpChannel);
@@ -324,16 +818,50 @@ struct Consume : public Consumers {
 };
 
 struct Listen : public Consumers {
-  BroadcastChannel *_bChannel;
-  MPMCChannel *_subscriptionChannel;
+  BroadcastChannel *_bChannel{};
+  std::shared_ptr<BroadcastChannel::Subscriber> _subscriber;
+  // messages referenced by the last output
+  std::vector<BroadcastChannel::Message *> _held;
+  std::vector<SHVar> _values;
+
+  void releaseHeld() {
+    for (auto msg : _held)
+      _bChannel->release(msg);
+    _held.clear();
+    _values.clear();
+  }
+
+  SHVar output() {
+    if (_values.size() == 1)
+      return _values[0];
+    // a view of the shared messages, no copies
+    SHVar res{};
+    res.valueType = SHType::Seq;
+    res.payload.seqValue.elements = _values.data();
+    res.payload.seqValue.len = uint32_t(_values.size());
+    return res;
+  }
+
+  void warmup(SHContext *context) {
+    // listening starts from the latest message, cleanup unsubscribes
+    if (!_subscriber)
+      _subscriber = _bChannel->subscribe();
+  }
 
   void cleanup() {
     Consumers::cleanup();
 
-    // cleanup storage
-    if (_subscriptionChannel) {
-      _subscriptionChannel->closed = true;
-      _storage.recycle(_subscriptionChannel);
+    if (_parked) {
+      _bChannel->consumers.remove(_parked);
+      _parked = nullptr;
+    }
+
+    if (_bChannel) {
+      releaseHeld();
+      if (_subscriber) {
+        _bChannel->unsubscribe(_subscriber);
+        _subscriber.reset();
+      }
     }
   }
 
@@ -341,10 +869,12 @@ struct Listen : public Consumers {
     if (_outType.basicType == SHType::None) {
       throw std::logic_error("Listen: Type parameter is required.");
     }
+    if (isShared(_name))
+      throw ComposeError(fmt::format("Broadcast channels can't be shared across processes: {}", _name));
 
     _channel = get(_name);
     _bChannel = &getAndInitChannel<BroadcastChannel>(_channel, _outType, _noCopy, _name.c_str());
-    _subscriptionChannel = &_bChannel->subscribe();
+    // no subscription here, a composed wire might never run and would pin the slowest cursor forever
 
     if (_bufferSize == 1) {
       return _outType;
@@ -358,39 +888,158 @@ struct Listen : public Consumers {
 
   SHVar activate(SHContext *context, const SHVar &input) {
     assert(_bChannel);
-    assert(_subscriptionChannel);
+    assert(_subscriber);
 
-    // send previous values to recycle
-    _storage.recycle(_subscriptionChannel);
+    // the previous output is not referenced anymore
+    releaseHeld();
 
     // reset buffer
     _current = _bufferSize;
 
     // suspending; and
-    // everytime we are resumed we try to pop a value
+    // everytime we are resumed we try to read a message
     while (_current--) {
-      SHVar output{};
-      while (!_subscriptionChannel->data.pop(output)) {
+      BroadcastChannel::Message *msg;
+      while (!_bChannel->read(*_subscriber, msg)) {
         // check also for channel completion
         if (_bChannel->closed) {
-          if (!_storage.empty()) {
-            return _storage;
+          if (!_values.empty()) {
+            return output();
           } else {
             context->stopFlow(Var::Empty);
             return Var::Empty;
           }
         }
-        SH_SUSPEND(context, 0);
+        // parked until a broadcast or the channel completes
+        const auto state = park(context, _bChannel->consumers, _parked,
+                                [&]() { return _subscriber->cursor < _bChannel->head() || _bChannel->closed; });
+        if (state != SHWireState::Continue)
+          return Var::Empty;
       }
 
-      // keep for recycling
-      _storage.add(output);
+      _held.push_back(msg);
+      _values.push_back(msg->value);
     }
 
-    return _storage;
+    return output();
   }
 };
 
+BroadcastChannel::BroadcastChannel(bool noCopy)
+    : ChannelShared(), _subscribers(std::make_shared<const Subscribers>()), _noCopy(noCopy) {
+  setCapacity(DefaultCapacity);
+}
+
+BroadcastChannel::~BroadcastChannel() {
+  // every message ever allocated is here, in the ring, in the pool or still held
+  for (auto &msg : _messages) {
+    if (!_noCopy)
+      destroyVar(msg->value);
+  }
+}
+
+void BroadcastChannel::setCapacity(size_t capacity) {
+  size_t size = 1;
+  while (size < capacity)
+    size <<= 1;
+  if (_ring && size == _mask + 1)
+    return;
+  if (_head > 0)
+    throw ComposeError("Broadcast channel capacity can't change once messages were published");
+
+  _ring.reset(new std::atomic<Message *>[size]);
+  for (size_t i = 0; i < size; i++)
+    _ring[i] = nullptr;
+  _mask = size - 1;
+}
+
+std::shared_ptr<BroadcastChannel::Subscriber> BroadcastChannel::subscribe() {
+  auto subscriber = std::make_shared<Subscriber>();
+  subscriber->cursor = head();
+
+  std::scoped_lock lock(_subscribersMutex);
+  auto next = std::make_shared<Subscribers>(*std::atomic_load(&_subscribers));
+  next->push_back(subscriber);
+  std::atomic_store(&_subscribers, std::shared_ptr<const Subscribers>(std::move(next)));
+  return subscriber;
+}
+
+void BroadcastChannel::unsubscribe(const std::shared_ptr<Subscriber> &subscriber) {
+  {
+    std::scoped_lock lock(_subscribersMutex);
+    auto next = std::make_shared<Subscribers>(*std::atomic_load(&_subscribers));
+    next->erase(std::remove(next->begin(), next->end(), subscriber), next->end());
+    std::atomic_store(&_subscribers, std::shared_ptr<const Subscribers>(std::move(next)));
+  }
+  // it might have been the slowest one
+  producers.wakeAll();
+}
+
+uint64_t BroadcastChannel::minCursor() const {
+  auto subscribers = std::atomic_load(&_subscribers);
+  auto res = head();
+  for (auto &subscriber : *subscribers)
+    res = std::min(res, subscriber->cursor.load(std::memory_order_acquire));
+  return res;
+}
+
+BroadcastChannel::Message *BroadcastChannel::acquire() {
+  Message *msg;
+  if (_pool.pop(msg))
+    return msg;
+
+  std::scoped_lock lock(_messagesMutex);
+  return _messages.emplace_back(std::make_unique<Message>()).get();
+}
+
+void BroadcastChannel::publish(Message *msg) {
+  // claimed first so that many broadcasters can publish, readers wait for the slot to be filled
+  const auto seq = _head.fetch_add(1, std::memory_order_acq_rel);
+  msg->seq.store(seq, std::memory_order_relaxed);
+  // readers can only take a reference from here on, which also publishes the value
+  msg->refcount.store(1, std::memory_order_release);
+  auto old = _ring[seq & _mask].exchange(msg, std::memory_order_acq_rel);
+  if (old)
+    release(old);
+  consumers.wakeAll();
+}
+
+bool BroadcastChannel::read(Subscriber &subscriber, Message *&msg) {
+  while (true) {
+    const auto seq = subscriber.cursor.load(std::memory_order_relaxed);
+    const auto last = head();
+    if (seq >= last)
+      return false;
+
+    // the oldest message still in the ring, anything before was overwritten
+    const auto oldest = last > capacity() ? last - capacity() : 0;
+    if (seq < oldest) {
+      subscriber.lagged += oldest - seq;
+      subscriber.cursor.store(oldest, std::memory_order_release);
+      continue;
+    }
+
+    auto candidate = _ring[seq & _mask].load(std::memory_order_acquire);
+    if (candidate && candidate->tryRef()) {
+      const auto candidateSeq = candidate->seq.load(std::memory_order_relaxed);
+      if (candidateSeq == seq) {
+        subscriber.cursor.store(seq + 1, std::memory_order_release);
+        msg = candidate;
+        // a blocked broadcaster might be waiting on us
+        producers.wakeAll();
+        return true;
+      }
+      release(candidate);
+      // claimed but not filled yet
+      if (candidateSeq < seq)
+        return false;
+    } else if (!candidate) {
+      return false;
+    }
+    // overwritten while we were reading it, try again with the new head
+  }
+}
+
 struct Complete : public Base {
   std::shared_ptr<Channel> _channel;
   ChannelShared *_mpChannel{};
@@ -425,6 +1074,9 @@ struct Complete : public Base {
 
   SHTypeInfo compose(const SHInstanceData &data) {
     _channel = get(_name);
+    // the other end might live in another process only
+    if (isShared(_name) && _channel->index() == 0)
+      _channel->emplace<SharedMemoryChannel>(false).open(_name, 0, 0);
     _mpChannel = std::visit(
         [&](auto &arg) {
           using T = std::decay_t<decltype(arg)>;
@@ -446,10 +1098,29 @@ struct Complete : public Base {
       SHLOG_INFO("Complete called on an already closed channel: {}", _name);
     }
 
+    if (auto shared = std::get_if<SharedMemoryChannel>(_channel.get()))
+      shared->ring.complete();
+
+    // parked wires need to see the channel closed
+    _mpChannel->consumers.wakeAll();
+    _mpChannel->producers.wakeAll();
+
     return input;
   }
 };
 
+void SharedMemoryChannel::open(const std::string &name, size_t capacity, uint64_t typeHash) {
+  std::scoped_lock lock(_mutex);
+  if (!ring.isOpen()) {
+    // a single path component for shm_open
+    auto segment = "shards." + name.substr(SharedPrefix.size());
+    std::replace(segment.begin(), segment.end(), '/', '_');
+    ring.open(segment, capacity);
+  }
+  if (typeHash != 0)
+    ring.claimType(typeHash);
+}
+
 std::shared_ptr<Channel> get(const std::string &name) {
   static std::unordered_map<std::string, std::weak_ptr<Channel>> channels;
   static std::shared_mutex mutex;
@@ -477,6 +1148,7 @@ std::shared_ptr<Channel> get(const std::string &name) {
 } // namespace shards
 SHARDS_REGISTER_FN(channels) {
   using namespace shards::channels;
+  REGISTER_ENUM(ChannelOverflowEnumInfo);
   REGISTER_SHARD("Produce", Produce);
   REGISTER_SHARD("Broadcast", Broadcast);
   REGISTER_SHARD("Consume", Consume);
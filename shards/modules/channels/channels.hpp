@@ -1,20 +1,56 @@
 #ifndef SH_CORE_SHARDS_CHANNELS
 #define SH_CORE_SHARDS_CHANNELS
 
+#include "shared_ring.hpp"
 #include <shards/core/shared.hpp>
 #include <atomic>
 #include <boost/lockfree/queue.hpp>
 #include <boost/lockfree/stack.hpp>
 #include <memory>
 #include <mutex>
+#include <string_view>
 #include <variant>
+#include <vector>
 
 namespace shards {
 namespace channels {
 
+// What a producer does when a bounded channel is full
+enum class OverflowPolicy { Block, DropOldest, DropNewest, Fail };
+
+// Wires parked until the other end of a channel makes progress,
+// only wires ticked by a mesh can be parked, others keep polling every tick
+class WaitList {
+public:
+  // Registers the wire running context, false if it can't be woken up
+  bool add(SHContext *context, SHWire *&parked);
+  void remove(SHWire *wire);
+  // Thread safe, resumes all the parked wires
+  void wakeAll() {
+    if (_count.load(std::memory_order_acquire) > 0)
+      wakeAllSlow();
+  }
+
+private:
+  void wakeAllSlow();
+
+  struct Waiter {
+    std::weak_ptr<SHMesh> mesh;
+    SHWire *wire;
+  };
+
+  std::mutex _mutex;
+  std::vector<Waiter> _waiters;
+  std::atomic_size_t _count{0};
+};
+
 struct ChannelShared {
   SHTypeInfo type;
   std::atomic_bool closed;
+  // consumers waiting for data or the channel to close
+  WaitList consumers;
+  // producers waiting for room in a full channel
+  WaitList producers;
 };
 
 struct DummyChannel : public ChannelShared {};
@@ -36,33 +72,141 @@ struct MPMCChannel : public ChannelShared {
     }
   }
 
+  // Reserves a slot for a push, false if the channel is full
+  bool reserve() {
+    if (capacity == 0) {
+      size++;
+      return true;
+    }
+    auto current = size.load();
+    do {
+      if (current >= capacity)
+        return false;
+    } while (!size.compare_exchange_weak(current, current + 1));
+    return true;
+  }
+
+  // Requires a reserved slot
+  void push(const SHVar &var) {
+    data.push(var);
+    consumers.wakeAll();
+  }
+
+  bool pop(SHVar &var) {
+    if (!data.pop(var))
+      return false;
+    size--;
+    producers.wakeAll();
+    return true;
+  }
+
   // A single source to steal data from
   boost::lockfree::queue<SHVar> data{16};
   boost::lockfree::stack<SHVar> recycle{16};
+  // 0 means unbounded
+  size_t capacity{0};
+  // values queued or about to be
+  std::atomic_size_t size{0};
 
 private:
   bool _noCopy;
 };
 
-struct Broadcast;
+// Broadcast ring, every message is copied once and shared by all the listeners,
+// each listener reads at its own pace through its own cursor
 class BroadcastChannel : public ChannelShared {
 public:
-  BroadcastChannel(bool noCopy) : ChannelShared(), _noCopy(noCopy) {}
+  struct Message {
+    std::atomic_uint32_t refcount{0};
+    // the sequence number the message was published with
+    std::atomic_uint64_t seq{0};
+    SHVar value{};
+
+    // Fails once the message went back to the pool, messages are never freed while the channel lives
+    // so this is safe to call on a message that was released in the meantime
+    bool tryRef() {
+      auto current = refcount.load(std::memory_order_relaxed);
+      do {
+        if (current == 0)
+          return false;
+      } while (!refcount.compare_exchange_weak(current, current + 1, std::memory_order_acquire));
+      return true;
+    }
+  };
 
-  MPMCChannel &subscribe() {
-    // we automatically cleanup based on the closed flag of the inner channel
-    std::unique_lock<std::mutex> lock(subMutex);
-    return subscribers.emplace_back(_noCopy);
+  struct Subscriber {
+    // next sequence to read
+    std::atomic_uint64_t cursor{0};
+    // messages overwritten before this subscriber could read them
+    std::atomic_uint64_t lagged{0};
+  };
+
+  static constexpr size_t DefaultCapacity = 256;
+
+  BroadcastChannel(bool noCopy);
+  ~BroadcastChannel();
+
+  // Compose time only, rounded up to a power of two
+  void setCapacity(size_t capacity);
+  size_t capacity() const { return _mask + 1; }
+
+  uint64_t head() const { return _head.load(std::memory_order_acquire); }
+
+  std::shared_ptr<Subscriber> subscribe();
+  void unsubscribe(const std::shared_ptr<Subscriber> &subscriber);
+  bool hasSubscribers() const { return !std::atomic_load(&_subscribers)->empty(); }
+  // The slowest subscriber cursor, head() if there are none
+  uint64_t minCursor() const;
+
+  // A message owned by the caller, to fill and publish
+  Message *acquire();
+  // Takes ownership of msg, overwriting the oldest message if the ring is full
+  void publish(Message *msg);
+  // Takes a reference on the next message for subscriber, false if none is available yet
+  bool read(Subscriber &subscriber, Message *&msg);
+
+  void release(Message *msg) {
+    if (msg->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      _pool.push(msg);
   }
 
-protected:
-  friend struct Broadcast;
-  std::mutex subMutex;
-  std::list<MPMCChannel> subscribers;
+private:
+  std::unique_ptr<std::atomic<Message *>[]> _ring;
+  size_t _mask{0};
+  std::atomic_uint64_t _head{0};
+
+  boost::lockfree::stack<Message *> _pool{64};
+  std::mutex _messagesMutex;
+  std::vector<std::unique_ptr<Message>> _messages;
+
+  // replaced as a whole when subscribers come and go, readers never lock (read-copy-update),
+  // old lists are reclaimed once the last reader drops them
+  using Subscribers = std::vector<std::shared_ptr<Subscriber>>;
+  std::mutex _subscribersMutex;
+  std::shared_ptr<const Subscribers> _subscribers;
+
   bool _noCopy = false;
 };
 
-using Channel = std::variant<DummyChannel, MPMCChannel, BroadcastChannel>;
+// Channels named with this prefix cross process boundaries through a shared memory ring
+constexpr std::string_view SharedPrefix = "shm:";
+inline bool isShared(const std::string &name) { return name.compare(0, SharedPrefix.size(), SharedPrefix) == 0; }
+
+// Values are copied in and out of the ring, blittables raw and others through Serialization
+struct SharedMemoryChannel : public ChannelShared {
+  SharedMemoryChannel(bool) : ChannelShared() {}
+
+  // Attaches the ring once, every shard of this process shares the mapping.
+  // capacity is in bytes and only used by the process creating the segment.
+  void open(const std::string &name, size_t capacity, uint64_t typeHash);
+
+  SharedRing ring;
+
+private:
+  std::mutex _mutex;
+};
+
+using Channel = std::variant<DummyChannel, MPMCChannel, BroadcastChannel, SharedMemoryChannel>;
 std::shared_ptr<Channel> get(const std::string &name);
 
 } // namespace channels
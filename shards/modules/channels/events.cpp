@@ -7,9 +7,14 @@
 
 namespace shards {
 namespace Events {
+// dispatchers are process wide, wires using them can't be ticked concurrently (see SHMesh::setWorkers)
+static TableVar sharedProperties{{Var("shared"), Var(true)}};
+
 struct Base {
   std::optional<std::reference_wrapper<EventDispatcher>> _dispatcher;
 
+  static const SHTable *properties() { return &sharedProperties.payload.tableValue; }
+
   static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
   static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
 
@@ -38,12 +43,30 @@ struct Base {
   void cleanup() { PARAM_CLEANUP(); }
 };
 
+// resolves the ID parameter, entt::null if there is none and no wire ID either
+inline entt::id_type eventId(SHContext *context, const SHVar &idVar) {
+  if (idVar.valueType == SHType::Int)
+    return static_cast<entt::id_type>(idVar.payload.intValue);
+  return findId(context);
+}
+
 struct Send : Base {
+  PARAM_VAR(_capacity, "Capacity",
+            "How many events of a frame are kept for each ID, past it the oldest ones are overwritten. Every sender of an event "
+            "must agree on it.",
+            {CoreInfo::IntType, CoreInfo::NoneType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_eventName), PARAM_IMPL_FOR(_id), PARAM_IMPL_FOR(_capacity));
+
+  EventBuffer *_buffer{};
+  entt::id_type _bufferId{entt::null};
+
   SHTypeInfo compose(const SHInstanceData &data) {
     Base::compose(data);
 
+    auto &dispatcher = _dispatcher->get();
+
     // when we send we store the type of the event
-    auto currentType = (*_dispatcher).get().type;
+    auto currentType = dispatcher.type;
     if (currentType.basicType != SHType::None) {
       if (!matchTypes(data.inputType, currentType, false, true)) {
         SHLOG_ERROR("Event type mismatch, expected {} got {}", currentType, data.inputType);
@@ -51,40 +74,40 @@ struct Send : Base {
       }
     } else {
       // we store the type of the event
-      (*_dispatcher).get().type = data.inputType;
+      dispatcher.type = data.inputType;
+    }
+
+    if (_capacity.valueType == SHType::Int) {
+      const auto capacity = size_t(std::max(int64_t(1), _capacity.payload.intValue));
+      if (dispatcher.frame > 0 && dispatcher.capacity != capacity)
+        throw ComposeError(fmt::format("Attempted to change the capacity of event {}", dispatcher.name));
+      dispatcher.capacity = capacity;
     }
 
+    _buffer = nullptr;
     return data.inputType;
   }
 
   SHVar activate(SHContext *context, const SHVar &input) {
     assert(_dispatcher);
 
-    auto &dispatcher = _dispatcher->get();
-
-    entt::id_type id;
-    auto &idVar = _id.get();
-    if (idVar.valueType == SHType::Int) {
-      id = static_cast<entt::id_type>(idVar.payload.intValue);
-    } else {
-      id = findId(context);
+    // the buffer is looked up only when the ID changes, sending is a clone into a recycled slot
+    const auto id = eventId(context, _id.get());
+    if (!_buffer || id != _bufferId) {
+      _buffer = &_dispatcher->get().buffer(id);
+      _bufferId = id;
     }
-
-    OwnedVar ownedInput = input;
-    if (id == entt::null)
-      dispatcher->enqueue(std::move(ownedInput));
-    else
-      dispatcher->enqueue_hint(id, std::move(ownedInput));
+    _buffer->push(input);
 
     return input;
   }
 };
 
 struct Receive : Base {
-  SeqVar _eventsIn;
-  SeqVar _eventsOut;
-
-  entt::connection _connection;
+  EventBuffer *_buffer{};
+  entt::id_type _bufferId{entt::null};
+  // the frame we last output, the same events are never output twice
+  uint64_t _frame{0};
 
   Type singleType;
   Type outputType;
@@ -92,8 +115,6 @@ struct Receive : Base {
   static SHTypesInfo inputTypes() { return CoreInfo::NoneType; }
   static SHTypesInfo outputTypes() { return CoreInfo::AnySeqType; }
 
-  void onEvent(OwnedVar &event) { _eventsIn.push_back(event); }
-
   SHTypeInfo compose(const SHInstanceData &data) {
     Base::compose(data);
 
@@ -111,45 +132,33 @@ struct Receive : Base {
     return outputType;
   }
 
-  void warmup(SHContext *context) { Base::warmup(context); }
+  void warmup(SHContext *context) {
+    Base::warmup(context);
+    // only what is sent from now on
+    _frame = _dispatcher->get().frame;
+  }
 
   void cleanup() {
     Base::cleanup();
-
-    assert(_dispatcher);
-
-    if (_connection)
-      _connection.release();
-
-    _prevId = Var::Empty;
+    _buffer = nullptr;
   }
 
-  SHVar _prevId{};
-
   SHVar activate(SHContext *context, const SHVar &input) {
-    auto &idVar = _id.get();
-    if (!_connection || _prevId != idVar) {
-      assert(_dispatcher);
-
-      entt::id_type id;
-      if (idVar.valueType == SHType::Int) {
-        id = static_cast<entt::id_type>(idVar.payload.intValue);
-      } else {
-        id = findId(context);
-      }
-
-      if (_connection)
-        _connection.release();
+    assert(_dispatcher);
 
-      if (id == entt::null)
-        _connection = _dispatcher->get()->sink<OwnedVar>().connect<&Receive::onEvent>(this);
-      else
-        _connection = _dispatcher->get()->sink<OwnedVar>(id).connect<&Receive::onEvent>(this);
+    auto &dispatcher = _dispatcher->get();
+    const auto id = eventId(context, _id.get());
+    if (!_buffer || id != _bufferId) {
+      _buffer = &dispatcher.buffer(id);
+      _bufferId = id;
     }
 
-    std::swap(_eventsOut, _eventsIn);
-    _eventsIn.clear();
-    return Var(_eventsOut);
+    if (_frame == dispatcher.frame)
+      return Var(SHSeq{});
+    _frame = dispatcher.frame;
+
+    // a view of the whole frame, valid until the next Events.Update
+    return _buffer->front();
   }
 };
 
@@ -157,9 +166,7 @@ struct Update : Base {
   SHVar activate(SHContext *context, const SHVar &input) {
     assert(_dispatcher);
 
-    auto &dispatcher = _dispatcher->get();
-
-    dispatcher->update();
+    _dispatcher->get().update();
 
     return input;
   }
@@ -0,0 +1,338 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2020 Fragcolor Pte. Ltd. */
+
+#include "shared_ring.hpp"
+#include <shards/core/runtime.hpp>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#if SH_SHARED_RING_SUPPORTED
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace shards {
+namespace channels {
+
+// Lives at the start of the segment, the data follows on its own cache line.
+// Everything is lock free atomics, plain integers in memory, so any process can map it.
+struct SharedRing::Header {
+  static constexpr uint32_t Magic = 'shRB';
+  static constexpr uint32_t Version = 1;
+
+  std::atomic_uint32_t magic;
+  uint32_t version;
+  uint64_t capacity;
+  // 0 until someone attaches with a type
+  std::atomic_uint64_t typeHash;
+  std::atomic_uint32_t attached;
+  std::atomic_uint32_t closed;
+
+  // writers side
+  alignas(64) std::atomic_uint64_t head;
+  std::atomic_uint32_t writeLock;
+  // futex word, bumped every time room is made
+  std::atomic_uint32_t spaceSeq;
+  std::atomic_uint32_t writersWaiting;
+
+  // readers side
+  alignas(64) std::atomic_uint64_t tail;
+  std::atomic_uint32_t readLock;
+  // futex word, bumped every time a record is written
+  std::atomic_uint32_t dataSeq;
+  std::atomic_uint32_t readersWaiting;
+};
+
+namespace {
+static_assert(std::atomic_uint32_t::is_always_lock_free && std::atomic_uint64_t::is_always_lock_free,
+              "Shared rings need lock free atomics");
+static_assert(sizeof(std::atomic_uint32_t) == sizeof(uint32_t));
+
+// the header fits in here, keeping the data cache line aligned
+constexpr size_t DataOffset = 256;
+constexpr uint32_t WrapMarker = UINT32_MAX;
+constexpr size_t MinCapacity = 4096;
+
+constexpr size_t alignRecord(size_t size) { return (size + 7) & ~size_t(7); }
+
+// Records are short copies, so spinning then yielding is enough
+struct SpinGuard {
+  std::atomic_uint32_t &lock;
+  SpinGuard(std::atomic_uint32_t &lock) : lock(lock) {
+    int spins = 0;
+    while (lock.exchange(1, std::memory_order_acquire)) {
+      if (++spins > 64)
+        std::this_thread::yield();
+    }
+  }
+  ~SpinGuard() { lock.store(0, std::memory_order_release); }
+};
+
+void futexWait(std::atomic_uint32_t &word, uint32_t expected, double timeout) {
+#if SH_SHARED_RING_SUPPORTED && defined(__linux__)
+  timespec ts;
+  ts.tv_sec = time_t(timeout);
+  ts.tv_nsec = long((timeout - double(ts.tv_sec)) * 1e9);
+  // not FUTEX_PRIVATE, waiters and wakers live in different processes
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+#else
+  const auto deadline = SHClock::now() + std::chrono::duration_cast<SHClock::duration>(SHDuration(timeout));
+  while (word.load(std::memory_order_acquire) == expected && SHClock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+}
+
+void futexWakeAll(std::atomic_uint32_t &word) {
+#if SH_SHARED_RING_SUPPORTED && defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+} // namespace
+
+void SharedRing::open(const std::string &name, size_t capacity) {
+  static_assert(sizeof(Header) <= DataOffset);
+
+#if !SH_SHARED_RING_SUPPORTED
+  throw SHException("Shared memory channels are not supported on this platform");
+#else
+  if (isOpen())
+    throw SHException(fmt::format("Shared ring {} is already open", _segmentName));
+
+  if (capacity == 0)
+    capacity = DefaultCapacity;
+  size_t size = MinCapacity;
+  while (size < capacity)
+    size <<= 1;
+
+  const auto segmentName = "/" + name;
+  auto fd = shm_open(segmentName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  const auto creator = fd != -1;
+  if (!creator) {
+    if (errno == EEXIST)
+      fd = shm_open(segmentName.c_str(), O_RDWR, 0600);
+    if (fd == -1)
+      throw SHException(fmt::format("Failed to open shared memory {}: {}", segmentName, strerror(errno)));
+  } else if (ftruncate(fd, off_t(DataOffset + size)) != 0) {
+    const auto err = errno;
+    ::close(fd);
+    shm_unlink(segmentName.c_str());
+    throw SHException(fmt::format("Failed to size shared memory {}: {}", segmentName, strerror(err)));
+  }
+
+  if (!creator) {
+    // the creator might still be sizing and initializing the segment
+    const auto deadline = SHClock::now() + std::chrono::seconds(2);
+    struct stat st {};
+    Header *header = nullptr;
+    while (true) {
+      if (!header && fstat(fd, &st) == 0 && size_t(st.st_size) >= DataOffset) {
+        auto mapped = mmap(nullptr, DataOffset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped != MAP_FAILED)
+          header = reinterpret_cast<Header *>(mapped);
+      }
+      if (header && header->magic.load(std::memory_order_acquire) == Header::Magic)
+        break;
+      if (SHClock::now() > deadline) {
+        if (header)
+          munmap(header, DataOffset);
+        ::close(fd);
+        throw SHException(fmt::format("Shared memory {} was never initialized", segmentName));
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (header->version != Header::Version) {
+      munmap(header, DataOffset);
+      ::close(fd);
+      throw SHException(fmt::format("Shared memory {} has an incompatible layout", segmentName));
+    }
+    size = size_t(header->capacity);
+    munmap(header, DataOffset);
+  }
+
+  auto mapped = mmap(nullptr, DataOffset + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // the mapping keeps the segment alive
+  ::close(fd);
+  if (mapped == MAP_FAILED)
+    throw SHException(fmt::format("Failed to map shared memory {}: {}", segmentName, strerror(errno)));
+
+  _header = reinterpret_cast<Header *>(mapped);
+  _data = reinterpret_cast<uint8_t *>(mapped) + DataOffset;
+  _mappedSize = DataOffset + size;
+  _segmentName = segmentName;
+
+  if (creator) {
+    // ftruncate zero filled the rest
+    _header->version = Header::Version;
+    _header->capacity = size;
+    _header->magic.store(Header::Magic, std::memory_order_release);
+  }
+  _header->attached++;
+#endif
+}
+
+void SharedRing::claimType(uint64_t typeHash) {
+  uint64_t expected = 0;
+  if (!_header->typeHash.compare_exchange_strong(expected, typeHash) && expected != typeHash)
+    throw SHException(fmt::format("Shared memory {} already carries another type", _segmentName));
+}
+
+void SharedRing::close() {
+#if SH_SHARED_RING_SUPPORTED
+  if (!_header)
+    return;
+
+  if (_header->attached.fetch_sub(1) == 1)
+    shm_unlink(_segmentName.c_str());
+  munmap(_header, _mappedSize);
+  _header = nullptr;
+  _data = nullptr;
+  _mappedSize = 0;
+#endif
+}
+
+size_t SharedRing::capacity() const { return size_t(_header->capacity); }
+
+bool SharedRing::hasRoom(size_t size) const {
+  const auto cap = capacity();
+  const auto recSize = alignRecord(RecordHeaderSize + size);
+  const auto head = _header->head.load(std::memory_order_acquire);
+  const auto tail = _header->tail.load(std::memory_order_acquire);
+  const auto offset = size_t(head & (cap - 1));
+  // a record that does not fit before the end wastes the space left
+  const auto pad = cap - offset < recSize ? cap - offset : 0;
+  return head + pad + recSize - tail <= cap;
+}
+
+bool SharedRing::tryWrite(const uint8_t *data, size_t size) {
+  const auto cap = capacity();
+  const auto recSize = alignRecord(RecordHeaderSize + size);
+  // past half the ring the padding before a wrap could keep it from ever fitting
+  if (recSize > cap / 2)
+    return false;
+
+  {
+    SpinGuard guard(_header->writeLock);
+    auto head = _header->head.load(std::memory_order_relaxed);
+    const auto tail = _header->tail.load(std::memory_order_acquire);
+    auto offset = size_t(head & (cap - 1));
+    const auto pad = cap - offset < recSize ? cap - offset : 0;
+    if (head + pad + recSize - tail > cap)
+      return false;
+
+    if (pad) {
+      std::memcpy(_data + offset, &WrapMarker, RecordHeaderSize);
+      head += pad;
+      offset = 0;
+    }
+    const auto len = uint32_t(size);
+    std::memcpy(_data + offset, &len, RecordHeaderSize);
+    std::memcpy(_data + offset + RecordHeaderSize, data, size);
+    _header->head.store(head + recSize, std::memory_order_release);
+  }
+
+  _header->dataSeq++;
+  if (_header->readersWaiting > 0)
+    futexWakeAll(_header->dataSeq);
+  return true;
+}
+
+bool SharedRing::tryRead(std::vector<uint8_t> &out) {
+  const auto cap = capacity();
+  {
+    SpinGuard guard(_header->readLock);
+    auto tail = _header->tail.load(std::memory_order_relaxed);
+    const auto head = _header->head.load(std::memory_order_acquire);
+    if (tail == head)
+      return false;
+
+    auto offset = size_t(tail & (cap - 1));
+    uint32_t len;
+    std::memcpy(&len, _data + offset, RecordHeaderSize);
+    if (len == WrapMarker) {
+      tail += cap - offset;
+      offset = 0;
+      std::memcpy(&len, _data, RecordHeaderSize);
+    }
+    const auto begin = _data + offset + RecordHeaderSize;
+    out.assign(begin, begin + len);
+    _header->tail.store(tail + alignRecord(RecordHeaderSize + len), std::memory_order_release);
+  }
+
+  _header->spaceSeq++;
+  if (_header->writersWaiting > 0)
+    futexWakeAll(_header->spaceSeq);
+  return true;
+}
+
+bool SharedRing::dropOldest() {
+  const auto cap = capacity();
+  {
+    SpinGuard guard(_header->readLock);
+    auto tail = _header->tail.load(std::memory_order_relaxed);
+    const auto head = _header->head.load(std::memory_order_acquire);
+    if (tail == head)
+      return false;
+
+    auto offset = size_t(tail & (cap - 1));
+    uint32_t len;
+    std::memcpy(&len, _data + offset, RecordHeaderSize);
+    if (len == WrapMarker) {
+      tail += cap - offset;
+      std::memcpy(&len, _data, RecordHeaderSize);
+    }
+    _header->tail.store(tail + alignRecord(RecordHeaderSize + len), std::memory_order_release);
+  }
+
+  _header->spaceSeq++;
+  if (_header->writersWaiting > 0)
+    futexWakeAll(_header->spaceSeq);
+  return true;
+}
+
+bool SharedRing::empty() const {
+  return _header->tail.load(std::memory_order_acquire) == _header->head.load(std::memory_order_acquire);
+}
+
+void SharedRing::waitReadable(double timeout) {
+  // registered before sampling the sequence, a writer either sees us waiting or bumps the sequence we wait on
+  _header->readersWaiting++;
+  const auto seq = _header->dataSeq.load();
+  if (empty() && !closed())
+    futexWait(_header->dataSeq, seq, timeout);
+  _header->readersWaiting--;
+}
+
+void SharedRing::waitWritable(size_t size, double timeout) {
+  _header->writersWaiting++;
+  const auto seq = _header->spaceSeq.load();
+  if (!hasRoom(size) && !closed())
+    futexWait(_header->spaceSeq, seq, timeout);
+  _header->writersWaiting--;
+}
+
+void SharedRing::wakeAll() {
+  // bumped so that a waiter about to sleep returns right away
+  _header->dataSeq++;
+  _header->spaceSeq++;
+  futexWakeAll(_header->dataSeq);
+  futexWakeAll(_header->spaceSeq);
+}
+
+bool SharedRing::closed() const { return _header->closed.load(std::memory_order_acquire) != 0; }
+
+void SharedRing::complete() {
+  _header->closed.store(1, std::memory_order_release);
+  wakeAll();
+}
+
+} // namespace channels
+} // namespace shards
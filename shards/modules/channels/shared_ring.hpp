@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2020 Fragcolor Pte. Ltd. */
+
+#ifndef SH_CORE_SHARDS_CHANNELS_SHARED_RING
+#define SH_CORE_SHARDS_CHANNELS_SHARED_RING
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if (defined(__linux__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+#define SH_SHARED_RING_SUPPORTED 1
+#else
+#define SH_SHARED_RING_SUPPORTED 0
+#endif
+
+namespace shards {
+namespace channels {
+
+// A byte ring living in a named shared memory segment, so that processes on the same host can exchange records.
+// Records are [uint32 size][bytes] aligned to 8, a record never wraps, a marker sends readers back to the start.
+// Writers and readers are serialized among themselves by a spin lock in the segment, readers and writers
+// never block each other. Waiting is done with futexes on Linux, by sleeping elsewhere.
+class SharedRing {
+public:
+  static constexpr size_t DefaultCapacity = 1 << 20;
+
+  SharedRing() = default;
+  SharedRing(const SharedRing &) = delete;
+  SharedRing &operator=(const SharedRing &) = delete;
+  ~SharedRing() { close(); }
+
+  // Maps the segment called name, creating it with capacity bytes when missing
+  void open(const std::string &name, size_t capacity);
+  // typeHash identifies what travels in the ring, the first claim wins and others must match
+  void claimType(uint64_t typeHash);
+  // Detaches, the last process to detach removes the segment
+  void close();
+  bool isOpen() const { return _header != nullptr; }
+
+  size_t capacity() const;
+  // The largest record accepted, half the ring so that it fits an empty ring wherever the head is
+  size_t maxRecordSize() const { return capacity() / 2 - RecordHeaderSize; }
+
+  // False if the ring has no room for size bytes right now
+  bool tryWrite(const uint8_t *data, size_t size);
+  // False if the ring is empty, otherwise the oldest record is copied into out and removed
+  bool tryRead(std::vector<uint8_t> &out);
+  // Removes the oldest record, false if the ring is empty
+  bool dropOldest();
+
+  bool empty() const;
+  // Blocks the calling thread until there might be something to read or timeout seconds passed
+  void waitReadable(double timeout);
+  // Blocks the calling thread until there might be room for size bytes or timeout seconds passed
+  void waitWritable(size_t size, double timeout);
+  // Wakes every thread waiting on the ring, in any process
+  void wakeAll();
+
+  bool closed() const;
+  // Marks the ring completed for every process attached to it
+  void complete();
+
+private:
+  struct Header;
+
+  static constexpr size_t RecordHeaderSize = sizeof(uint32_t);
+
+  bool hasRoom(size_t size) const;
+
+  Header *_header{};
+  uint8_t *_data{};
+  size_t _mappedSize{0};
+  std::string _segmentName;
+};
+
+} // namespace channels
+} // namespace shards
+
+#endif
@@ -472,11 +472,111 @@ struct Profile {
     activateShards(SHVar(_shards).payload.seqValue, context, input, output);
     const auto stop = std::chrono::high_resolution_clock::now();
     const auto dur = std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
-    SHLOG_INFO("{} took {} microseconds.", dur);
+    SHLOG_INFO("{} took {} microseconds.", _label, dur);
     return output;
   }
 };
 
+// The profiler of the mesh running the current wire
+inline const std::shared_ptr<ShardProfiler> &meshProfiler(SHContext *context) {
+  if (!context->profiler)
+    throw ActivationError("Profiler shards require a wire scheduled on a mesh.");
+  return context->profiler;
+}
+
+struct ProfilerStart {
+  int64_t _sampleEvery{1};
+
+  static inline Parameters _params{
+      {"SampleEvery",
+       SHCCSTR("Record only one every this many top level shard activations of each wire, reduces the overhead."),
+       {CoreInfo::IntType}}};
+
+  static SHOptionalString help() {
+    return SHCCSTR("Starts recording call counts, times and allocations of every shard run by the mesh of this wire.");
+  }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+
+  static SHParametersInfo parameters() { return _params; }
+
+  void setParam(int index, const SHVar &value) { _sampleEvery = std::max<int64_t>(value.payload.intValue, 1); }
+
+  SHVar getParam(int index) { return Var(_sampleEvery); }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    meshProfiler(context)->enable(true, uint32_t(_sampleEvery));
+    return input;
+  }
+};
+
+struct ProfilerStop {
+  static SHOptionalString help() { return SHCCSTR("Stops recording shard activations, data recorded so far is kept."); }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    meshProfiler(context)->enable(false);
+    return input;
+  }
+};
+
+struct ProfilerReset {
+  static SHOptionalString help() { return SHCCSTR("Clears the data recorded by the mesh profiler."); }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    meshProfiler(context)->reset();
+    return input;
+  }
+};
+
+struct ProfilerReport {
+  SeqVar _output;
+
+  static inline std::array<SHVar, 6> EntryKeys{Var("Path"),        Var("Shard"),       Var("Calls"),
+                                                Var("InclusiveNs"), Var("ExclusiveNs"), Var("Allocations")};
+  static inline Types EntryTypes{{CoreInfo::StringType, CoreInfo::StringType, CoreInfo::IntType, CoreInfo::IntType,
+                                  CoreInfo::IntType, CoreInfo::IntType}};
+  static inline Type EntryType = Type::TableOf(EntryTypes, EntryKeys);
+  static inline Types OutputTypes{{EntryType}};
+  static inline Type OutputType = Type::SeqOf(OutputTypes);
+
+  static SHOptionalString help() {
+    return SHCCSTR("Outputs the data recorded by the mesh profiler, one table per call path. Paths are the wire name "
+                   "followed by the shards leading to the entry, separated by `;`.");
+  }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return OutputType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    meshProfiler(context)->results(_output);
+    return _output;
+  }
+};
+
+struct ProfilerCollapsed {
+  std::string _output;
+
+  static SHOptionalString help() {
+    return SHCCSTR("Outputs the data recorded by the mesh profiler as collapsed stacks, one `path exclusive-nanoseconds` "
+                   "line per call path, ready for flame graph tools.");
+  }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::StringType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    _output = meshProfiler(context)->collapsed();
+    return Var(_output);
+  }
+};
+
 struct XPendBase {
   static inline Types xpendTypes{{CoreInfo::AnyVarSeqType, CoreInfo::StringVarType, CoreInfo::BytesVarType}};
 };
@@ -1060,10 +1160,7 @@ struct Assoc : public VariableBase {
   }
 
   void warmup(SHContext *context) {
-    if (_global)
-      _target = referenceGlobalVariable(context, _name.c_str());
-    else
-      _target = referenceVariable(context, _name.c_str());
+    warmupTarget(context);
     _key.warmup(context);
   }
 
@@ -1907,6 +2004,11 @@ SHARDS_REGISTER_FN(core) {
   REGISTER_CORE_SHARD(IsAllLessEqual);
 
   REGISTER_SHARD("Profile", Profile);
+  REGISTER_SHARD("Profiler.Start", ProfilerStart);
+  REGISTER_SHARD("Profiler.Stop", ProfilerStop);
+  REGISTER_SHARD("Profiler.Reset", ProfilerReset);
+  REGISTER_SHARD("Profiler.Report", ProfilerReport);
+  REGISTER_SHARD("Profiler.Collapsed", ProfilerCollapsed);
 
   REGISTER_SHARD("ForEach", ForEachShard);
   REGISTER_SHARD("ForRange", ForRangeShard);
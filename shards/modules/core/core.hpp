@@ -675,6 +675,7 @@ struct VariableBase {
   bool _global{false};
   void *_tablePtr{nullptr};
   uint64_t _tableVersion{0};
+  VariableSlot _slot{};
 
   static inline Parameters getterParams{
       {"Name", SHCCSTR("The name of the variable."), {CoreInfo::StringOrAnyVar}},
@@ -709,6 +710,7 @@ struct VariableBase {
     switch (index) {
     case 0:
       _name = SHSTRVIEW(value);
+      _slot = {};
       break;
     case 1:
       if (value.valueType == SHType::None) {
@@ -737,6 +739,13 @@ struct VariableBase {
     }
   }
 
+  void warmupTarget(SHContext *context) {
+    if (_global)
+      _target = referenceGlobalVariable(context, _name.c_str());
+    else
+      _target = referenceVariable(context, _name, _slot);
+  }
+
   ALWAYS_INLINE void checkIfTableChanged() {
     if (_tablePtr != _target->payload.tableValue.opaque || _tableVersion != _target->version) {
       _tablePtr = _target->payload.tableValue.opaque;
@@ -881,10 +890,7 @@ struct SetBase : public VariableBase {
   }
 
   void warmup(SHContext *context) {
-    if (_global)
-      _target = referenceGlobalVariable(context, _name.c_str());
-    else
-      _target = referenceVariable(context, _name.c_str());
+    warmupTarget(context);
     _key.warmup(context);
   }
 };
@@ -1498,10 +1504,7 @@ struct Get : public VariableBase {
   }
 
   void warmup(SHContext *context) {
-    if (_global)
-      _target = referenceGlobalVariable(context, _name.c_str());
-    else
-      _target = referenceVariable(context, _name.c_str());
+    warmupTarget(context);
 
     _key.warmup(context);
   }
@@ -1689,10 +1692,7 @@ struct SeqBase : public VariableBase {
   }
 
   void warmup(SHContext *context) {
-    if (_global)
-      _target = referenceGlobalVariable(context, _name.c_str());
-    else
-      _target = referenceVariable(context, _name.c_str());
+    warmupTarget(context);
     _key.warmup(context);
     initSeq();
   }
@@ -2110,10 +2110,7 @@ struct TableDecl : public VariableBase {
   }
 
   void warmup(SHContext *context) {
-    if (_global)
-      _target = referenceGlobalVariable(context, _name.c_str());
-    else
-      _target = referenceVariable(context, _name.c_str());
+    warmupTarget(context);
     _key.warmup(context);
     initTable();
   }
@@ -2355,10 +2352,7 @@ struct SeqUser : VariableBase {
   }
 
   void warmup(SHContext *context) {
-    if (_global)
-      _target = referenceGlobalVariable(context, _name.c_str());
-    else
-      _target = referenceVariable(context, _name.c_str());
+    warmupTarget(context);
     _key.warmup(context);
     initSeq();
   }
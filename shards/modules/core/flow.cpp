@@ -2,9 +2,346 @@
 /* Copyright © 2019 Fragcolor Pte. Ltd. */
 
 #include <shards/core/module.hpp>
+#include <shards/core/runtime.hpp>
 #include "flow.hpp"
+#include <boost/filesystem.hpp>
+#include <ctime>
+#include <fstream>
+#include <list>
 
 namespace shards {
+struct Memoize {
+  struct Key {
+    uint64_t low;
+    uint64_t high;
+    bool operator==(const Key &other) const { return low == other.low && high == other.high; }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const { return size_t(key.low); }
+  };
+
+  struct Entry {
+    Key key;
+    OwnedVar value;
+    size_t bytes;
+  };
+
+  ShardsVar _shards{};
+  SHComposeResult _composition{};
+  int64_t _maxEntries{64};
+  int64_t _maxBytes{0};
+  std::string _statsName;
+  std::string _spill;
+  int64_t _spillMaxFiles{1024};
+  // files in the spill directory, -1 until counted
+  int64_t _spillFiles{-1};
+
+  // most recently used first
+  std::list<Entry> _lru;
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> _index;
+  size_t _bytes{0};
+
+  SHVar _flowHash{};
+  std::vector<SHVar *> _required;
+  std::vector<uint64_t> _keyWords;
+  Serialization _serial;
+
+  int64_t _hits{0};
+  int64_t _misses{0};
+  int64_t _evictions{0};
+  SHVar *_stats{nullptr};
+  TableVar _statsTable{};
+  std::vector<SHExposedTypeInfo> _exposed;
+
+  static inline std::array<SHVar, 5> StatsKeys{Var("Hits"), Var("Misses"), Var("Evictions"), Var("Entries"), Var("Bytes")};
+  static inline Types StatsTypes{
+      {CoreInfo::IntType, CoreInfo::IntType, CoreInfo::IntType, CoreInfo::IntType, CoreInfo::IntType}};
+  static inline Type StatsType = Type::TableOf(StatsTypes, StatsKeys);
+
+  static SHOptionalString help() {
+    return SHCCSTR("Caches the output of a pure shard or sequence of shards. When the input and every variable the shards read "
+                   "hash the same as a previous activation the cached output is returned without activating the shards.");
+  }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHOptionalString inputHelp() { return SHCCSTR("The value passed to the memoized shards, part of the cache key."); }
+
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+  static SHOptionalString outputHelp() { return SHCCSTR("The output of the memoized shards, cached or fresh."); }
+
+  static inline Parameters _params{
+      {"Shards", SHCCSTR("The pure shards to memoize."), {CoreInfo::ShardsOrNone}},
+      {"MaxEntries", SHCCSTR("The maximum amount of cached outputs, least recently used ones are evicted first."),
+       {CoreInfo::IntType}},
+      {"MaxBytes", SHCCSTR("The maximum serialized size of all cached outputs, 0 for no limit."), {CoreInfo::IntType}},
+      {"Stats",
+       SHCCSTR("The name of a variable to expose a table of counters to (Hits, Misses, Evictions, Entries, Bytes)."),
+       {CoreInfo::NoneType, CoreInfo::StringType}},
+      {"Spill",
+       SHCCSTR("A directory where outputs are also written, misses look there before activating the shards. Persists across "
+               "runs."),
+       {CoreInfo::NoneType, CoreInfo::StringType}},
+      {"SpillMaxFiles",
+       SHCCSTR("The maximum amount of files kept in the Spill directory, least recently used ones are removed first."),
+       {CoreInfo::IntType}}};
+
+  static SHParametersInfo parameters() { return _params; }
+
+  void setParam(int index, const SHVar &value) {
+    switch (index) {
+    case 0:
+      _shards = value;
+      break;
+    case 1:
+      _maxEntries = std::max(int64_t(1), value.payload.intValue);
+      break;
+    case 2:
+      _maxBytes = std::max(int64_t(0), value.payload.intValue);
+      break;
+    case 3:
+      _statsName = value.valueType == SHType::None ? "" : SHSTRVIEW(value);
+      break;
+    case 4:
+      _spill = value.valueType == SHType::None ? "" : SHSTRVIEW(value);
+      _spillFiles = -1;
+      break;
+    case 5:
+      _spillMaxFiles = std::max(int64_t(1), value.payload.intValue);
+      break;
+    default:
+      break;
+    }
+  }
+
+  SHVar getParam(int index) {
+    switch (index) {
+    case 0:
+      return _shards;
+    case 1:
+      return Var(_maxEntries);
+    case 2:
+      return Var(_maxBytes);
+    case 3:
+      return _statsName.empty() ? Var::Empty : Var(_statsName);
+    case 4:
+      return _spill.empty() ? Var::Empty : Var(_spill);
+    case 5:
+      return Var(_spillMaxFiles);
+    default:
+      return Var::Empty;
+    }
+  }
+
+  SHTypeInfo compose(const SHInstanceData &data) {
+    _composition = _shards.compose(data);
+
+    // params and shards don't change after compose, hash them once
+    _flowHash = hash(SHVar(_shards));
+
+    // a cache hit skips the shards, whatever they write would be left stale
+    if (_composition.exposedInfo.len > 0) {
+      throw ComposeError(fmt::format("Memoize: memoized shards must not expose variables, found {}",
+                                     _composition.exposedInfo.elements[0].name));
+    }
+
+    _exposed.clear();
+    if (!_statsName.empty())
+      _exposed.push_back(ExposedInfo::Variable(_statsName.c_str(), SHCCSTR("The memoization counters."), StatsType));
+
+    // a changed cache key space invalidates everything
+    clear();
+
+    return _composition.outputType;
+  }
+
+  SHExposedTypesInfo exposedVariables() { return {_exposed.data(), uint32_t(_exposed.size()), 0}; }
+
+  void warmup(SHContext *context) {
+    _shards.warmup(context);
+
+    // variables read by the shards are part of the key, as much as the input
+    for (uint32_t i = 0; i < _composition.requiredInfo.len; i++) {
+      _required.push_back(referenceVariable(context, _composition.requiredInfo.elements[i].name));
+    }
+
+    if (!_statsName.empty()) {
+      _stats = referenceVariable(context, _statsName);
+    }
+  }
+
+  void cleanup() {
+    for (auto var : _required)
+      releaseVariable(var);
+    _required.clear();
+
+    if (_stats) {
+      releaseVariable(_stats);
+      _stats = nullptr;
+    }
+
+    _shards.cleanup();
+  }
+
+  void clear() {
+    _lru.clear();
+    _index.clear();
+    _bytes = 0;
+  }
+
+  Key computeKey(const SHVar &input) {
+    _keyWords.clear();
+    _keyWords.push_back(uint64_t(_flowHash.payload.int2Value[0]));
+    _keyWords.push_back(uint64_t(_flowHash.payload.int2Value[1]));
+    auto pushHash = [&](const SHVar &var) {
+      auto h = hash(var);
+      _keyWords.push_back(uint64_t(h.payload.int2Value[0]));
+      _keyWords.push_back(uint64_t(h.payload.int2Value[1]));
+    };
+    pushHash(input);
+    for (auto var : _required)
+      pushHash(*var);
+    auto digest = XXH3_128bits(_keyWords.data(), _keyWords.size() * sizeof(uint64_t));
+    return Key{digest.low64, digest.high64};
+  }
+
+  std::string spillPath(const Key &key) const {
+    return (boost::filesystem::path(_spill) / fmt::format("{:016x}{:016x}.bin", key.high, key.low)).string();
+  }
+
+  bool readSpill(const Key &key, SHVar &output) {
+    std::ifstream stream(spillPath(key), std::ios::binary);
+    if (!stream.good())
+      return false;
+
+    try {
+      auto reader = [&](uint8_t *buf, size_t size) {
+        stream.read((char *)buf, size);
+        if (!stream.good())
+          throw SHException("Memoize: truncated spill file");
+      };
+      _serial.reset();
+      _serial.deserialize(reader, output);
+      // keeps recently read files away from trimming
+      boost::system::error_code ec;
+      boost::filesystem::last_write_time(spillPath(key), std::time(nullptr), ec);
+      return true;
+    } catch (std::exception &e) {
+      SHLOG_WARNING("Memoize: ignoring unreadable spill file {}: {}", spillPath(key), e.what());
+      destroyVar(output);
+      return false;
+    }
+  }
+
+  // Removes the least recently used spill files until a quarter of the budget is free,
+  // so the directory is listed once in a while rather than on every write
+  void trimSpill() {
+    namespace fs = boost::filesystem;
+    std::vector<std::pair<std::time_t, fs::path>> files;
+    for (auto &entry : fs::directory_iterator(_spill)) {
+      if (fs::is_regular_file(entry.status()) && entry.path().extension() == ".bin")
+        files.emplace_back(fs::last_write_time(entry.path()), entry.path());
+    }
+    _spillFiles = int64_t(files.size());
+
+    if (_spillFiles <= _spillMaxFiles)
+      return;
+
+    const auto target = _spillMaxFiles - _spillMaxFiles / 4;
+    std::sort(files.begin(), files.end(), [](auto &a, auto &b) { return a.first < b.first; });
+    for (auto &[written, path] : files) {
+      if (_spillFiles <= target)
+        break;
+      boost::system::error_code ec;
+      if (fs::remove(path, ec))
+        _spillFiles--;
+    }
+  }
+
+  void writeSpill(const Key &key, const SHVar &value) {
+    try {
+      boost::filesystem::create_directories(_spill);
+      if (_spillFiles < 0)
+        trimSpill();
+
+      {
+        std::ofstream stream(spillPath(key), std::ios::binary | std::ios::trunc);
+        auto writer = [&](const uint8_t *buf, size_t size) { stream.write((const char *)buf, size); };
+        _serial.reset();
+        _serial.serialize(value, writer);
+      }
+
+      if (++_spillFiles > _spillMaxFiles)
+        trimSpill();
+    } catch (std::exception &e) {
+      SHLOG_WARNING("Memoize: failed to spill output: {}", e.what());
+    }
+  }
+
+  const SHVar &insert(const Key &key, const SHVar &value) {
+    auto counter = [](const uint8_t *, size_t) {};
+    _serial.reset();
+    const auto bytes = _serial.serialize(value, counter);
+
+    auto &entry = _lru.emplace_front(Entry{key, value, bytes});
+    _index[key] = _lru.begin();
+    _bytes += bytes;
+
+    // never evict what we just inserted
+    while (_lru.size() > 1 &&
+           (_lru.size() > size_t(_maxEntries) || (_maxBytes > 0 && _bytes > size_t(_maxBytes)))) {
+      auto &last = _lru.back();
+      _bytes -= last.bytes;
+      _index.erase(last.key);
+      _lru.pop_back();
+      _evictions++;
+    }
+
+    return entry.value;
+  }
+
+  void updateStats() {
+    _statsTable[Var("Hits")] = Var(_hits);
+    _statsTable[Var("Misses")] = Var(_misses);
+    _statsTable[Var("Evictions")] = Var(_evictions);
+    _statsTable[Var("Entries")] = Var(int64_t(_lru.size()));
+    _statsTable[Var("Bytes")] = Var(int64_t(_bytes));
+    cloneVar(*_stats, _statsTable);
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    const auto key = computeKey(input);
+    DEFER(if (_stats) updateStats());
+
+    if (auto it = _index.find(key); it != _index.end()) {
+      _hits++;
+      _lru.splice(_lru.begin(), _lru, it->second);
+      return it->second->value;
+    }
+
+    _misses++;
+
+    if (!_spill.empty()) {
+      SHVar spilled{};
+      if (readSpill(key, spilled)) {
+        DEFER(destroyVar(spilled));
+        return insert(key, spilled);
+      }
+    }
+
+    SHVar output{};
+    if (_shards.activate(context, input, output) != SHWireState::Continue) {
+      // don't remember interrupted flows
+      return output;
+    }
+
+    if (!_spill.empty())
+      writeSpill(key, output);
+
+    return insert(key, output);
+  }
+};
+
 SHARDS_REGISTER_FN(flow) {
   REGISTER_SHARD("Cond", Cond);
   REGISTER_SHARD("Maybe", Maybe);
@@ -15,5 +352,6 @@ SHARDS_REGISTER_FN(flow) {
   REGISTER_SHARD("Match", Match);
   REGISTER_SHARD("Sub", Sub);
   REGISTER_SHARD("Hashed", HashedShards);
+  REGISTER_SHARD("Memoize", Memoize);
 }
 }; // namespace shards
@@ -169,9 +169,128 @@ ALWAYS_INLINE bool SHARDS_MODULE_FN(activateShardInline)(Shard *blk, SHContext *
     auto shard = reinterpret_cast<Math::RShiftRuntime *>(blk);
     output = shard->core.activate(context, input);
   } break;
+  case InlineShard::MathSpecialized:
+    // compose bound activate to a type-specialized instantiation
+    output = blk->activate(blk, context, &input);
+    break;
   default:
     return false;
   }
   return true;
 }
+
+// Calls fn with the core of a binary Math shard, returns false if blk is not one
+template <typename F> ALWAYS_INLINE inline bool withFusableMath(Shard *blk, F &&fn) {
+  switch (blk->inlineShardId) {
+  case InlineShard::MathAdd:
+    fn(reinterpret_cast<Math::AddRuntime *>(blk)->core);
+    return true;
+  case InlineShard::MathSubtract:
+    fn(reinterpret_cast<Math::SubtractRuntime *>(blk)->core);
+    return true;
+  case InlineShard::MathMultiply:
+    fn(reinterpret_cast<Math::MultiplyRuntime *>(blk)->core);
+    return true;
+  case InlineShard::MathDivide:
+    fn(reinterpret_cast<Math::DivideRuntime *>(blk)->core);
+    return true;
+  case InlineShard::MathXor:
+    fn(reinterpret_cast<Math::XorRuntime *>(blk)->core);
+    return true;
+  case InlineShard::MathAnd:
+    fn(reinterpret_cast<Math::AndRuntime *>(blk)->core);
+    return true;
+  case InlineShard::MathOr:
+    fn(reinterpret_cast<Math::OrRuntime *>(blk)->core);
+    return true;
+  case InlineShard::MathMod:
+    fn(reinterpret_cast<Math::ModRuntime *>(blk)->core);
+    return true;
+  case InlineShard::MathLShift:
+    fn(reinterpret_cast<Math::LShiftRuntime *>(blk)->core);
+    return true;
+  case InlineShard::MathRShift:
+    fn(reinterpret_cast<Math::RShiftRuntime *>(blk)->core);
+    return true;
+  default:
+    return false;
+  }
+}
+
+ALWAYS_INLINE inline bool isFusableMath(Shard *blk) {
+  return blk->inlineShardId == InlineShard::MathSpecialized || withFusableMath(blk, [](auto &) {});
+}
+
+// Superinstructions, matched on the inline ids so they follow Get/Set promotions done during warmup and activation
+ALWAYS_INLINE uint32_t SHARDS_MODULE_FN(activateShardsFused)(Shard *const *shards, size_t len, SHContext *context,
+                                                             const SHVar &input, SHVar &output) {
+  if (len < 2)
+    return 0;
+
+  auto head = shards[0];
+  auto next = shards[1];
+  if (head->inlineShardId == InlineShard::CoreConst || head->inlineShardId == InlineShard::CoreGet) {
+    const SHVar &value = head->inlineShardId == InlineShard::CoreConst
+                             ? reinterpret_cast<shards::ShardWrapper<Const> *>(head)->shard._value
+                             : *reinterpret_cast<shards::GetRuntime *>(head)->core._cell;
+
+    // Const | Set, Get | Update
+    if (next->inlineShardId == InlineShard::CoreSetUpdateRegular) {
+      output = reinterpret_cast<shards::SetRuntime *>(next)->core.activateRegular(context, value);
+      return 2;
+    }
+
+    // Get | Math.* | Update, a blittable result is written straight into the target variable
+    if (head->inlineShardId == InlineShard::CoreGet && len > 2 &&
+        shards[2]->inlineShardId == InlineShard::CoreSetUpdateRegular) {
+      auto &setter = reinterpret_cast<shards::SetRuntime *>(shards[2])->core;
+      if (next->inlineShardId == InlineShard::MathSpecialized) {
+        const auto result = next->activate(next, context, &value);
+        if (unlikely(!context->shouldContinue())) {
+          output = result;
+          return 2;
+        }
+        output = setter.activateRegular(context, result);
+        return 3;
+      }
+      uint32_t consumed = 3;
+      if (withFusableMath(next, [&](auto &math) {
+            SHVar &target = *setter._target;
+            if (likely(math._opType == Math::OpType::Direct && target.valueType < SHType::EndOfBlittableTypes)) {
+              const auto operand = math._operand.get();
+              math.op.operateDirect(target, value, operand);
+              output = target;
+            } else {
+              output = math.activate(context, value);
+              if (unlikely(!context->shouldContinue()))
+                consumed = 2;
+              else
+                output = setter.activateRegular(context, output);
+            }
+          }))
+        return consumed;
+    }
+
+    return 0;
+  }
+
+  // Math.* chains, each result feeds the next operation without going back to the dispatch loop
+  uint32_t count = 0;
+  while (count < len && isFusableMath(shards[count]))
+    count++;
+  if (count < 2)
+    return 0;
+
+  output = input;
+  for (uint32_t i = 0; i < count; i++) {
+    auto blk = shards[i];
+    if (blk->inlineShardId == InlineShard::MathSpecialized)
+      output = blk->activate(blk, context, &output);
+    else
+      withFusableMath(blk, [&](auto &math) { output = math.activate(context, output); });
+    if (unlikely(!context->shouldContinue()))
+      return i + 1;
+  }
+  return count;
+}
 } // namespace shards
@@ -12,10 +12,12 @@
 #include <shards/shards.hpp>
 #include <shards/common_types.hpp>
 #include <shards/number_types.hpp>
+#include <shards/inlined.hpp>
 #include <sstream>
 #include <stdexcept>
 #include <variant>
 #include <shards/math_ops.hpp>
+#include "tensor.hpp"
 
 #define _PC
 #include "ShaderFastMathLib.h"
@@ -182,6 +184,8 @@ struct ApplyBroadcast {
 };
 
 template <typename TOp, DispatchType DispatchType = DispatchType::NumberTypes> struct BasicBinaryOperation {
+  static constexpr auto Dispatch = DispatchType;
+
   ApplyBinary<TOp> apply;
   ApplyBroadcast applyBroadcast;
   const VectorTypeTraits *_lhsVecType{};
@@ -223,6 +227,12 @@ template <typename TOp, DispatchType DispatchType = DispatchType::NumberTypes> s
     dispatchType<DispatchType>(a.valueType, apply, output.payload, a.payload, b.payload);
   }
 
+  // operateDirect for a type known at compose time
+  template <SHType ValueType> ALWAYS_INLINE void operateDirectTyped(SHVar &output, const SHVar &a, const SHVar &b) {
+    output.valueType = ValueType;
+    apply.template apply<ValueType>(output.payload, a.payload, b.payload);
+  }
+
   void operateBroadcast(SHVar &output, const SHVar &a, const SHVar &b) {
     // This implements broadcast operators on float types
     const VectorTypeTraits *scalarType = _lhsVecType;
@@ -262,8 +272,58 @@ template <typename TOp, DispatchType DispatchType = DispatchType::NumberTypes> s
 ///    // Apply OpType::Broadcast
 ///    void operateBroadcast(SHVar &output, const SHVar &a, const SHVar &b);
 ///  };
+///
+///  Ops can opt into type-specialized activation by also providing:
+///
+///    static constexpr DispatchType Dispatch;
+///    template <SHType ValueType> void operateDirectTyped(SHVar &output, const SHVar &a, const SHVar &b);
+template <typename TOp, typename = void> struct HasTypedDirect : std::false_type {};
+template <typename TOp> struct HasTypedDirect<TOp, std::void_t<decltype(TOp::Dispatch)>> : std::true_type {};
+
+// Swaps a shard's activation for a type-specialized one during compose, and back when a later compose can't specialize.
+// Specialized shards are tagged InlineShard::MathSpecialized so the runtime dispatch and the Math fusion call them.
+struct ActivationSpecializer {
+  SHActivateProc _genericActivate{};
+  SHInlineShards _genericInlineId{};
+
+  void install(Shard *shard, SHActivateProc proc) {
+    if (!_genericActivate) {
+      _genericActivate = shard->activate;
+      _genericInlineId = shard->inlineShardId;
+    }
+
+    if (proc) {
+      shard->activate = proc;
+      shard->inlineShardId = InlineShard::MathSpecialized;
+    } else {
+      shard->activate = _genericActivate;
+      shard->inlineShardId = _genericInlineId;
+    }
+  }
+};
+
+// The element type of a sequence type holding a single dispatchable type, SHType::None otherwise
+inline SHType homogeneousSeqType(const SHTypeInfo &type) {
+  if (type.basicType != SHType::Seq || type.seqTypes.len != 1)
+    return SHType::None;
+  return type.seqTypes.elements[0].basicType;
+}
+
+// Sizes output as a sequence of len elements, their previous contents are blittable values of the same type
+ALWAYS_INLINE inline SHSeq &typedSeqOutput(SHVar &output, uint32_t len) {
+  if (output.valueType != SHType::Seq) {
+    destroyVar(output);
+    output.valueType = SHType::Seq;
+  }
+  shards::arrayResize(output.payload.seqValue, len);
+  return output.payload.seqValue;
+}
+
 template <class TOp> struct BinaryOperation : public BinaryBase {
+  enum class Kernel { Direct, Seq1, SeqSeq };
+
   TOp op;
+  ActivationSpecializer _specializer;
 
   static SHOptionalString help() {
     return SHCCSTR("Applies the binary operation on the input value and the operand and returns the result (or a sequence of "
@@ -277,7 +337,93 @@ template <class TOp> struct BinaryOperation : public BinaryBase {
     return opType;
   }
 
-  SHTypeInfo compose(const SHInstanceData &data) { return this->genericCompose(*this, data); }
+  SHTypeInfo compose(const SHInstanceData &data) {
+    auto resultType = this->genericCompose(*this, data);
+    if constexpr (HasTypedDirect<TOp>::value)
+      specialize(data);
+    return resultType;
+  }
+
+  template <Kernel K> struct SpecializedActivation {
+    template <SHType ValueType> void apply(SHActivateProc &proc) {
+      proc = specializedActivation<BinaryOperation, &BinaryOperation::template activateTyped<K, ValueType>>();
+    }
+  };
+
+  // The element type of a sequence operand when all its elements share it, SHType::None otherwise
+  SHType operandSeqType(const SHInstanceData &data) {
+    SHVar operandSpec = _operand;
+    if (operandSpec.valueType == SHType::ContextVar) {
+      for (uint32_t i = 0; i < data.shared.len; i++) {
+        if (data.shared.elements[i].name == SHSTRVIEW(operandSpec))
+          return homogeneousSeqType(data.shared.elements[i].exposedType);
+      }
+      return SHType::None;
+    }
+
+    if (operandSpec.valueType != SHType::Seq || operandSpec.payload.seqValue.len == 0)
+      return SHType::None;
+    const auto &seq = operandSpec.payload.seqValue;
+    const auto type = seq.elements[0].valueType;
+    for (uint32_t i = 1; i < seq.len; i++) {
+      if (seq.elements[i].valueType != type)
+        return SHType::None;
+    }
+    return type;
+  }
+
+  // Once compose settled on a single scalar/vector type, bind activation to a kernel instantiated for it,
+  // skipping the op type checks and the per value (or per element) type switch.
+  void specialize(const SHInstanceData &data) {
+    if (!data.shard)
+      return;
+
+    SHActivateProc proc{};
+    const auto type = data.inputType.basicType;
+    if (_opType == Direct && isDispatchedType(TOp::Dispatch, type)) {
+      dispatchType<TOp::Dispatch>(type, SpecializedActivation<Kernel::Direct>{}, proc);
+    } else if (_opType == Seq1 || _opType == SeqSeq) {
+      const auto elementType = homogeneousSeqType(data.inputType);
+      if (isDispatchedType(TOp::Dispatch, elementType)) {
+        if (_opType == Seq1)
+          dispatchType<TOp::Dispatch>(elementType, SpecializedActivation<Kernel::Seq1>{}, proc);
+        else if (operandSeqType(data) == elementType)
+          dispatchType<TOp::Dispatch>(elementType, SpecializedActivation<Kernel::SeqSeq>{}, proc);
+      }
+    }
+
+    // a previous compose might have left a different kind of value there
+    if (proc)
+      destroyVar(_result);
+    _specializer.install(data.shard, proc);
+  }
+
+  // Sequence kernels size the output once and run every element through the ValueType instantiation,
+  // no per element type switch or resize. Elements are whole SHVars, so this is still a scalar loop.
+  template <Kernel K, SHType ValueType> SHVar activateTyped(SHContext *context, const SHVar &input) {
+    const auto &operand = _operand.get();
+    if constexpr (K == Kernel::Direct) {
+      op.template operateDirectTyped<ValueType>(_result, input, operand);
+    } else if constexpr (K == Kernel::Seq1) {
+      const auto &a = input.payload.seqValue;
+      auto &out = typedSeqOutput(_result, a.len);
+      for (uint32_t i = 0; i < a.len; i++)
+        op.template operateDirectTyped<ValueType>(out.elements[i], a.elements[i], operand);
+    } else {
+      const auto &a = input.payload.seqValue;
+      const auto &b = operand.payload.seqValue;
+      // like the generic path, a shorter operand repeats and an empty one yields nothing
+      auto &out = typedSeqOutput(_result, b.len > 0 ? a.len : 0);
+      if (b.len >= a.len) {
+        for (uint32_t i = 0; i < out.len; i++)
+          op.template operateDirectTyped<ValueType>(out.elements[i], a.elements[i], b.elements[i]);
+      } else {
+        for (uint32_t i = 0; i < out.len; i++)
+          op.template operateDirectTyped<ValueType>(out.elements[i], a.elements[i], b.elements[i % b.len]);
+      }
+    }
+    return _result;
+  }
 
   void operate(OpType opType, SHVar &output, const SHVar &a, const SHVar &b) {
     if (opType == Broadcast) {
@@ -362,6 +508,8 @@ template <typename TOp> struct ApplyUnary {
 };
 
 template <typename TOp, DispatchType DispatchType = DispatchType::NumberTypes> struct BasicUnaryOperation {
+  static constexpr auto Dispatch = DispatchType;
+
   ApplyUnary<TOp> apply;
 
   OpType validateTypes(const SHTypeInfo &a, SHTypeInfo &resultType) {
@@ -373,10 +521,19 @@ template <typename TOp, DispatchType DispatchType = DispatchType::NumberTypes> s
     output.valueType = a.valueType;
     dispatchType<DispatchType>(a.valueType, apply, output.payload, a.payload);
   }
+
+  // operateDirect for a type known at compose time
+  template <SHType ValueType> ALWAYS_INLINE void operateDirectTyped(SHVar &output, const SHVar &a) {
+    output.valueType = ValueType;
+    apply.template apply<ValueType>(output.payload, a.payload);
+  }
 };
 
 template <class TOp> struct UnaryOperation : public UnaryBase {
+  enum class Kernel { Direct, Seq1 };
+
   TOp op;
+  ActivationSpecializer _specializer;
 
   void destroy() { destroyVar(_result); }
 
@@ -389,9 +546,48 @@ template <class TOp> struct UnaryOperation : public UnaryBase {
   SHTypeInfo compose(const SHInstanceData &data) {
     SHTypeInfo resultType = data.inputType;
     validateTypes(data.inputType, resultType);
+    if constexpr (HasTypedDirect<TOp>::value)
+      specialize(data);
     return resultType;
   }
 
+  template <Kernel K> struct SpecializedActivation {
+    template <SHType ValueType> void apply(SHActivateProc &proc) {
+      proc = specializedActivation<UnaryOperation, &UnaryOperation::template activateTyped<K, ValueType>>();
+    }
+  };
+
+  // Same as BinaryOperation::specialize, for a value or a sequence of a single type
+  void specialize(const SHInstanceData &data) {
+    if (!data.shard)
+      return;
+
+    SHActivateProc proc{};
+    if (_opType == OpType::Direct && isDispatchedType(TOp::Dispatch, data.inputType.basicType)) {
+      dispatchType<TOp::Dispatch>(data.inputType.basicType, SpecializedActivation<Kernel::Direct>{}, proc);
+    } else if (_opType == OpType::Seq1) {
+      const auto elementType = homogeneousSeqType(data.inputType);
+      if (isDispatchedType(TOp::Dispatch, elementType))
+        dispatchType<TOp::Dispatch>(elementType, SpecializedActivation<Kernel::Seq1>{}, proc);
+    }
+
+    if (proc)
+      destroyVar(_result);
+    _specializer.install(data.shard, proc);
+  }
+
+  template <Kernel K, SHType ValueType> SHVar activateTyped(SHContext *context, const SHVar &input) {
+    if constexpr (K == Kernel::Direct) {
+      op.template operateDirectTyped<ValueType>(_result, input);
+    } else {
+      const auto &a = input.payload.seqValue;
+      auto &out = typedSeqOutput(_result, a.len);
+      for (uint32_t i = 0; i < a.len; i++)
+        op.template operateDirectTyped<ValueType>(out.elements[i], a.elements[i]);
+    }
+    return _result;
+  }
+
   static SHOptionalString help() {
     return SHCCSTR("Applies the unary operation on the input value and returns the result (or a sequence of results if the input "
                    "and the operand are sequences).");
@@ -497,8 +693,89 @@ template <class TOp> struct UnaryVarOperation final : public UnaryOperation<TOp>
   }
 };
 
-#define MATH_BINARY_OPERATION(NAME, OPERATOR, DIV_BY_ZERO)      \
-  using NAME = BinaryOperation<BasicBinaryOperation<NAME##Op>>; \
+struct TensorMathTypes {
+  static inline Types InputTypes{Base::MathTypes, {Tensor::Float32TensorType, Tensor::Float64TensorType,
+                                                   Tensor::Int32TensorType, Tensor::Int64TensorType}};
+  static inline Types OperandTypes{
+      BinaryBase::MathTypesOrVar,
+      {Type::VariableOf(Tensor::Float32TensorType), Type::VariableOf(Tensor::Float64TensorType),
+       Type::VariableOf(Tensor::Int32TensorType), Type::VariableOf(Tensor::Int64TensorType)}};
+  static inline ParamsInfo Params = ParamsInfo(ParamsInfo::Param(
+      "Operand", SHCCSTR("The operand for this operation, a number or a tensor of the same type if the input is a tensor."),
+      OperandTypes));
+};
+
+// Binary operations that also apply elementwise to a Tensor input, TScalarOp is the operation on each element
+template <class TBase, typename TScalarOp> struct TensorBinaryOperation : public TBase {
+  TScalarOp _scalarOp;
+  Tensor::OutputBase _tensorOutput;
+  bool _tensorInput{false};
+
+  static SHOptionalString help() {
+    return SHCCSTR("Applies the binary operation on the input value and the operand and returns the result (or a sequence of "
+                   "results if the input and the operand are sequences). Tensors are operated on element by element.");
+  }
+
+  static SHTypesInfo inputTypes() { return TensorMathTypes::InputTypes; }
+  static SHTypesInfo outputTypes() { return TensorMathTypes::InputTypes; }
+  static SHParametersInfo parameters() { return SHParametersInfo(TensorMathTypes::Params); }
+
+  SHTypeInfo compose(const SHInstanceData &data) {
+    Tensor::DType dtype;
+    _tensorInput = Tensor::tensorDType(data.inputType, dtype);
+    if (!_tensorInput)
+      return TBase::compose(data);
+
+    // none of the scalar and sequence paths apply, including the typed kernels of a previous compose
+    this->_opType = Invalid;
+    if (data.shard)
+      this->_specializer.install(data.shard, nullptr);
+
+    SHVar operandSpec = this->_operand;
+    SHTypeInfo operandType{};
+    if (operandSpec.valueType == SHType::ContextVar) {
+      bool variableFound = false;
+      for (uint32_t i = 0; i < data.shared.len; i++) {
+        if (data.shared.elements[i].name == SHSTRVIEW(operandSpec)) {
+          operandType = data.shared.elements[i].exposedType;
+          variableFound = true;
+          break;
+        }
+      }
+      if (!variableFound)
+        throw ComposeError(fmt::format("Operand variable {} not found", SHSTRVIEW(operandSpec)));
+    } else {
+      operandType.basicType = operandSpec.valueType;
+    }
+
+    Tensor::DType operandDType;
+    if (Tensor::tensorDType(operandType, operandDType)) {
+      if (operandDType != dtype)
+        throw ComposeError("Tensor operands must have the same element type");
+    } else if (operandType.basicType != SHType::Int && operandType.basicType != SHType::Float) {
+      throw ComposeError("Tensor inputs take a number or a tensor as operand");
+    }
+
+    return data.inputType;
+  }
+
+  void cleanup() {
+    _tensorOutput.cleanup();
+    TBase::cleanup();
+  }
+
+  ALWAYS_INLINE SHVar activate(SHContext *context, const SHVar &input) {
+    if (likely(!_tensorInput))
+      return TBase::activate(context, input);
+
+    auto &out = _tensorOutput.output();
+    Tensor::elementwise(_scalarOp, out, Tensor::asTensor(input), this->_operand.get());
+    return _tensorOutput.outputVar();
+  }
+};
+
+#define MATH_BINARY_OPERATION(NAME, OPERATOR, DIV_BY_ZERO)                                   \
+  using NAME = TensorBinaryOperation<BinaryOperation<BasicBinaryOperation<NAME##Op>>, NAME##Op>; \
   RUNTIME_SHARD_TYPE(Math, NAME);
 
 #define MATH_BINARY_INT_OPERATION(NAME, OPERATOR)                                          \
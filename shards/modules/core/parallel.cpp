@@ -0,0 +1,419 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#include <shards/core/shared.hpp>
+#include <shards/core/async.hpp>
+#include <shards/core/runtime.hpp>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if HAS_ASYNC_SUPPORT
+// Remove define from winspool.h
+#ifdef MAX_PRIORITY
+#undef MAX_PRIORITY
+#endif
+#include <taskflow/taskflow.hpp>
+#endif
+
+namespace shards {
+// Base of the data parallel Map/Reduce variants.
+// The body is cloned once per worker, each clone runs on its own stub context (no coroutine, so it can't suspend)
+// with a private pure wire holding copies of the outer variables the body reads.
+struct ParallelApplyBase {
+  static inline Parameters _params{
+      {"Apply",
+       SHCCSTR("The function to apply to each item of the sequence, it must not suspend nor write variables it does not own."),
+       {CoreInfo::Shards}},
+      {"Threads", SHCCSTR("The number of worker threads, 0 to use every cpu core."), {CoreInfo::IntType}},
+      {"ChunkSize", SHCCSTR("How many items a worker takes at once, 0 to pick it from the input length."), {CoreInfo::IntType}}};
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnySeqType; }
+  static SHParametersInfo parameters() { return _params; }
+
+  void setParam(int index, const SHVar &value) {
+    switch (index) {
+    case 0:
+      _shards = value;
+      break;
+    case 1:
+      _threads = std::max(int64_t(0), value.payload.intValue);
+      break;
+    case 2:
+      _chunk = std::max(int64_t(0), value.payload.intValue);
+      break;
+    default:
+      break;
+    }
+  }
+
+  SHVar getParam(int index) {
+    switch (index) {
+    case 0:
+      return _shards;
+    case 1:
+      return Var(_threads);
+    case 2:
+      return Var(_chunk);
+    default:
+      return Var::Empty;
+    }
+  }
+
+  struct Worker {
+    std::shared_ptr<SHWire> wire = SHWire::make("Parallel-Worker");
+    SHFlow flow{};
+    SHCoro stubCoro{};
+#ifndef __EMSCRIPTEN__
+    SHContext context{std::move(stubCoro), wire.get(), &flow};
+#else
+    SHContext context{&stubCoro, wire.get(), &flow};
+#endif
+    ShardsVar shards;
+    // copies of the outer variables, refreshed on every activation
+    std::vector<SHVar *> captures;
+    // $0 for Reduce
+    SHVar *accumulator{};
+  };
+
+  size_t numWorkers() const {
+#if HAS_ASYNC_SUPPORT
+    return _threads > 0 ? size_t(_threads) : std::max(1u, std::thread::hardware_concurrency());
+#else
+    return 1;
+#endif
+  }
+
+  // innerData is what the body is composed with, the clones are composed with the same data
+  void composeBody(const char *name, const SHInstanceData &data, const SHInstanceData &innerData) {
+    const auto &res = _shards.compose(innerData);
+
+    for (uint32_t i = 0; i < res.exposedInfo.len; i++) {
+      const auto &exposed = res.exposedInfo.elements[i];
+      if (exposed.global)
+        throw ComposeError(fmt::format("{}: the body can't expose global variables, found: {}", name, exposed.name));
+      // a worker would only change its own copy
+      for (uint32_t j = 0; j < data.shared.len; j++) {
+        if (strcmp(data.shared.elements[j].name, exposed.name) == 0)
+          throw ComposeError(fmt::format("{}: the body can't write outer variables, found: {}", name, exposed.name));
+      }
+    }
+
+    _captureNames.clear();
+    for (uint32_t i = 0; i < res.requiredInfo.len; i++) {
+      const auto &required = res.requiredInfo.elements[i];
+      if (strcmp(required.name, "$0") == 0)
+        continue;
+      if (std::find(_captureNames.begin(), _captureNames.end(), required.name) == _captureNames.end())
+        _captureNames.emplace_back(required.name);
+    }
+
+    _workers.clear();
+    for (size_t i = 0; i < numWorkers(); i++) {
+      auto worker = std::make_unique<Worker>();
+      worker->wire->pure = true;
+      SHVar body{};
+      WireCloner().clone(_shards, body);
+      worker->shards = body;
+      destroyVar(body);
+      worker->shards.compose(innerData);
+      _workers.emplace_back(std::move(worker));
+    }
+  }
+
+  void warmup(SHContext *context) {
+    _captures.clear();
+    for (auto &name : _captureNames)
+      _captures.push_back(referenceVariable(context, name));
+
+    for (auto &worker : _workers) {
+      worker->captures.clear();
+      for (auto &name : _captureNames)
+        worker->captures.push_back(&worker->wire->variables[name]);
+      worker->accumulator = &worker->wire->variables["$0"];
+      worker->shards.warmup(&worker->context);
+    }
+
+#if HAS_ASYNC_SUPPORT
+    if (_workers.size() > 1 && (!_exec || _exec->num_workers() != _workers.size())) {
+      _exec = std::make_unique<tf::Executor>(_workers.size());
+      // one long lived task per worker, each pulls chunks until none are left
+      _flow.clear();
+      for (size_t i = 0; i < _workers.size(); i++) {
+        _flow.emplace([this, i]() { runWorker(i); });
+      }
+    }
+#endif
+  }
+
+  void cleanup() {
+    for (auto &worker : _workers) {
+      worker->shards.cleanup();
+      for (auto var : worker->captures)
+        destroyVar(*var);
+      worker->captures.clear();
+      if (worker->accumulator)
+        destroyVar(*worker->accumulator);
+      worker->accumulator = nullptr;
+    }
+
+    for (auto var : _captures)
+      releaseVariable(var);
+    _captures.clear();
+  }
+
+  // Processes items [begin, end) of the input, chunk is the index of the range
+  virtual SHWireState runChunk(Worker &worker, size_t chunk, size_t begin, size_t end) = 0;
+
+  static constexpr size_t MinChunkSize = 256;
+
+  size_t numChunks() const { return (_len + _chunkSize - 1) / _chunkSize; }
+
+  // Runs on the executor, or inline when there's a single chunk
+  void runWorker(size_t index) {
+    auto &worker = *_workers[index];
+    while (!_failed) {
+      const auto chunk = _nextChunk.fetch_add(1);
+      const auto begin = chunk * _chunkSize;
+      if (begin >= _len)
+        return;
+
+      const auto state = runChunk(worker, chunk, begin, std::min(begin + _chunkSize, _len));
+      if (state != SHWireState::Continue) {
+        std::scoped_lock lock(_errorMutex);
+        if (!_failed) {
+          _error = state == SHWireState::Error ? worker.context.getErrorMessage()
+                                               : std::string("the body can't stop, restart or return from the flow");
+          _failed = true;
+        }
+        worker.context.continueFlow();
+      }
+    }
+  }
+
+  // Sets the input of the next run() and splits it in chunks
+  void prepare(const SHVar &input) {
+    _input = &input;
+    _len = input.payload.seqValue.len;
+    const auto split = _workers.size() * 4;
+    _chunkSize = _chunk > 0 ? size_t(_chunk) : std::max(MinChunkSize, (_len + split - 1) / split);
+  }
+
+  // Returns false if the calling wire was interrupted while waiting for the workers
+  bool run(SHContext *context) {
+    _nextChunk = 0;
+    _failed = false;
+
+    for (auto &worker : _workers) {
+      for (size_t i = 0; i < _captures.size(); i++)
+        cloneVar(*worker->captures[i], *_captures[i]);
+    }
+
+#if HAS_ASYNC_SUPPORT
+    if (_exec && numChunks() > 1) {
+      // the executor wakes us up once all the workers are done
+      AwaitCompletion completion(context);
+      auto future = _exec->run(_flow, [&completion]() { completion.notify(); });
+      while (!completion.complete) {
+        if (unlikely(completion.suspend(context) != SHWireState::Continue)) {
+          _failed = true; // stops the workers at the next chunk
+          future.wait();
+          return false;
+        }
+      }
+      future.wait();
+    } else {
+      runWorker(0);
+    }
+#else
+    runWorker(0);
+#endif
+
+    if (_failed)
+      throw ActivationError(_error);
+    return true;
+  }
+
+protected:
+  ShardsVar _shards{};
+  int64_t _threads{0};
+  int64_t _chunk{0};
+  std::vector<std::string> _captureNames;
+  std::vector<SHVar *> _captures;
+  std::vector<std::unique_ptr<Worker>> _workers;
+#if HAS_ASYNC_SUPPORT
+  std::unique_ptr<tf::Executor> _exec;
+  tf::Taskflow _flow;
+#endif
+  // state of the current activation, shared with the workers
+  const SHVar *_input{};
+  size_t _len{0};
+  size_t _chunkSize{1};
+  std::atomic_size_t _nextChunk{0};
+  std::atomic_bool _failed{false};
+  std::mutex _errorMutex;
+  std::string _error;
+};
+
+struct ParallelMap : public ParallelApplyBase {
+  static SHOptionalString help() {
+    return SHCCSTR("Like Map, but splits the sequence in chunks processed by worker threads, the order of the output is kept.");
+  }
+
+  static SHTypesInfo outputTypes() { return CoreInfo::AnySeqType; }
+
+  void destroy() { destroyVar(_output); }
+
+  SHTypeInfo compose(const SHInstanceData &data) {
+    if (data.inputType.seqTypes.len != 1) {
+      throw ComposeError("ParallelMap: Invalid sequence inner type, must be a single defined type.");
+    }
+    SHInstanceData dataCopy = data;
+    dataCopy.inputType = data.inputType.seqTypes.elements[0];
+    composeBody("ParallelMap", data, dataCopy);
+    _outputSingleType = _shards.composeResult().outputType;
+    _outputType = {SHType::Seq, {.seqTypes = {&_outputSingleType, 1, 0}}};
+    return _outputType;
+  }
+
+  void warmup(SHContext *context) {
+    _output.valueType = SHType::Seq;
+    ParallelApplyBase::warmup(context);
+  }
+
+  SHWireState runChunk(Worker &worker, size_t chunk, size_t begin, size_t end) override {
+    const auto &items = _input->payload.seqValue;
+    auto &outputs = _output.payload.seqValue;
+    SHVar output{};
+    for (size_t i = begin; i < end; i++) {
+      auto state = worker.shards.activate<true>(&worker.context, items.elements[i], output);
+      if (state != SHWireState::Continue)
+        return state;
+      // every worker writes its own slots of the pre sized output
+      cloneVar(outputs.elements[i], output);
+    }
+    return SHWireState::Continue;
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    arrayResize(_output.payload.seqValue, input.payload.seqValue.len);
+    if (input.payload.seqValue.len == 0)
+      return _output;
+    prepare(input);
+    if (!run(context))
+      return Var::Empty;
+    return _output;
+  }
+
+private:
+  SHVar _output{};
+  SHTypeInfo _outputSingleType{};
+  Type _outputType{};
+};
+
+struct ParallelReduce : public ParallelApplyBase {
+  static SHOptionalString help() {
+    return SHCCSTR("Like Reduce, but splits the sequence in chunks reduced by worker threads, the chunk results are then reduced "
+                   "in order with the same function. The function must be associative.");
+  }
+
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+
+  void destroy() { destroyVar(_output); }
+
+  SHTypeInfo compose(const SHInstanceData &data) {
+    if (data.inputType.seqTypes.len != 1) {
+      throw ComposeError("ParallelReduce: Invalid sequence inner type, must be a single defined type.");
+    }
+    // same as Reduce, a copy of the shared variables where $0 is ours
+    SHInstanceData dataCopy = data;
+    dataCopy.shared = {};
+    DEFER({ arrayFree(dataCopy.shared); });
+    dataCopy.inputType = data.inputType.seqTypes.elements[0];
+    for (uint32_t i = data.shared.len; i > 0; i--) {
+      auto &item = data.shared.elements[i - 1];
+      if (strcmp(item.name, "$0") != 0) {
+        arrayPush(dataCopy.shared, item);
+      }
+    }
+    _tmpInfo.exposedType = dataCopy.inputType;
+    arrayPush(dataCopy.shared, _tmpInfo);
+    composeBody("ParallelReduce", data, dataCopy);
+
+    // chunk results are fed back to the body as items
+    const auto &outputType = _shards.composeResult().outputType;
+    if (!matchTypes(outputType, dataCopy.inputType, false, true)) {
+      throw ComposeError("ParallelReduce: the function must output the same type as the sequence items.");
+    }
+    return outputType;
+  }
+
+  void warmup(SHContext *context) {
+    _tmp = referenceVariable(context, "$0");
+    _shards.warmup(context);
+    ParallelApplyBase::warmup(context);
+  }
+
+  void cleanup() {
+    ParallelApplyBase::cleanup();
+    _shards.cleanup();
+    releaseVariable(_tmp);
+    _tmp = nullptr;
+    _partials.clear();
+  }
+
+  SHWireState runChunk(Worker &worker, size_t chunk, size_t begin, size_t end) override {
+    const auto &items = _input->payload.seqValue;
+    cloneVar(*worker.accumulator, items.elements[begin]);
+    SHVar output{};
+    for (size_t i = begin + 1; i < end; i++) {
+      auto state = worker.shards.activate<true>(&worker.context, items.elements[i], output);
+      if (state != SHWireState::Continue)
+        return state;
+      cloneVar(*worker.accumulator, output);
+    }
+    _partials[chunk] = *worker.accumulator;
+    return SHWireState::Continue;
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    if (input.payload.seqValue.len == 0) {
+      throw ActivationError("ParallelReduce: Input sequence was empty!");
+    }
+
+    prepare(input);
+    _partials.resize(numChunks());
+    if (!run(context))
+      return Var::Empty;
+
+    // combine on the calling wire, in chunk order
+    cloneVar(*_tmp, _partials[0]);
+    SHVar output{};
+    for (size_t i = 1; i < _partials.size(); i++) {
+      auto state = _shards.activate<true>(context, _partials[i], output);
+      if (state == SHWireState::Error) {
+        // the context carries the failure, a partial reduction must not look like a result
+        return Var::Empty;
+      } else if (state != SHWireState::Continue) {
+        // same rule as the chunks running on the workers
+        throw ActivationError("ParallelReduce: the body can't stop, restart or return from the flow");
+      }
+      cloneVar(*_tmp, output);
+    }
+    cloneVar(_output, *_tmp);
+    return _output;
+  }
+
+private:
+  SHExposedTypeInfo _tmpInfo{"$0"};
+  SHVar *_tmp{};
+  SHVar _output{};
+  std::vector<OwnedVar> _partials;
+};
+
+SHARDS_REGISTER_FN(parallel) {
+  REGISTER_SHARD("ParallelMap", ParallelMap);
+  REGISTER_SHARD("ParallelReduce", ParallelReduce);
+}
+} // namespace shards
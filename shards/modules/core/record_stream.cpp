@@ -0,0 +1,355 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#include "record_stream.hpp"
+#include <boost/filesystem.hpp>
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#include <snappy.h>
+
+namespace shards {
+using namespace recordstream;
+
+namespace {
+// favors speed, streams are written while capturing
+constexpr int BrotliQuality = 5;
+} // namespace
+
+RecordStreamWriter::RecordStreamWriter(const std::string &path, bool append, Compression compression, size_t blockSize)
+    : _path(path), _compression(compression), _blockSize(blockSize) {
+  namespace fs = boost::filesystem;
+  fs::path p(path);
+  if (append && fs::exists(p) && fs::file_size(p) > 0) {
+    // continue the existing stream, its index is dropped and written again on close
+    {
+      RecordStreamReader reader(path);
+      _index = reader.index();
+      _records = reader.records();
+      _indexedRecords = _records;
+      _offset = reader.dataEnd();
+    }
+    fs::resize_file(p, _offset);
+    _stream = std::ofstream(path, std::ios::app | std::ios::binary);
+  } else {
+    _stream = std::ofstream(path, std::ios::trunc | std::ios::binary);
+    StreamHeader header{Magic, Version, 0};
+    _stream.write((const char *)&header, sizeof(header));
+    _offset = sizeof(header);
+  }
+
+  if (!_stream)
+    throw SHException("Failed to open record stream: " + path);
+
+  _current.firstRecord = _records;
+  _worker = std::thread([this]() { workerLoop(); });
+}
+
+RecordStreamWriter::~RecordStreamWriter() { close(); }
+
+void RecordStreamWriter::write(const SHVar &var) {
+  {
+    std::scoped_lock lock(_mutex);
+    if (!_error.empty())
+      throw SHException("Failed to write record stream " + _path + ": " + _error);
+  }
+
+  // records are prefixed by their size
+  auto &data = _current.data;
+  const auto start = data.size();
+  data.resize(start + sizeof(uint32_t));
+  auto writer = [&](const uint8_t *buf, size_t size) { data.insert(data.end(), buf, buf + size); };
+  _serial.reset();
+  const auto size = uint32_t(_serial.serialize(var, writer));
+  memcpy(data.data() + start, &size, sizeof(uint32_t));
+
+  _current.records++;
+  _records++;
+  if (data.size() >= _blockSize)
+    seal();
+}
+
+void RecordStreamWriter::flush() { seal(); }
+
+void RecordStreamWriter::seal() {
+  if (_current.records == 0)
+    return;
+
+  {
+    std::unique_lock lock(_mutex);
+    // the disk can't keep up, don't let pending blocks pile up
+    _cv.wait(lock, [&]() { return _pending.size() < MaxPendingBlocks || !_error.empty(); });
+    _pending.push_back(std::move(_current));
+    _current = Block{};
+    if (!_spare.empty()) {
+      _current.data = std::move(_spare.back());
+      _spare.pop_back();
+    }
+  }
+  _cv.notify_all();
+  _current.firstRecord = _records;
+}
+
+void RecordStreamWriter::close() {
+  if (_closed)
+    return;
+  _closed = true;
+
+  seal();
+  {
+    std::scoped_lock lock(_mutex);
+    _closing = true;
+  }
+  _cv.notify_all();
+  if (_worker.joinable())
+    _worker.join();
+
+  if (!_error.empty()) {
+    // drop whatever a failed block left behind, the index goes right after the last good block
+    _stream.close();
+    boost::system::error_code ec;
+    boost::filesystem::resize_file(_path, _offset, ec);
+    _stream = std::ofstream(_path, std::ios::app | std::ios::binary);
+  }
+
+  const auto indexOffset = _offset;
+  _stream.write((const char *)_index.data(), _index.size() * sizeof(IndexEntry));
+  // records of blocks that failed to be written are not in the stream
+  StreamFooter footer{indexOffset, _indexedRecords, uint32_t(_index.size()), FooterMagic};
+  _stream.write((const char *)&footer, sizeof(footer));
+  _stream.close();
+
+  if (!_error.empty())
+    SHLOG_ERROR("Record stream {} is incomplete: {}", _path, _error);
+}
+
+void RecordStreamWriter::workerLoop() {
+  while (true) {
+    Block block;
+    {
+      std::unique_lock lock(_mutex);
+      _cv.wait(lock, [&]() { return !_pending.empty() || _closing; });
+      if (_pending.empty())
+        return;
+      block = std::move(_pending.front());
+      _pending.pop_front();
+    }
+    _cv.notify_all();
+
+    std::string error;
+    bool failed;
+    {
+      std::scoped_lock lock(_mutex);
+      failed = !_error.empty();
+    }
+    // after a failure later blocks would leave a hole in the record numbering
+    if (!failed) {
+      try {
+        writeBlock(block);
+      } catch (std::exception &e) {
+        error = e.what();
+      }
+    }
+
+    block.data.clear();
+    std::scoped_lock lock(_mutex);
+    if (!error.empty() && _error.empty())
+      _error = error;
+    if (_spare.size() < 4)
+      _spare.push_back(std::move(block.data));
+  }
+}
+
+void RecordStreamWriter::writeBlock(Block &block) {
+  BlockHeader header{BlockMagic, _compression, {}, block.records, uint32_t(block.data.size()), 0, 0};
+  const uint8_t *payload = block.data.data();
+  size_t size = block.data.size();
+
+  switch (_compression) {
+  case Compression::None:
+    break;
+  case Compression::Snappy:
+    _compressed.resize(snappy::MaxCompressedLength(size));
+    snappy::RawCompress((const char *)payload, size, (char *)_compressed.data(), &size);
+    payload = _compressed.data();
+    break;
+  case Compression::Brotli: {
+    _compressed.resize(BrotliEncoderMaxCompressedSize(size));
+    size_t len = _compressed.size();
+    if (BrotliEncoderCompress(BrotliQuality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, size, payload, &len,
+                              _compressed.data()) != BROTLI_TRUE)
+      throw SHException("Failed to compress record stream block");
+    payload = _compressed.data();
+    size = len;
+  } break;
+  }
+
+  // not worth it, store as is
+  if (size >= block.data.size()) {
+    header.compression = Compression::None;
+    payload = block.data.data();
+    size = block.data.size();
+  }
+
+  header.size = uint32_t(size);
+  header.checksum = uint32_t(XXH3_64bits(payload, size));
+  _stream.write((const char *)&header, sizeof(header));
+  _stream.write((const char *)payload, size);
+  // readers tailing the stream see whole blocks
+  _stream.flush();
+  if (!_stream)
+    throw SHException("Failed to write record stream: " + _path);
+
+  _index.push_back(IndexEntry{_offset, block.firstRecord});
+  _indexedRecords = block.firstRecord + block.records;
+  _offset += sizeof(header) + size;
+}
+
+RecordStreamReader::RecordStreamReader(const std::string &path) : _path(path), _stream(path, std::ios::binary) {
+  StreamHeader header{};
+  _stream.read((char *)&header, sizeof(header));
+  if (!_stream || header.magic != Magic)
+    throw SHException("Not a record stream: " + path);
+  if (header.version != Version)
+    throw SHException("Unsupported record stream version: " + path);
+  _scanEnd = sizeof(header);
+
+  // closed streams end with the index
+  const auto size = uint64_t(boost::filesystem::file_size(path));
+  StreamFooter footer{};
+  if (size >= sizeof(StreamHeader) + sizeof(StreamFooter)) {
+    _stream.seekg(size - sizeof(StreamFooter));
+    _stream.read((char *)&footer, sizeof(footer));
+  }
+  if (_stream && footer.magic == FooterMagic &&
+      footer.indexOffset + footer.blocks * sizeof(IndexEntry) + sizeof(StreamFooter) == size) {
+    _index.resize(footer.blocks);
+    _stream.seekg(footer.indexOffset);
+    _stream.read((char *)_index.data(), _index.size() * sizeof(IndexEntry));
+    _records = footer.records;
+    for (size_t i = 0; i < _index.size(); i++) {
+      const auto end = i + 1 < _index.size() ? _index[i + 1].firstRecord : _records;
+      _blockRecords.push_back(uint32_t(end - _index[i].firstRecord));
+    }
+    _scanEnd = footer.indexOffset;
+    _indexed = true;
+  } else {
+    scan();
+  }
+}
+
+void RecordStreamReader::scan() {
+  const auto size = uint64_t(boost::filesystem::file_size(_path));
+  _stream.clear();
+  while (_scanEnd + sizeof(BlockHeader) <= size) {
+    BlockHeader header;
+    _stream.seekg(_scanEnd);
+    _stream.read((char *)&header, sizeof(header));
+    // a block still being written, or garbage past the last complete one
+    if (!_stream || header.magic != BlockMagic || _scanEnd + sizeof(BlockHeader) + header.size > size)
+      break;
+
+    _index.push_back(IndexEntry{_scanEnd, _records});
+    _blockRecords.push_back(header.records);
+    _records += header.records;
+    _scanEnd += sizeof(BlockHeader) + header.size;
+  }
+  _stream.clear();
+}
+
+void RecordStreamReader::loadBlock(size_t block) {
+  BlockHeader header;
+  _stream.clear();
+  _stream.seekg(_index[block].offset);
+  _stream.read((char *)&header, sizeof(header));
+  _compressed.resize(header.size);
+  _stream.read((char *)_compressed.data(), header.size);
+  if (!_stream || header.magic != BlockMagic || uint32_t(XXH3_64bits(_compressed.data(), header.size)) != header.checksum)
+    throw SHException("Corrupted record stream block: " + _path);
+
+  switch (header.compression) {
+  case Compression::None:
+    std::swap(_raw, _compressed);
+    break;
+  case Compression::Snappy:
+    _raw.resize(header.rawSize);
+    if (!snappy::RawUncompress((const char *)_compressed.data(), _compressed.size(), (char *)_raw.data()))
+      throw SHException("Corrupted record stream block: " + _path);
+    break;
+  case Compression::Brotli: {
+    _raw.resize(header.rawSize);
+    size_t len = _raw.size();
+    if (BrotliDecoderDecompress(_compressed.size(), _compressed.data(), &len, _raw.data()) != BROTLI_DECODER_RESULT_SUCCESS ||
+        len != header.rawSize)
+      throw SHException("Corrupted record stream block: " + _path);
+  } break;
+  default:
+    throw SHException("Corrupted record stream block: " + _path);
+  }
+
+  _block = block;
+  _pos = 0;
+  _posRecord = _index[block].firstRecord;
+}
+
+void RecordStreamReader::seek(uint64_t record) {
+  if (record > _records && !_indexed)
+    scan();
+  if (record > _records)
+    throw SHException("Record stream seek out of range: " + _path);
+  _record = record;
+}
+
+bool RecordStreamReader::next(SHVar &output) {
+  if (_record >= _records) {
+    if (_indexed)
+      return false;
+    scan();
+    if (_record >= _records)
+      return false;
+  }
+
+  if (_block >= _index.size() || _record < _index[_block].firstRecord ||
+      _record >= _index[_block].firstRecord + _blockRecords[_block]) {
+    auto it = std::upper_bound(_index.begin(), _index.end(), _record,
+                               [](uint64_t record, const IndexEntry &entry) { return record < entry.firstRecord; });
+    loadBlock(size_t(it - _index.begin()) - 1);
+  }
+
+  auto readSize = [&]() {
+    uint32_t size;
+    if (_pos + sizeof(uint32_t) > _raw.size())
+      throw SHException("Corrupted record stream block: " + _path);
+    memcpy(&size, _raw.data() + _pos, sizeof(uint32_t));
+    _pos += sizeof(uint32_t);
+    return size;
+  };
+
+  // seeking backwards within the block, walk again from its start
+  if (_record < _posRecord) {
+    _pos = 0;
+    _posRecord = _index[_block].firstRecord;
+  }
+  while (_posRecord < _record) {
+    _pos += readSize();
+    _posRecord++;
+  }
+
+  const auto size = readSize();
+  if (_pos + size > _raw.size())
+    throw SHException("Corrupted record stream block: " + _path);
+  size_t offset = 0;
+  auto reader = [&](uint8_t *buf, size_t len) {
+    if (offset + len > size)
+      throw SHException("Corrupted record stream record: " + _path);
+    memcpy(buf, _raw.data() + _pos + offset, len);
+    offset += len;
+  };
+  _serial.reset();
+  _serial.deserialize(reader, output);
+
+  _pos += size;
+  _posRecord++;
+  _record++;
+  return true;
+}
+} // namespace shards
@@ -0,0 +1,153 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#ifndef SH_CORE_RECORD_STREAM
+#define SH_CORE_RECORD_STREAM
+
+#include <shards/core/runtime.hpp>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace shards {
+// Record streams are blocks of length-prefixed serialized vars, each block optionally compressed,
+// closed by an index of block offsets so readers can seek to any record.
+// Layout: StreamHeader, blocks (BlockHeader + payload), index entries, StreamFooter.
+// A stream whose writer didn't get to close it has no index, readers rebuild it by scanning the blocks.
+namespace recordstream {
+constexpr uint32_t Magic = 'S' | ('H' << 8) | ('R' << 16) | ('S' << 24);
+constexpr uint32_t BlockMagic = 'S' | ('H' << 8) | ('R' << 16) | ('B' << 24);
+constexpr uint32_t FooterMagic = 'S' | ('H' << 8) | ('R' << 16) | ('I' << 24);
+constexpr uint16_t Version = 1;
+
+enum class Compression : uint8_t { None, Snappy, Brotli };
+
+struct StreamHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;
+};
+
+struct BlockHeader {
+  uint32_t magic;
+  Compression compression;
+  uint8_t reserved[3];
+  uint32_t records;
+  // size of the records once decompressed
+  uint32_t rawSize;
+  // size of the payload following this header
+  uint32_t size;
+  // low bits of the payload's XXH3
+  uint32_t checksum;
+};
+
+struct IndexEntry {
+  uint64_t offset;
+  uint64_t firstRecord;
+};
+
+struct StreamFooter {
+  uint64_t indexOffset;
+  uint64_t records;
+  uint32_t blocks;
+  uint32_t magic;
+};
+} // namespace recordstream
+
+// Appends records to a stream. Records are serialized into the current block,
+// full blocks are compressed and written behind by a worker thread so the producer doesn't wait on the disk.
+struct RecordStreamWriter {
+  static constexpr size_t MaxPendingBlocks = 64;
+
+  RecordStreamWriter(const std::string &path, bool append, recordstream::Compression compression, size_t blockSize);
+  ~RecordStreamWriter();
+
+  void write(const SHVar &var);
+  // Hands the current block over to the worker even if not full
+  void flush();
+  // Writes everything pending and the index, the writer can't be used afterwards
+  void close();
+
+private:
+  struct Block {
+    std::vector<uint8_t> data;
+    uint32_t records{};
+    uint64_t firstRecord{};
+  };
+
+  void seal();
+  void workerLoop();
+  void writeBlock(Block &block);
+
+  std::string _path;
+  std::ofstream _stream;
+  recordstream::Compression _compression;
+  size_t _blockSize;
+  Serialization _serial;
+
+  // producer side
+  Block _current;
+  uint64_t _records{};
+  bool _closed{false};
+
+  // worker side
+  uint64_t _offset{};
+  std::vector<recordstream::IndexEntry> _index;
+  // records of the blocks that made it to the index
+  uint64_t _indexedRecords{};
+  std::vector<uint8_t> _compressed;
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<Block> _pending;
+  std::vector<std::vector<uint8_t>> _spare;
+  std::string _error;
+  bool _closing{false};
+  std::thread _worker;
+};
+
+// Reads records in order or from any position, using the stream index (rebuilt when missing)
+struct RecordStreamReader {
+  RecordStreamReader(const std::string &path);
+
+  // Deserializes the next record into output, false once there are no more.
+  // Streams still being written without an index pick up new blocks when reaching the end.
+  bool next(SHVar &output);
+  // Moves to record, the next call to next() reads it
+  void seek(uint64_t record);
+
+  uint64_t records() const { return _records; }
+  const std::vector<recordstream::IndexEntry> &index() const { return _index; }
+  // where the blocks end, the index starts there if any
+  uint64_t dataEnd() const { return _scanEnd; }
+
+private:
+  void scan();
+  void loadBlock(size_t block);
+
+  std::string _path;
+  std::ifstream _stream;
+  std::vector<recordstream::IndexEntry> _index;
+  std::vector<uint32_t> _blockRecords;
+  uint64_t _records{};
+  // set when the stream was closed by its writer, no more blocks will come
+  bool _indexed{false};
+  uint64_t _scanEnd{};
+
+  size_t _block{size_t(-1)};
+  std::vector<uint8_t> _raw;
+  std::vector<uint8_t> _compressed;
+  size_t _pos{};
+  // the record at _pos
+  uint64_t _posRecord{};
+  // the record next() reads
+  uint64_t _record{};
+  Serialization _serial;
+};
+} // namespace shards
+
+#endif
@@ -2,15 +2,42 @@
 /* Copyright © 2019 Fragcolor Pte. Ltd. */
 
 #include "file_base.hpp"
+#include <shards/core/var_file.hpp>
+#include "record_stream.hpp"
 #include <fstream>
 #include <future>
 #include <string>
 
 namespace shards {
+enum class FileFormat { Plain, Mapped, Stream };
+} // namespace shards
+
+ENUM_HELP(shards::FileFormat, shards::FileFormat::Plain, SHCCSTR("One serialized var after another, read in order."));
+ENUM_HELP(shards::FileFormat, shards::FileFormat::Mapped,
+          SHCCSTR("The aligned var file format. Read through a memory mapping, strings, bytes, images and sequences of "
+                  "numbers point straight into it and are valid until the next activation."));
+ENUM_HELP(shards::FileFormat, shards::FileFormat::Stream,
+          SHCCSTR("A record stream. Records are batched in optionally compressed blocks written by a background thread, "
+                  "an index written when closing lets readers seek to any record."));
+ENUM_HELP(shards::recordstream::Compression, shards::recordstream::Compression::None, SHCCSTR("Blocks are stored as is."));
+ENUM_HELP(shards::recordstream::Compression, shards::recordstream::Compression::Snappy,
+          SHCCSTR("Fast compression with a moderate ratio."));
+ENUM_HELP(shards::recordstream::Compression, shards::recordstream::Compression::Brotli,
+          SHCCSTR("Slower compression with a better ratio."));
+
+namespace shards {
+DECL_ENUM_INFO(FileFormat, FileFormat, 'flFm');
+DECL_ENUM_INFO(recordstream::Compression, StreamCompression, 'flCm');
+
 struct WriteFile : public FileBase {
   std::ofstream _fileStream;
   bool _append = false;
   bool _flush = false;
+  FileFormat _format{FileFormat::Plain};
+  recordstream::Compression _compression{recordstream::Compression::None};
+  int64_t _blockSize{64 * 1024};
+  VarFileEncoder _encoder;
+  std::unique_ptr<RecordStreamWriter> _recordStream;
 
   static inline Parameters params{
       FileBase::params,
@@ -18,7 +45,13 @@ struct WriteFile : public FileBase {
         SHCCSTR("If we should append to the file if existed already or "
                 "truncate. (default: false)."),
         {CoreInfo::BoolType}},
-       {"Flush", SHCCSTR("If the file should be flushed to disk after every write."), {CoreInfo::BoolType}}}};
+       {"Flush",
+        SHCCSTR("If the file should be flushed to disk after every write. With the Stream format, the current block is "
+                "handed to the writer thread even if not full."),
+        {CoreInfo::BoolType}},
+       {"Format", SHCCSTR("The layout of the file."), {FileFormatEnumInfo::Type}},
+       {"Compression", SHCCSTR("How blocks are compressed, Stream format only."), {StreamCompressionEnumInfo::Type}},
+       {"BlockSize", SHCCSTR("The size in bytes of the blocks records are batched in, Stream format only."), {CoreInfo::IntType}}}};
 
   static SHParametersInfo parameters() { return params; }
 
@@ -30,6 +63,15 @@ struct WriteFile : public FileBase {
     case 2:
       _flush = value.payload.boolValue;
       break;
+    case 3:
+      _format = FileFormat(value.payload.enumValue);
+      break;
+    case 4:
+      _compression = recordstream::Compression(value.payload.enumValue);
+      break;
+    case 5:
+      _blockSize = std::max<int64_t>(value.payload.intValue, 1);
+      break;
     default:
       FileBase::setParam(index, value);
     }
@@ -41,6 +83,12 @@ struct WriteFile : public FileBase {
       return Var(_append);
     case 2:
       return Var(_flush);
+    case 3:
+      return Var::Enum(_format, FileFormatEnumInfo::VendorId, FileFormatEnumInfo::TypeId);
+    case 4:
+      return Var::Enum(_compression, StreamCompressionEnumInfo::VendorId, StreamCompressionEnumInfo::TypeId);
+    case 5:
+      return Var(_blockSize);
     default:
       return FileBase::getParam(index);
     }
@@ -51,6 +99,8 @@ struct WriteFile : public FileBase {
       _fileStream.flush();
     }
     _fileStream = {};
+    // writes what's pending and the index
+    _recordStream.reset();
     FileBase::cleanup();
   }
 
@@ -63,7 +113,8 @@ struct WriteFile : public FileBase {
   Serialization serial;
 
   SHVar activate(SHContext *context, const SHVar &input) {
-    if (!_fileStream.is_open() || (_filename.isVariable() && _filename.get() != _currentFileName)) {
+    const auto opened = _format == FileFormat::Stream ? bool(_recordStream) : _fileStream.is_open();
+    if (!opened || (_filename.isVariable() && _filename.get() != _currentFileName)) {
       std::string filename;
       if (!getFilename(context, filename, false)) {
         return input;
@@ -77,15 +128,42 @@ struct WriteFile : public FileBase {
       if (!parent_path.empty() && !fs::exists(parent_path))
         fs::create_directories(p.parent_path());
 
-      if (_append)
-        _fileStream = std::ofstream(filename, std::ios::app | std::ios::binary);
-      else
-        _fileStream = std::ofstream(filename, std::ios::trunc | std::ios::binary);
+      if (_format == FileFormat::Stream) {
+        _recordStream.reset();
+        _recordStream = std::make_unique<RecordStreamWriter>(filename, _append, _compression, size_t(_blockSize));
+      } else {
+        const auto empty = !_append || !fs::exists(p) || fs::file_size(p) == 0;
+        if (_append)
+          _fileStream = std::ofstream(filename, std::ios::app | std::ios::binary);
+        else
+          _fileStream = std::ofstream(filename, std::ios::trunc | std::ios::binary);
+
+        if (_format == FileFormat::Mapped && empty) {
+          const auto header = VarFileEncoder::header();
+          _fileStream.write((const char *)&header, sizeof(header));
+        }
+      }
+    }
+
+    switch (_format) {
+    case FileFormat::Stream:
+      _recordStream->write(input);
+      if (_flush) {
+        _recordStream->flush();
+      }
+      return input;
+    case FileFormat::Mapped: {
+      // a record goes out in a single write
+      auto &record = _encoder.record(input);
+      _fileStream.write((const char *)record.data(), record.size());
+    } break;
+    case FileFormat::Plain: {
+      Writer s(_fileStream);
+      serial.reset();
+      serial.serialize(input, s);
+    } break;
     }
 
-    Writer s(_fileStream);
-    serial.reset();
-    serial.serialize(input, s);
     if (_flush) {
       _fileStream.flush();
     }
@@ -96,15 +174,102 @@ struct WriteFile : public FileBase {
 struct ReadFile : public FileBase {
   static SHTypesInfo inputTypes() { return CoreInfo::NoneType; }
 
+  static inline Parameters params{
+      FileBase::params,
+      {{"Format", SHCCSTR("The layout of the file, as written by WriteFile."), {FileFormatEnumInfo::Type}},
+       {"Seek",
+        SHCCSTR("The record to read, reading continues in order from there. Stream format only, none reads the next "
+                "record."),
+        {CoreInfo::NoneType, CoreInfo::IntType, CoreInfo::IntVarType}}}};
+
+  static SHParametersInfo parameters() { return params; }
+
   std::ifstream _fileStream;
+  std::unique_ptr<MappedVarFile> _mappedFile;
+  std::unique_ptr<RecordStreamReader> _recordStream;
+  FileFormat _format{FileFormat::Plain};
+  ParamVar _seek{};
   SHVar _output{};
 
+  void setParam(int index, const SHVar &value) {
+    switch (index) {
+    case 1:
+      _format = FileFormat(value.payload.enumValue);
+      break;
+    case 2:
+      _seek = value;
+      break;
+    default:
+      FileBase::setParam(index, value);
+    }
+  }
+
+  SHVar getParam(int index) {
+    switch (index) {
+    case 1:
+      return Var::Enum(_format, FileFormatEnumInfo::VendorId, FileFormatEnumInfo::TypeId);
+    case 2:
+      return _seek;
+    default:
+      return FileBase::getParam(index);
+    }
+  }
+
+  void warmup(SHContext *context) {
+    FileBase::warmup(context);
+    _seek.warmup(context);
+  }
+
   void cleanup() {
     destroyVar(_output);
+    // mapped outputs are foreign and point into the mapping, forget them before unmapping
+    _output = {};
+    _mappedFile.reset();
+    _recordStream.reset();
     _fileStream = {};
+    _seek.cleanup();
     FileBase::cleanup();
   }
 
+  SHVar activateMapped(SHContext *context) {
+    if (!_mappedFile || (_filename.isVariable() && _filename.get() != _currentFileName)) {
+      std::string filename;
+      if (!getFilename(context, filename)) {
+        return Var::Empty;
+      }
+
+      destroyVar(_output);
+      _output = {};
+      _mappedFile = std::make_unique<MappedVarFile>(filename);
+    }
+
+    if (!_mappedFile->next(_output))
+      return Var::Empty;
+    return _output;
+  }
+
+  SHVar activateStream(SHContext *context) {
+    if (!_recordStream || (_filename.isVariable() && _filename.get() != _currentFileName)) {
+      std::string filename;
+      if (!getFilename(context, filename)) {
+        return Var::Empty;
+      }
+
+      _recordStream = std::make_unique<RecordStreamReader>(filename);
+    }
+
+    auto &seek = _seek.get();
+    if (seek.valueType == SHType::Int) {
+      if (seek.payload.intValue < 0)
+        throw ActivationError("ReadFile: Seek must be positive");
+      _recordStream->seek(uint64_t(seek.payload.intValue));
+    }
+
+    if (!_recordStream->next(_output))
+      return Var::Empty;
+    return _output;
+  }
+
   struct Reader {
     std::ifstream &_fileStream;
     Reader(std::ifstream &stream) : _fileStream(stream) {}
@@ -114,6 +279,11 @@ struct ReadFile : public FileBase {
   Serialization serial;
 
   SHVar activate(SHContext *context, const SHVar &input) {
+    if (_format == FileFormat::Mapped)
+      return activateMapped(context);
+    if (_format == FileFormat::Stream)
+      return activateStream(context);
+
     if (!_fileStream.is_open() || (_filename.isVariable() && _filename.get() != _currentFileName)) {
       std::string filename;
       if (!getFilename(context, filename)) {
@@ -189,6 +359,9 @@ struct FromBytes {
 };
 
 SHARDS_REGISTER_FN(serialization) {
+  REGISTER_ENUM(FileFormatEnumInfo);
+  REGISTER_ENUM(StreamCompressionEnumInfo);
+
   REGISTER_SHARD("WriteFile", WriteFile);
   REGISTER_SHARD("ReadFile", ReadFile);
   REGISTER_SHARD("FromBytes", FromBytes);
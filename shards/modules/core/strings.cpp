@@ -387,7 +387,6 @@ struct ParseFloat : public Parser {
 };
 
 struct Split {
-  std::string _inputStr;
   SeqVar _lines;
   std::string _separator;
 
@@ -420,20 +419,41 @@ struct Split {
     }
   }
 
+  template <typename F> void split(std::string_view str, F &&f) {
+    const auto sep = _separator[0];
+    // same pieces std::getline would give, no trailing empty one
+    size_t pos = 0;
+    while (pos < str.size()) {
+      auto next = str.find(sep, pos);
+      if (next == std::string_view::npos)
+        next = str.size();
+      f(str.substr(pos, next - pos));
+      pos = next + 1;
+    }
+  }
+
   SHVar activate(SHContext *context, const SHVar &input) {
     auto input_string = SHSTRVIEW(input);
-    _inputStr.clear();
-    _inputStr.append(input_string);
-    std::vector<std::string> components;
-    std::string component;
-    std::istringstream input_stream(_inputStr);
-    const auto sep = _separator[0];
 
-    _lines.clear();
-    while (std::getline(input_stream, component, sep)) {
-      _lines.push_back(Var(component));
+    if (auto arena = iterationArena(context)) {
+      uint32_t count = 0;
+      size_t needed = 0;
+      split(input_string, [&](std::string_view part) {
+        count++;
+        needed += IterationArena::aligned(part.size() + 1);
+      });
+      needed += IterationArena::aligned(sizeof(SHVar) * count);
+      // in a loop every activation allocates again, past the budget reuse our own buffer
+      if (arena->fits(needed)) {
+        auto output = arena->seq(count);
+        uint32_t idx = 0;
+        split(input_string, [&](std::string_view part) { output.payload.seqValue.elements[idx++] = arena->string(part); });
+        return output;
+      }
     }
 
+    _lines.clear();
+    split(input_string, [&](std::string_view part) { _lines.push_back(Var(part)); });
     return _lines;
   }
 };
@@ -0,0 +1,393 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#include "tensor.hpp"
+#include <shards/core/shared.hpp>
+#include <shards/math_ops.hpp>
+#include <cstring>
+
+ENUM_HELP(shards::Tensor::DType, shards::Tensor::DType::Float32, SHCCSTR("32 bit floating point elements."));
+ENUM_HELP(shards::Tensor::DType, shards::Tensor::DType::Float64, SHCCSTR("64 bit floating point elements."));
+ENUM_HELP(shards::Tensor::DType, shards::Tensor::DType::Int32, SHCCSTR("32 bit integer elements."));
+ENUM_HELP(shards::Tensor::DType, shards::Tensor::DType::Int64, SHCCSTR("64 bit integer elements."));
+
+namespace shards {
+namespace Tensor {
+DECL_ENUM_INFO(DType, TensorDType, 'tnTy');
+
+std::vector<uint8_t> serialize(const TensorData &tensor) {
+  std::vector<uint8_t> res;
+  const auto rank = uint32_t(tensor.shape.size());
+  res.resize(sizeof(uint8_t) + sizeof(uint32_t) + rank * sizeof(int64_t) + tensor.data.size());
+  auto p = res.data();
+  *p++ = uint8_t(tensor.dtype);
+  memcpy(p, &rank, sizeof(uint32_t));
+  p += sizeof(uint32_t);
+  memcpy(p, tensor.shape.data(), rank * sizeof(int64_t));
+  p += rank * sizeof(int64_t);
+  memcpy(p, tensor.data.data(), tensor.data.size());
+  return res;
+}
+
+TensorData deserialize(const std::string_view &data) {
+  auto p = (const uint8_t *)data.data();
+  const auto end = p + data.size();
+  if (data.size() < sizeof(uint8_t) + sizeof(uint32_t))
+    throw SHException("Invalid serialized tensor");
+
+  const auto dtype = DType(*p++);
+  if (dtype > DType::Int64)
+    throw SHException("Invalid serialized tensor");
+  uint32_t rank;
+  memcpy(&rank, p, sizeof(uint32_t));
+  p += sizeof(uint32_t);
+  if (size_t(end - p) < rank * sizeof(int64_t))
+    throw SHException("Invalid serialized tensor");
+
+  std::vector<int64_t> shape(rank);
+  memcpy(shape.data(), p, rank * sizeof(int64_t));
+  p += rank * sizeof(int64_t);
+
+  TensorData res;
+  res.reshape(dtype, shape);
+  if (size_t(end - p) != res.data.size())
+    throw SHException("Invalid serialized tensor");
+  memcpy(res.data.data(), p, res.data.size());
+  return res;
+}
+
+// Shards building a tensor out of a flat buffer, the element type and shape are given as parameters
+struct BuilderBase : public OutputBase {
+  DType _dtype{DType::Float32};
+  OwnedVar _shape{};
+
+  static inline Parameters params{
+      {{"Type", SHCCSTR("The type of the elements."), {TensorDTypeEnumInfo::Type}},
+       {"Shape",
+        SHCCSTR("The dimensions of the tensor, the product must match the number of elements. A single dimension if none."),
+        {CoreInfo::NoneType, CoreInfo::IntSeqType}}}};
+
+  static SHParametersInfo parameters() { return params; }
+
+  SHTypeInfo compose(const SHInstanceData &data) { return tensorType(_dtype); }
+
+  void setParam(int index, const SHVar &value) {
+    switch (index) {
+    case 0:
+      _dtype = DType(value.payload.enumValue);
+      break;
+    case 1:
+      _shape = value;
+      break;
+    default:
+      break;
+    }
+  }
+
+  SHVar getParam(int index) {
+    switch (index) {
+    case 0:
+      return Var::Enum(_dtype, TensorDTypeEnumInfo::VendorId, TensorDTypeEnumInfo::TypeId);
+    case 1:
+      return _shape;
+    default:
+      return Var::Empty;
+    }
+  }
+
+  TensorData &output(size_t count) {
+    auto &tensor = OutputBase::output();
+    if (_shape.valueType == SHType::Seq) {
+      std::vector<int64_t> dims;
+      size_t n = 1;
+      const auto &seq = _shape.payload.seqValue;
+      for (uint32_t i = 0; i < seq.len; i++) {
+        const auto dim = seq.elements[i].payload.intValue;
+        dims.push_back(dim);
+        n *= size_t(std::max<int64_t>(dim, 0));
+      }
+      if (n != count)
+        throw ActivationError(fmt::format("Tensor shape holds {} elements, got {}", n, count));
+      tensor.reshape(_dtype, dims);
+    } else {
+      tensor.reshape(_dtype, {int64_t(count)});
+    }
+    return tensor;
+  }
+};
+
+struct FromSeq : public BuilderBase {
+  static inline Types InputTypes{{CoreInfo::FloatSeqType, CoreInfo::IntSeqType}};
+
+  static SHOptionalString help() { return SHCCSTR("Packs a sequence of numbers into a dense tensor."); }
+  static SHTypesInfo inputTypes() { return InputTypes; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    const auto &seq = input.payload.seqValue;
+    auto &tensor = output(seq.len);
+    tensor.visit([&](auto *p) {
+      using T = std::remove_pointer_t<decltype(p)>;
+      for (uint32_t i = 0; i < seq.len; i++) {
+        const auto &e = seq.elements[i];
+        p[i] = e.valueType == SHType::Int ? T(e.payload.intValue) : T(e.payload.floatValue);
+      }
+    });
+    return outputVar();
+  }
+};
+
+struct FromBytes : public BuilderBase {
+  static SHOptionalString help() {
+    return SHCCSTR("Copies raw native endian elements into a dense tensor, the size must be a multiple of the element size.");
+  }
+  static SHTypesInfo inputTypes() { return CoreInfo::BytesType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    const auto size = input.payload.bytesSize;
+    if (size % dtypeSize(_dtype) != 0)
+      throw ActivationError("Bytes size is not a multiple of the tensor element size");
+    auto &tensor = output(size / dtypeSize(_dtype));
+    memcpy(tensor.data.data(), input.payload.bytesValue, size);
+    return outputVar();
+  }
+};
+
+struct FromAudio : public OutputBase {
+  static SHOptionalString help() {
+    return SHCCSTR("Copies audio samples into a Float32 tensor shaped [samples channels].");
+  }
+  static SHTypesInfo inputTypes() { return CoreInfo::AudioType; }
+
+  SHTypeInfo compose(const SHInstanceData &data) { return Float32TensorType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    const auto &audio = input.payload.audioValue;
+    auto &tensor = output();
+    tensor.reshape(DType::Float32, {int64_t(audio.nsamples), int64_t(audio.channels)});
+    memcpy(tensor.data.data(), audio.samples, tensor.data.size());
+    return outputVar();
+  }
+};
+
+struct FromImage : public OutputBase {
+  static SHOptionalString help() {
+    return SHCCSTR("Converts an image into a Float32 tensor shaped [height width channels], pixel values are kept as they are.");
+  }
+  static SHTypesInfo inputTypes() { return CoreInfo::ImageType; }
+
+  SHTypeInfo compose(const SHInstanceData &data) { return Float32TensorType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    const auto &image = input.payload.imageValue;
+    auto &tensor = output();
+    tensor.reshape(DType::Float32, {int64_t(image.height), int64_t(image.width), int64_t(image.channels)});
+    auto out = reinterpret_cast<float *>(tensor.data.data());
+    const auto n = tensor.count();
+    if ((image.flags & SHIMAGE_FLAGS_32BITS_FLOAT) == SHIMAGE_FLAGS_32BITS_FLOAT) {
+      memcpy(out, image.data, n * sizeof(float));
+    } else if ((image.flags & SHIMAGE_FLAGS_16BITS_INT) == SHIMAGE_FLAGS_16BITS_INT) {
+      auto in = reinterpret_cast<const uint16_t *>(image.data);
+      for (size_t i = 0; i < n; i++)
+        out[i] = float(in[i]);
+    } else {
+      for (size_t i = 0; i < n; i++)
+        out[i] = float(image.data[i]);
+    }
+    return outputVar();
+  }
+};
+
+// Views of a tensor as another type, they point into the tensor and are valid as long as the tensor is
+struct ViewBase {
+  static SHTypesInfo inputTypes() { return TensorTypes; }
+};
+
+struct ToBytes : public ViewBase {
+  static SHOptionalString help() { return SHCCSTR("The raw native endian elements of the tensor, without copying them."); }
+  static SHTypesInfo outputTypes() { return CoreInfo::BytesType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &tensor = asTensor(input);
+    return Var(tensor.data.data(), uint32_t(tensor.data.size()));
+  }
+};
+
+struct ToAudio : public ViewBase {
+  int64_t _sampleRate{44100};
+
+  static SHOptionalString help() {
+    return SHCCSTR("Views a Float32 tensor shaped [samples] or [samples channels] as audio, without copying.");
+  }
+  static SHTypesInfo outputTypes() { return CoreInfo::AudioType; }
+
+  static inline Parameters params{{{"SampleRate", SHCCSTR("The sample rate of the audio."), {CoreInfo::IntType}}}};
+  static SHParametersInfo parameters() { return params; }
+  void setParam(int index, const SHVar &value) { _sampleRate = value.payload.intValue; }
+  SHVar getParam(int index) { return Var(_sampleRate); }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &tensor = asTensor(input);
+    if (tensor.dtype != DType::Float32 || tensor.shape.empty() || tensor.shape.size() > 2)
+      throw ActivationError("Audio tensors must be Float32 shaped [samples] or [samples channels]");
+    const auto samples = tensor.shape[0];
+    const auto channels = tensor.shape.size() == 2 ? tensor.shape[1] : 1;
+    if (samples > UINT16_MAX || channels > UINT16_MAX)
+      throw ActivationError("Tensor too large for audio");
+
+    SHVar res{};
+    res.valueType = SHType::Audio;
+    res.payload.audioValue = SHAudio{uint32_t(_sampleRate), uint16_t(samples), uint16_t(channels),
+                                     reinterpret_cast<float *>(tensor.data.data())};
+    return res;
+  }
+};
+
+struct ToImage : public ViewBase {
+  static SHOptionalString help() {
+    return SHCCSTR("Views a Float32 tensor shaped [height width channels] as a 32 bit float image, without copying.");
+  }
+  static SHTypesInfo outputTypes() { return CoreInfo::ImageType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &tensor = asTensor(input);
+    if (tensor.dtype != DType::Float32 || tensor.shape.size() != 3)
+      throw ActivationError("Image tensors must be Float32 shaped [height width channels]");
+    const auto height = tensor.shape[0];
+    const auto width = tensor.shape[1];
+    const auto channels = tensor.shape[2];
+    if (height > UINT16_MAX || width > UINT16_MAX || channels < 1 || channels > 4)
+      throw ActivationError("Tensor can't be viewed as an image");
+
+    SHVar res{};
+    res.valueType = SHType::Image;
+    res.payload.imageValue = SHImage{uint16_t(width), uint16_t(height), uint8_t(channels), SHIMAGE_FLAGS_32BITS_FLOAT,
+                                     tensor.data.data()};
+    return res;
+  }
+};
+
+struct ToSeq : public ViewBase {
+  SeqVar _output;
+
+  static SHOptionalString help() {
+    return SHCCSTR("Unpacks the elements of the tensor into a sequence of Float or Int, depending on the tensor type.");
+  }
+  static inline Types OutputTypes{{CoreInfo::FloatSeqType, CoreInfo::IntSeqType}};
+  static SHTypesInfo outputTypes() { return OutputTypes; }
+
+  SHTypeInfo compose(const SHInstanceData &data) {
+    DType dtype;
+    if (!tensorDType(data.inputType, dtype))
+      throw ComposeError("Tensor.ToSeq expects a Tensor input");
+    return isFloat(dtype) ? CoreInfo::FloatSeqType : CoreInfo::IntSeqType;
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &tensor = asTensor(input);
+    const auto n = tensor.count();
+    _output.resize(n);
+    auto elements = _output.payload.seqValue.elements;
+    tensor.visit([&](auto *p) {
+      for (size_t i = 0; i < n; i++) {
+        if constexpr (std::is_floating_point_v<std::remove_pointer_t<decltype(p)>>) {
+          elements[i].valueType = SHType::Float;
+          elements[i].payload.floatValue = SHFloat(p[i]);
+        } else {
+          elements[i].valueType = SHType::Int;
+          elements[i].payload.intValue = SHInt(p[i]);
+        }
+      }
+    });
+    return _output;
+  }
+};
+
+struct Shape : public ViewBase {
+  SeqVar _output;
+
+  static SHOptionalString help() { return SHCCSTR("The dimensions of the tensor."); }
+  static SHTypesInfo outputTypes() { return CoreInfo::IntSeqType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &tensor = asTensor(input);
+    _output.clear();
+    for (auto dim : tensor.shape)
+      _output.push_back(Var(dim));
+    return _output;
+  }
+};
+
+struct Sum : public ViewBase {
+  static SHOptionalString help() { return SHCCSTR("The sum of all the elements of the tensor."); }
+  static SHTypesInfo outputTypes() { return CoreInfo::FloatType; }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &tensor = asTensor(input);
+    const auto n = tensor.count();
+    double sum = 0.0;
+    tensor.visit([&](auto *p) {
+      for (size_t i = 0; i < n; i++)
+        sum += double(p[i]);
+    });
+    return Var(sum);
+  }
+};
+
+// Elementwise operation between a tensor and a number or another tensor of the same type and size,
+// the output has the type and shape of the input
+template <typename TOp> struct Elementwise : public OutputBase {
+  ParamVar _operand{Var(0.0)};
+  TOp _op;
+
+  static inline Parameters params{{{"Operand", SHCCSTR("A number, or a tensor of the same type and size."), TensorOperandTypes}}};
+
+  static SHOptionalString help() {
+    return SHCCSTR("Applies the operation to every element of the input tensor and the operand.");
+  }
+  static SHTypesInfo inputTypes() { return TensorTypes; }
+  static SHParametersInfo parameters() { return params; }
+
+  void setParam(int index, const SHVar &value) { _operand = value; }
+  SHVar getParam(int index) { return _operand; }
+
+  SHTypeInfo compose(const SHInstanceData &data) { return data.inputType; }
+
+  void warmup(SHContext *context) { _operand.warmup(context); }
+  void cleanup() {
+    _operand.cleanup();
+    OutputBase::cleanup();
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &a = asTensor(input);
+    auto &out = output();
+    elementwise(_op, out, a, _operand.get());
+    return outputVar();
+  }
+};
+
+using Add = Elementwise<Math::AddOp>;
+using Subtract = Elementwise<Math::SubtractOp>;
+using Multiply = Elementwise<Math::MultiplyOp>;
+using Divide = Elementwise<Math::DivideOp>;
+} // namespace Tensor
+
+SHARDS_REGISTER_FN(tensor) {
+  REGISTER_ENUM(Tensor::TensorDTypeEnumInfo);
+
+  REGISTER_SHARD("Tensor.FromSeq", Tensor::FromSeq);
+  REGISTER_SHARD("Tensor.FromBytes", Tensor::FromBytes);
+  REGISTER_SHARD("Tensor.FromAudio", Tensor::FromAudio);
+  REGISTER_SHARD("Tensor.FromImage", Tensor::FromImage);
+  REGISTER_SHARD("Tensor.ToSeq", Tensor::ToSeq);
+  REGISTER_SHARD("Tensor.ToBytes", Tensor::ToBytes);
+  REGISTER_SHARD("Tensor.ToAudio", Tensor::ToAudio);
+  REGISTER_SHARD("Tensor.ToImage", Tensor::ToImage);
+  REGISTER_SHARD("Tensor.Shape", Tensor::Shape);
+  REGISTER_SHARD("Tensor.Sum", Tensor::Sum);
+  REGISTER_SHARD("Tensor.Add", Tensor::Add);
+  REGISTER_SHARD("Tensor.Subtract", Tensor::Subtract);
+  REGISTER_SHARD("Tensor.Multiply", Tensor::Multiply);
+  REGISTER_SHARD("Tensor.Divide", Tensor::Divide);
+}
+} // namespace shards
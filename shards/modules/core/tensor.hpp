@@ -0,0 +1,226 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#ifndef SH_CORE_TENSOR
+#define SH_CORE_TENSOR
+
+#include <shards/core/foundation.hpp>
+#include <shards/common_types.hpp>
+#include <numeric>
+#include <string_view>
+#include <vector>
+
+namespace shards {
+namespace Tensor {
+enum class DType : uint8_t { Float32, Float64, Int32, Int64 };
+
+constexpr size_t dtypeSize(DType dtype) {
+  switch (dtype) {
+  case DType::Float32:
+  case DType::Int32:
+    return 4;
+  case DType::Float64:
+  case DType::Int64:
+    return 8;
+  }
+  return 0;
+}
+
+constexpr bool isFloat(DType dtype) { return dtype == DType::Float32 || dtype == DType::Float64; }
+
+// Dense row-major array of a single numeric type, 4 or 8 bytes per element
+// instead of the 32 bytes of a SHVar in a sequence.
+// Tensor.From* copy their input once, only the Tensor.To* views avoid copying.
+// Math.* and serialization understand tensors, Linalg.*, DSP.FFT, Map and Reduce still take sequences.
+struct TensorData {
+  DType dtype{DType::Float32};
+  std::vector<int64_t> shape;
+  std::vector<uint8_t> data;
+
+  size_t count() const { return data.size() / dtypeSize(dtype); }
+
+  // Sets type and shape, keeping the buffer when possible
+  void reshape(DType type, const std::vector<int64_t> &dims) {
+    size_t n = 1;
+    for (auto dim : dims) {
+      if (dim < 0)
+        throw ActivationError("Tensor dimensions can't be negative");
+      n *= size_t(dim);
+    }
+    dtype = type;
+    if (&dims != &shape)
+      shape = dims;
+    data.resize(n * dtypeSize(type));
+  }
+
+  // Calls fn with a pointer to the elements, typed after dtype
+  template <typename F> decltype(auto) visit(F &&fn) {
+    switch (dtype) {
+    case DType::Float32:
+      return fn(reinterpret_cast<float *>(data.data()));
+    case DType::Float64:
+      return fn(reinterpret_cast<double *>(data.data()));
+    case DType::Int32:
+      return fn(reinterpret_cast<int32_t *>(data.data()));
+    case DType::Int64:
+      return fn(reinterpret_cast<int64_t *>(data.data()));
+    }
+    throw ActivationError("Invalid tensor type");
+  }
+};
+
+// dtype, rank, shape then the raw elements
+std::vector<uint8_t> serialize(const TensorData &tensor);
+TensorData deserialize(const std::string_view &data);
+
+constexpr int32_t typeId(DType dtype) {
+  switch (dtype) {
+  case DType::Float32:
+    return 'tnF4';
+  case DType::Float64:
+    return 'tnF8';
+  case DType::Int32:
+    return 'tnI4';
+  case DType::Int64:
+    return 'tnI8';
+  }
+  return 0;
+}
+
+// One object type per element type, so that compose knows what a tensor holds.
+// They all wrap the same TensorData, any of them can create or release a tensor.
+using TensorObject = ObjectVar<TensorData, serialize, deserialize>;
+inline TensorObject Float32ObjectVar{"Tensor.Float32", CoreCC, typeId(DType::Float32)};
+inline TensorObject Float64ObjectVar{"Tensor.Float64", CoreCC, typeId(DType::Float64)};
+inline TensorObject Int32ObjectVar{"Tensor.Int32", CoreCC, typeId(DType::Int32)};
+inline TensorObject Int64ObjectVar{"Tensor.Int64", CoreCC, typeId(DType::Int64)};
+
+inline TensorObject &objectVar(DType dtype) {
+  switch (dtype) {
+  case DType::Float32:
+    return Float32ObjectVar;
+  case DType::Float64:
+    return Float64ObjectVar;
+  case DType::Int32:
+    return Int32ObjectVar;
+  case DType::Int64:
+    return Int64ObjectVar;
+  }
+  throw ActivationError("Invalid tensor type");
+}
+
+inline Type Float32TensorType = Type::Object(CoreCC, typeId(DType::Float32));
+inline Type Float64TensorType = Type::Object(CoreCC, typeId(DType::Float64));
+inline Type Int32TensorType = Type::Object(CoreCC, typeId(DType::Int32));
+inline Type Int64TensorType = Type::Object(CoreCC, typeId(DType::Int64));
+inline Types TensorTypes{{Float32TensorType, Float64TensorType, Int32TensorType, Int64TensorType}};
+inline Types TensorVarTypes{{Type::VariableOf(Float32TensorType), Type::VariableOf(Float64TensorType),
+                             Type::VariableOf(Int32TensorType), Type::VariableOf(Int64TensorType)}};
+// What elementwise operations take as operand
+inline Types TensorOperandTypes{TensorVarTypes,
+                                {CoreInfo::FloatType, CoreInfo::IntType, CoreInfo::FloatVarType, CoreInfo::IntVarType}};
+
+inline SHTypeInfo tensorType(DType dtype) {
+  switch (dtype) {
+  case DType::Float32:
+    return Float32TensorType;
+  case DType::Float64:
+    return Float64TensorType;
+  case DType::Int32:
+    return Int32TensorType;
+  case DType::Int64:
+    return Int64TensorType;
+  }
+  throw ComposeError("Invalid tensor type");
+}
+
+// The element type of a tensor type, false if type is not a tensor
+inline bool tensorDType(const SHTypeInfo &type, DType &dtype) {
+  if (type.basicType != SHType::Object || type.object.vendorId != CoreCC)
+    return false;
+  for (auto candidate : {DType::Float32, DType::Float64, DType::Int32, DType::Int64}) {
+    if (type.object.typeId == typeId(candidate)) {
+      dtype = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool isTensor(const SHVar &var) {
+  if (var.valueType != SHType::Object || var.payload.objectVendorId != CoreCC)
+    return false;
+  const auto id = var.payload.objectTypeId;
+  return id == typeId(DType::Float32) || id == typeId(DType::Float64) || id == typeId(DType::Int32) ||
+         id == typeId(DType::Int64);
+}
+
+inline TensorData &asTensor(const SHVar &var) {
+  if (!isTensor(var))
+    throw ActivationError("Expected a Tensor");
+  return *reinterpret_cast<TensorData *>(var.payload.objectValue);
+}
+
+// Owns the tensor a shard outputs, reused across activations unless something else still references it
+struct OutputBase {
+  TensorData *_tensor{};
+
+  static SHTypesInfo outputTypes() { return TensorTypes; }
+
+  TensorData &output() {
+    if (_tensor && Float32ObjectVar.RefCount(_tensor) > 1) {
+      // e.g. Set or Push kept the previous result, leave it alone
+      Float32ObjectVar.Release(_tensor);
+      _tensor = nullptr;
+    }
+    if (!_tensor)
+      _tensor = Float32ObjectVar.New();
+    return *_tensor;
+  }
+
+  // Typed after the current element type of the tensor
+  SHVar outputVar() { return objectVar(_tensor->dtype).Get(_tensor); }
+
+  void cleanup() {
+    if (_tensor) {
+      Float32ObjectVar.Release(_tensor);
+      _tensor = nullptr;
+    }
+  }
+};
+
+// out = a op operand for every element, operand is a number or a tensor of the same type and size.
+// out takes the type and shape of a, it can be a itself.
+template <typename TOp> void elementwise(TOp &op, TensorData &out, TensorData &a, const SHVar &operand) {
+  const TensorData *b = nullptr;
+  if (operand.valueType == SHType::Object) {
+    b = &asTensor(operand);
+    if (b->dtype != a.dtype || b->data.size() != a.data.size())
+      throw ActivationError("Tensor operands must have the same type and size");
+  } else if (operand.valueType != SHType::Int && operand.valueType != SHType::Float) {
+    throw ActivationError("Tensor operands must be numbers or tensors");
+  }
+
+  // keep the shape alive if out is a, it doesn't change
+  if (&out != &a)
+    out.reshape(a.dtype, a.shape);
+
+  const auto n = a.count();
+  a.visit([&](auto *pa) {
+    using T = std::remove_pointer_t<decltype(pa)>;
+    auto po = reinterpret_cast<T *>(out.data.data());
+    if (b) {
+      auto pb = reinterpret_cast<const T *>(b->data.data());
+      for (size_t i = 0; i < n; i++)
+        po[i] = op.apply(pa[i], pb[i]);
+    } else {
+      const auto s = operand.valueType == SHType::Int ? T(operand.payload.intValue) : T(operand.payload.floatValue);
+      for (size_t i = 0; i < n; i++)
+        po[i] = op.apply(pa[i], s);
+    }
+  });
+}
+} // namespace Tensor
+} // namespace shards
+
+#endif
@@ -1386,12 +1386,48 @@ struct ParallelBase : public CapturingSpawners {
       const auto threads = std::min(_threads, int64_t(std::thread::hardware_concurrency()));
       if (!_exec || _exec->num_workers() != (size_t(threads))) {
         _exec = std::make_unique<tf::Executor>(size_t(threads));
+
+        // one long lived task per worker, each pulls items until none are left
+        _flow.clear();
+        for (size_t i = 0; i < size_t(threads); i++) {
+          _flow.emplace([this, i]() { runItems(i); });
+        }
       }
     }
 #endif
     _composer.context = context;
   }
 
+  // A wire clone and a mesh per worker, acquired once and kept until cleanup
+  void warmupWorkerWires(SHContext *context) {
+    _workerWires.resize(_exec->num_workers());
+    for (auto &cref : _workerWires) {
+      if (!cref) {
+        cref = _pool->acquire(_composer, context);
+        if (!cref->mesh) {
+          cref->mesh = SHMesh::make();
+        }
+      }
+    }
+  }
+
+  void releaseWire(ManyWire *cref) {
+    if (cref->mesh) {
+      cref->mesh->terminate();
+    }
+
+    stop(cref->wire.get());
+
+    if (capturing) {
+      for (auto &v : _vars) {
+        // notice, this should be already destroyed by the wire releaseVariable
+        destroyVar(cref->wire->variables[v.variableName()]);
+      }
+    }
+
+    _pool->release(cref);
+  }
+
   void cleanup() {
     if (capturing) {
       for (auto &v : _vars) {
@@ -1406,23 +1442,17 @@ struct ParallelBase : public CapturingSpawners {
 
     for (auto &cref : _wires) {
       if (cref) {
-        if (cref->mesh) {
-          cref->mesh->terminate();
-        }
-
-        stop(cref->wire.get());
-
-        if (capturing) {
-          for (auto &v : _vars) {
-            // notice, this should be already destroyed by the wire releaseVariable
-            destroyVar(cref->wire->variables[v.variableName()]);
-          }
-        }
-
-        _pool->release(cref);
+        releaseWire(cref);
       }
     }
     _wires.clear();
+
+    for (auto &cref : _workerWires) {
+      if (cref) {
+        releaseWire(cref);
+      }
+    }
+    _workerWires.clear();
   }
 
   virtual SHVar getInput(const SHVar &input, uint32_t index) = 0;
@@ -1431,114 +1461,104 @@ struct ParallelBase : public CapturingSpawners {
 
   static constexpr size_t MinWiresAdded = 4;
 
-  SHVar activate(SHContext *context, const SHVar &input) {
-    assert(_threads > 0);
-
-    auto len = getLength(input);
-
-    if (len == 0) {
-      _outputs.resize(0);
-      return Var(_outputs.data(), 0);
+  struct Observer {
+    ParallelBase *server;
+    ManyWire *cref;
+
+    void before_compose(SHWire *wire) {}
+    void before_tick(SHWire *wire) {}
+    void before_stop(SHWire *wire) {}
+    void before_prepare(SHWire *wire) {}
+
+    void before_start(SHWire *wire) {
+      // capture variables / we could recycle but better to overwrite in case it was edited before
+      // (remember we recycle wires)
+      for (auto &v : server->_vars) {
+        auto &var = v.get();
+        cloneVar(cref->wire->variables[v.variableName()], var);
+      }
     }
+  };
 
-    size_t succeeded = 0;
-    size_t failed = 0;
-
-    _successes.resize(len);
-    std::fill(_successes.begin(), _successes.end(), false);
-    _outputs.resize(len);
-
-    // multithreaded
-    tf::Taskflow flow;
-
-    std::atomic_bool anySuccess = false;
-    std::mutex poolLock;
+  // Runs on the executor, worker owns _workerWires[worker] for the whole run
+  void runItems(size_t worker) {
+    auto cref = _workerWires[worker];
+    Observer obs{this, cref};
 
-    flow.for_each_index(size_t(0), len, size_t(1), [&](auto &idx) {
-      if (_policy == WaitUntil::FirstSuccess && anySuccess) {
-        // Early exit if FirstSuccess policy
+    while (true) {
+      const auto idx = _nextItem.fetch_add(1);
+      if (idx >= _len || (_policy == WaitUntil::FirstSuccess && _anySuccess)) {
+        // no more items or early exit if FirstSuccess policy
         return;
       }
 
       SHLOG_DEBUG("ParallelBase: activating wire {}", idx);
 
-      ManyWire *cref = nullptr;
-      try {
-        std::lock_guard<std::mutex> lock(poolLock);
-        cref = _pool->acquire(_composer, context);
-      } catch (std::exception &e) {
-        SHLOG_ERROR("Failed to acquire wire: {}", e.what());
-      }
-      DEFER({
-        SHLOG_DEBUG("ParallelBase: releasing wire {}", idx);
-        std::lock_guard<std::mutex> lock(poolLock);
-        _pool->release(cref);
-      });
-
-      if (!cref->mesh) {
-        cref->mesh = SHMesh::make();
-      }
-      cref->wire->mesh = cref->mesh;  // swap the mesh
-      DEFER(cref->mesh->terminate()); // ensure it's terminated
-
-      struct Observer {
-        ParallelBase *server;
-        ManyWire *cref;
-
-        void before_compose(SHWire *wire) {}
-        void before_tick(SHWire *wire) {}
-        void before_stop(SHWire *wire) {}
-        void before_prepare(SHWire *wire) {}
-
-        void before_start(SHWire *wire) {
-          // capture variables / we could recycle but better to overwrite in case it was edited before
-          // (remember we recycle wires)
-          for (auto &v : server->_vars) {
-            auto &var = v.get();
-            cloneVar(cref->wire->variables[v.variableName()], var);
-          }
-        }
-      } obs{this, cref};
-
       bool success = true;
-      cref->mesh->schedule(obs, cref->wire, getInput(input, idx), false); // don't compose
+      cref->mesh->schedule(obs, cref->wire, getInput(*_input, idx), false); // don't compose
       while (!cref->mesh->empty()) {
-        if (!cref->mesh->tick() || (_policy == WaitUntil::FirstSuccess && anySuccess)) {
+        if (!cref->mesh->tick() || (_policy == WaitUntil::FirstSuccess && _anySuccess)) {
           success = false;
           break;
         }
+        // don't spin while the wire is suspended
+        cref->mesh->waitIdle(SHDuration(0.01));
       }
 
       _successes[idx] = success;
 
       if (success) {
         SHLOG_DEBUG("ParallelBase: wire {} succeeded", idx);
-        anySuccess = true;
+        _anySuccess = true;
         stop(cref->wire.get(), &_outputs[idx]);
       } else {
         SHLOG_DEBUG("ParallelBase: wire {} failed", idx);
         _outputs[idx] = Var::Empty; // flag as empty to signal failure
-        // ensure it's stopped anyway
-        stop(cref->wire.get());
+        // ensure it's stopped and off the mesh anyway
+        cref->mesh->remove(cref->wire);
       }
-    });
+    }
+  }
 
-    auto future = _exec->run(std::move(flow));
+  SHVar activate(SHContext *context, const SHVar &input) {
+    assert(_threads > 0);
 
-    // we done if we are here
-    while (true) {
-      auto suspend_state = shards::suspend(context, 0);
-      if (unlikely(suspend_state != SHWireState::Continue)) {
+    auto len = getLength(input);
+
+    if (len == 0) {
+      _outputs.resize(0);
+      return Var(_outputs.data(), 0);
+    }
+
+    size_t succeeded = 0;
+    size_t failed = 0;
+
+    // only ever reallocates when growing
+    _successes.resize(len);
+    std::fill(_successes.begin(), _successes.end(), false);
+    _outputs.resize(len);
+
+    if (unlikely(_workerWires.size() != _exec->num_workers()))
+      warmupWorkerWires(context);
+
+    _input = &input;
+    _len = len;
+    _nextItem = 0;
+    _anySuccess = false;
+
+    // the executor wakes us up once all the workers are done
+    AwaitCompletion completion(context);
+    auto future = _exec->run(_flow, [&completion]() { completion.notify(); });
+
+    while (!completion.complete) {
+      if (unlikely(completion.suspend(context) != SHWireState::Continue)) {
         SHLOG_DEBUG("ParallelBase, interrupted!");
-        anySuccess = true; // flags early stop as well
-        future.get();      // wait for all to finish in any case
+        _anySuccess = true; // flags early stop as well
+        future.wait();      // wait for all to finish in any case
         return Var::Empty;
-      } else if ((_policy == WaitUntil::FirstSuccess && anySuccess) ||
-                 future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
-        future.get(); // wait for all to finish in any case
-        break;
       }
     }
+    future.wait();
 
     for (size_t i = 0; i < len; i++) {
       auto success = _successes[i];
@@ -1588,6 +1608,14 @@ protected:
   std::vector<ManyWire *> _wires;
   int64_t _threads{0};
   std::unique_ptr<tf::Executor> _exec;
+  tf::Taskflow _flow;
+  // one pre-warmed wire (and mesh) per executor worker
+  std::vector<ManyWire *> _workerWires;
+  // state of the current activation, shared with the workers
+  const SHVar *_input{};
+  size_t _len{0};
+  std::atomic_size_t _nextItem{0};
+  std::atomic_bool _anySuccess{false};
 };
 
 struct TryMany : public ParallelBase {
@@ -1693,7 +1721,10 @@ struct Spawn : public CapturingSpawners {
   static SHTypesInfo outputTypes() { return CoreInfo::WireType; }
 
   static inline Parameters _params{
-      {"Wire", SHCCSTR("The wire to spawn and try to run many times concurrently."), WireBase::WireVarTypes}};
+      {"Wire", SHCCSTR("The wire to spawn and try to run many times concurrently."), WireBase::WireVarTypes},
+      {"Prewarm",
+       SHCCSTR("How many spare copies of the wire to keep ready, topped up a couple per activation, 0 to clone on demand."),
+       {CoreInfo::IntType}}};
 
   static SHParametersInfo parameters() { return _params; }
 
@@ -1702,6 +1733,9 @@ struct Spawn : public CapturingSpawners {
     case 0:
       wireref = value;
       break;
+    case 1:
+      _prewarm = size_t(std::max(int64_t(0), value.payload.intValue));
+      break;
     default:
       break;
     }
@@ -1711,6 +1745,8 @@ struct Spawn : public CapturingSpawners {
     switch (index) {
     case 0:
       return wireref;
+    case 1:
+      return Var(int64_t(_prewarm));
     default:
       return Var::Empty;
     }
@@ -1774,6 +1810,9 @@ struct Spawn : public CapturingSpawners {
     }
 
     SHLOG_TRACE("Spawn: warmed up {} variables", _vars.size());
+
+    if (_prewarm > 0)
+      _pool->prewarm(_prewarm);
   }
 
   void cleanup() {
@@ -1803,6 +1842,9 @@ struct Spawn : public CapturingSpawners {
   SHVar activate(SHContext *context, const SHVar &input) {
     auto mesh = context->main->mesh.lock();
     auto c = _pool->acquire(_composer, context);
+    // stay ahead of demand, a small batch at a time
+    if (_prewarm > 0 && _pool->available() == 0)
+      _pool->prewarm(_prewarm);
 
     // Assume that we recycle containers so the connection might already exist!
     if (!c->onCleanupConnection) {
@@ -1823,6 +1865,7 @@ struct Spawn : public CapturingSpawners {
 
   std::unique_ptr<WireDoppelgangerPool<ManyWire>> _pool;
   SHTypeInfo _inputType{};
+  size_t _prewarm{0};
 };
 
 struct StepMany : public TryMany {
@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 /* Copyright © 2020 Fragcolor Pte. Ltd. */
 
+#include <fstream>
 #include <random>
 
 #include <shards/lang/bindings.h>
@@ -9,6 +10,9 @@
 #include <shards/common_types.hpp>
 #include <shards/core/async.hpp>
 #include <shards/core/runtime.hpp>
+#include <shards/core/var_file.hpp>
+#include <shards/inlined.hpp>
+#include <boost/filesystem.hpp>
 #include <shards/linalg_shim.hpp>
 
 #undef CHECK
@@ -898,6 +902,80 @@ TEST_CASE("SHMap") {
   REQUIRE(vx != vy);
 }
 
+TEST_CASE("SHMap-Indexed") {
+  SHMap x;
+  for (int64_t i = 999; i >= 0; i--) {
+    x[Var(i)] = Var(i * 2);
+  }
+  // values don't move while the index grows
+  auto first = &x[Var(0)];
+  for (int64_t i = 1000; i < 2000; i++) {
+    x.emplace(Var(i), Var(i * 2));
+  }
+  REQUIRE(first == &x[Var(0)]);
+  REQUIRE(x.size() == 2000);
+
+  for (int64_t i = 0; i < 2000; i += 2) {
+    x.erase(Var(i));
+  }
+  REQUIRE(x.size() == 1000);
+  REQUIRE(x.count(Var(2)) == 0);
+  REQUIRE(x[Var(1001)] == Var(2002));
+
+  // default iteration is sorted by key
+  int64_t last = -1;
+  for (auto &[k, v] : x) {
+    REQUIRE(k.payload.intValue > last);
+    REQUIRE(v.payload.intValue == k.payload.intValue * 2);
+    last = k.payload.intValue;
+  }
+
+  SHMap y;
+  y.setInsertionOrder(true);
+  y[Var("b")] = Var(1);
+  y[Var("a")] = Var(2);
+  y[Var("c")] = Var(3);
+  std::vector<std::string> keys;
+  for (auto &[k, v] : y) {
+    keys.emplace_back(SHSTRVIEW(k));
+  }
+  REQUIRE(keys == std::vector<std::string>{"b", "a", "c"});
+
+  // inserting after erasing the last entry must still notice the order broke
+  SHMap z;
+  z[Var("a")] = Var(1);
+  z[Var("b")] = Var(2);
+  z[Var("c")] = Var(3);
+  z.erase(Var("c"));
+  z[Var("0")] = Var(4);
+  keys.clear();
+  for (auto &[k, v] : z) {
+    keys.emplace_back(SHSTRVIEW(k));
+  }
+  REQUIRE(keys == std::vector<std::string>{"0", "a", "b"});
+}
+
+TEST_CASE("VarBuffer-Recycling") {
+  OwnedVar a = Var("short key");
+  REQUIRE(a.payload.stringCapacity == 15);
+  auto mem = a.payload.stringValue;
+  a = Var(42);
+  // the freed buffer is the next one handed out for the same size class
+  OwnedVar b = Var("another");
+  REQUIRE(b.payload.stringValue == mem);
+  REQUIRE(SHSTRVIEW(b) == "another");
+
+  uint8_t data[20]{1, 2, 3};
+  OwnedVar c = Var(data, 20);
+  REQUIRE(c.payload.bytesCapacity == 32);
+  REQUIRE(c.payload.bytesValue[2] == 3);
+
+  // larger payloads are plain allocations
+  std::string big(1000, 'x');
+  OwnedVar d = Var(big);
+  REQUIRE(d.payload.stringCapacity == 1000);
+}
+
 TEST_CASE("SHHashSet") {
   SHHashSet x;
   x.insert(Var(10));
@@ -1077,6 +1155,440 @@ TEST_CASE("ObjectVar") {
   }
 }
 
+TEST_CASE("Mesh-Workers") {
+  auto mesh = SHMesh::make();
+  mesh->setWorkers(4);
+  REQUIRE(mesh->workers() == 4);
+
+  std::vector<std::shared_ptr<SHWire>> wires;
+  for (int64_t i = 0; i < 16; i++) {
+    std::shared_ptr<SHWire> wire =
+        shards::Wire(fmt::format("test-wire-workers-{}", i)).let(i).shard("Math.Add", 1).shard("Assert.Is", i + 1);
+    mesh->schedule(wire);
+    REQUIRE(wire->meshIsolated);
+    wires.emplace_back(wire);
+  }
+
+  while (!mesh->empty()) {
+    REQUIRE(mesh->tick());
+  }
+
+  for (int64_t i = 0; i < 16; i++) {
+    REQUIRE(wires[i]->finishedOutput == Var(i + 1));
+  }
+
+  mesh->setWorkers(0);
+  REQUIRE(mesh->workers() == 0);
+}
+
+// Records the threads warming up, activating and cleaning up each probe, by Id
+struct ThreadProbe {
+  static inline std::mutex mutex;
+  static inline std::unordered_map<int64_t, std::vector<std::thread::id>> seen;
+
+  int64_t _id{0};
+  bool _warmedUp{false};
+
+  static inline Parameters params{{"Id", SHCCSTR("The key threads are recorded under."), {CoreInfo::IntType}}};
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+  static SHParametersInfo parameters() { return params; }
+
+  void setParam(int index, const SHVar &value) { _id = value.payload.intValue; }
+  SHVar getParam(int index) { return Var(_id); }
+
+  void record() {
+    std::scoped_lock lock(mutex);
+    seen[_id].push_back(std::this_thread::get_id());
+  }
+
+  void warmup(SHContext *context) {
+    _warmedUp = true;
+    record();
+  }
+
+  void cleanup() {
+    // cleanup also runs before any warmup, e.g. on compose
+    if (_warmedUp)
+      record();
+    _warmedUp = false;
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    record();
+    return input;
+  }
+};
+
+TEST_CASE("Mesh-Workers-Pinned") {
+  // meant to run under TSAN too (USE_TSAN), flows resumed by another thread or touching shared state would show up
+  static bool registered = false;
+  if (!registered) {
+    REGISTER_SHARD("Test.ThreadProbe", ThreadProbe);
+    registered = true;
+  }
+  ThreadProbe::seen.clear();
+
+  auto mesh = SHMesh::make();
+  mesh->setWorkers(4);
+
+  std::vector<std::shared_ptr<SHWire>> wires;
+  for (int64_t i = 0; i < 32; i++) {
+    std::shared_ptr<SHWire> wire = shards::Wire(fmt::format("test-wire-pinned-{}", i))
+                                       .looped(true)
+                                       .let(i)
+                                       .shard("Test.ThreadProbe", i)
+                                       .shard("Set", "x")
+                                       .shard("Pause", 0.0)
+                                       .shard("Get", "x")
+                                       .shard("Assert.Is", i, true);
+    mesh->schedule(wire);
+    REQUIRE(wire->meshWorker >= 0);
+    wires.emplace_back(wire);
+  }
+
+  // reaching other wires keeps a wire on the mesh thread
+  std::shared_ptr<SHWire> stopper = shards::Wire("test-wire-pinned-stopper").looped(true).shard("Pause", 0.0).shard("Stop");
+  mesh->schedule(stopper);
+  REQUIRE_FALSE(stopper->meshIsolated);
+  REQUIRE(stopper->meshWorker == -1);
+
+  std::shared_ptr<SHWire> callee = shards::Wire("test-wire-pinned-callee").shard("Math.Add", 1);
+  std::shared_ptr<SHWire> caller = shards::Wire("test-wire-pinned-caller").let(1).shard("Do", callee);
+  mesh->schedule(caller);
+  REQUIRE_FALSE(caller->meshIsolated);
+
+  for (int tick = 0; tick < 200; tick++) {
+    REQUIRE(mesh->tick());
+  }
+
+  // flows are pinned to the current workers
+  REQUIRE_THROWS(mesh->setWorkers(2));
+
+  mesh->terminate();
+
+  // warmup, every activation and cleanup ran on the same worker thread
+  const auto self = std::this_thread::get_id();
+  REQUIRE(ThreadProbe::seen.size() == wires.size());
+  for (auto &[id, threads] : ThreadProbe::seen) {
+    REQUIRE(threads.size() > 2);
+    REQUIRE(threads.front() != self);
+    for (auto &thread : threads) {
+      REQUIRE(thread == threads.front());
+    }
+  }
+
+  mesh->setWorkers(0);
+}
+
+TEST_CASE("Mesh-Dormant") {
+  auto mesh = SHMesh::make();
+  std::shared_ptr<SHWire> wire = shards::Wire("test-wire-dormant").looped(true).shard("Pause", 1.0);
+  mesh->schedule(wire);
+  REQUIRE(mesh->idleTime().count() == 0.0);
+
+  REQUIRE(mesh->tick());
+  // paused, no need to tick it for a while
+  REQUIRE(!mesh->empty());
+  REQUIRE(mesh->idleTime().count() > 0.0);
+  REQUIRE(mesh->idleTime().count() <= 1.0);
+
+  // stopping it from outside must wake it up and reap it
+  shards::stop(wire.get());
+  REQUIRE(mesh->tick());
+  REQUIRE(mesh->empty());
+  REQUIRE(mesh->idleTime().count() < 0.0);
+}
+
+TEST_CASE("Mesh-Await") {
+#if HAS_ASYNC_SUPPORT
+  typedef SHVar (*Func)(SHContext *, const SHVar *);
+  Func f = [](SHContext *ctx, const SHVar *input) -> SHVar {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    return Var(77);
+  };
+  auto sleeper = createShard("UnsafeActivate!");
+  auto fVar = Var(reinterpret_cast<uint64_t>(f));
+  sleeper->setParam(sleeper, 0, &fVar);
+
+  std::shared_ptr<SHWire> wire = shards::Wire("test-wire-await").shard("Await", Var(sleeper));
+  auto mesh = SHMesh::make();
+  mesh->schedule(wire);
+
+  // the wire is parked while the call runs and resumed once it completes, no polling
+  int ticks = 0;
+  while (!mesh->empty()) {
+    REQUIRE(mesh->tick());
+    mesh->waitIdle(SHDuration(1.0));
+    ticks++;
+  }
+  CHECK(ticks <= 3);
+  REQUIRE(wire->finishedOutput == Var(77));
+#endif
+}
+
+TEST_CASE("Variable-Slots") {
+  std::shared_ptr<SHWire> wire = shards::Wire("test-wire-slots")
+                                     .let(10)
+                                     .shard("Set", "x")
+                                     .shard("Get", "x")
+                                     .shard("Math.Add", Var::ContextVar("x"))
+                                     .shard("Update", "x")
+                                     .shard("Get", "x")
+                                     .shard("Assert.Is", 20)
+                                     .let(1)
+                                     .shard("Set", "y");
+  auto mesh = SHMesh::make();
+  mesh->schedule(wire);
+  // Set, Get and Update share a single slot per variable name
+  REQUIRE(wire->variableSlots.size() == 2);
+  REQUIRE(wire->variableSlots[wire->variableSlotIndices["x"]] == &wire->variables["x"]);
+  REQUIRE(wire->variableSlots[wire->variableSlotIndices["x"]]->refcount >= 4);
+  REQUIRE(mesh->tick());
+  REQUIRE(mesh->empty());
+  // cleanup resets resolved slots but keeps the indices
+  REQUIRE(wire->variableSlots.size() == 2);
+  REQUIRE(wire->variableSlots[0] == nullptr);
+}
+
+TEST_CASE("Fused-Activation") {
+  std::shared_ptr<SHWire> wire = shards::Wire("test-wire-fused")
+                                     .looped(true)
+                                     .let(1)
+                                     .shard("Set", "x")
+                                     .shard("Get", "x")
+                                     .shard("Math.Multiply", 3)
+                                     .shard("Update", "x")
+                                     .shard("Get", "x")
+                                     .shard("Math.Add", 1)
+                                     .shard("Math.Multiply", 2)
+                                     .shard("Assert.Is", 8, true);
+  auto mesh = SHMesh::make();
+  mesh->schedule(wire);
+  // Get is promoted on its first activation, later iterations take the fused paths
+  for (int i = 0; i < 4; i++) {
+    REQUIRE(mesh->tick());
+    REQUIRE(!mesh->empty());
+    REQUIRE(wire->variables["x"] == Var(3));
+    REQUIRE(wire->previousOutput == Var(8));
+  }
+  mesh->terminate();
+}
+
+TEST_CASE("Wire-Cloner") {
+  std::shared_ptr<SHWire> wire = shards::Wire("test-wire-clone")
+                                     .looped(true)
+                                     .let(2)
+                                     .shard("Math.Multiply", 3)
+                                     .shard("Set", "x")
+                                     .shard("Assert.Is", 6, true);
+  WireCloner cloner;
+  auto copy = cloner.clone(wire);
+  REQUIRE(copy != wire);
+  REQUIRE(copy->looped);
+  REQUIRE(copy->shards.size() == wire->shards.size());
+  for (size_t i = 0; i < copy->shards.size(); i++) {
+    REQUIRE(copy->shards[i] != wire->shards[i]);
+  }
+  REQUIRE(hash(Var(copy)) == hash(Var(wire)));
+  // cloning the same wire again within the same cloner yields the same copy
+  REQUIRE(cloner.clone(wire) == copy);
+
+  auto mesh = SHMesh::make();
+  mesh->schedule(copy);
+  REQUIRE(mesh->tick());
+  REQUIRE(copy->variables["x"] == Var(6));
+  mesh->terminate();
+}
+
+TEST_CASE("Var-File") {
+  const auto path = (boost::filesystem::temp_directory_path() / "shards-test.shvf").string();
+  SeqVar numbers;
+  for (int i = 0; i < 100; i++) {
+    numbers.push_back(Var(double(i)));
+  }
+  SeqVar mixed;
+  mixed.push_back(Var("hello"));
+  mixed.push_back(Var(42));
+  mixed.push_back(numbers);
+  TableVar table;
+  table[Var("key")] = Var("value");
+
+  {
+    VarFileEncoder encoder;
+    std::ofstream stream(path, std::ios::trunc | std::ios::binary);
+    const auto header = VarFileEncoder::header();
+    stream.write((const char *)&header, sizeof(header));
+    for (auto &var : {SHVar(Var(7)), SHVar(numbers), SHVar(mixed), SHVar(table)}) {
+      auto &record = encoder.record(var);
+      REQUIRE(record.size() % varfile::Alignment == 0);
+      stream.write((const char *)record.data(), record.size());
+    }
+  }
+
+  MappedVarFile file(path);
+  SHVar output{};
+  REQUIRE(file.next(output));
+  REQUIRE(output == Var(7));
+  REQUIRE(file.next(output));
+  REQUIRE(output == numbers);
+  // seqs of numbers point into the mapping
+  REQUIRE((output.flags & SHVAR_FLAGS_FOREIGN) == SHVAR_FLAGS_FOREIGN);
+  REQUIRE(uintptr_t(output.payload.seqValue.elements) % varfile::Alignment == 0);
+  REQUIRE(file.next(output));
+  REQUIRE(output == mixed);
+  REQUIRE((output.payload.seqValue.elements[0].flags & SHVAR_FLAGS_FOREIGN) == SHVAR_FLAGS_FOREIGN);
+  REQUIRE(file.next(output));
+  REQUIRE(output == table);
+  REQUIRE(!file.next(output));
+
+  // escaping values are regular copies
+  file.rewind();
+  REQUIRE(file.next(output));
+  REQUIRE(file.next(output));
+  OwnedVar copy = output;
+  REQUIRE((copy.flags & SHVAR_FLAGS_FOREIGN) == 0);
+  destroyVar(output);
+  boost::filesystem::remove(path);
+}
+
+TEST_CASE("Iteration-Arena") {
+  IterationArena arena;
+  auto str = arena.string("hello");
+  REQUIRE((str.flags & SHVAR_FLAGS_ARENA) == SHVAR_FLAGS_ARENA);
+  REQUIRE(str == Var("hello"));
+  // escaping values are deep copies owned as usual
+  OwnedVar copy = str;
+  REQUIRE((copy.flags & SHVAR_FLAGS_ARENA) == 0);
+  destroyVar(str);
+  REQUIRE(str.valueType == SHType::None);
+  REQUIRE(copy == Var("hello"));
+
+  // a spike past the first chunk is trimmed once an iteration doesn't need it
+  arena.alloc(IterationArena::ChunkSize * 2);
+  arena.reset();
+  REQUIRE(arena.capacity() == IterationArena::ChunkSize * 3);
+  arena.reset();
+  REQUIRE(arena.capacity() == IterationArena::ChunkSize);
+
+  // the budget is per iteration
+  REQUIRE(arena.fits(IterationArena::Budget));
+  arena.alloc(IterationArena::Budget);
+  REQUIRE(!arena.fits(1));
+  arena.reset();
+  REQUIRE(arena.used() == 0);
+
+  auto mesh = SHMesh::make();
+  std::shared_ptr<SHWire> wire = shards::Wire("test-wire-arena")
+                                     .looped(true)
+                                     .arena(true)
+                                     .let("a,b,,c")
+                                     .shard("String.Split", ",")
+                                     .shard("Set", "parts");
+  mesh->schedule(wire);
+  REQUIRE(mesh->tick());
+  REQUIRE(mesh->tick());
+  SeqVar expected;
+  expected.push_back(Var("a"));
+  expected.push_back(Var("b"));
+  expected.push_back(Var(""));
+  expected.push_back(Var("c"));
+  auto &parts = wire->variables["parts"];
+  REQUIRE(parts == expected);
+  REQUIRE((parts.flags & SHVAR_FLAGS_ARENA) == 0);
+  mesh->terminate();
+}
+
+TEST_CASE("Math-Specialized") {
+  auto mesh = SHMesh::make();
+  std::shared_ptr<SHWire> wire = shards::Wire("test-wire-specialized")
+                                     .looped(true)
+                                     .let(2)
+                                     .shard("Math.Multiply", 3)
+                                     .shard("Math.Add", 1)
+                                     .shard("Set", "x");
+  mesh->schedule(wire);
+  REQUIRE(mesh->tick());
+  REQUIRE(mesh->tick());
+  REQUIRE(wire->variables["x"] == Var(7));
+  // both operations compose to Int, so they run their Int instantiation
+  REQUIRE(wire->shards[1]->inlineShardId == InlineShard::MathSpecialized);
+  REQUIRE(wire->shards[2]->inlineShardId == InlineShard::MathSpecialized);
+  mesh->terminate();
+
+  // broadcasting a scalar keeps the generic activation
+  std::shared_ptr<SHWire> broadcast =
+      shards::Wire("test-wire-broadcast").looped(true).let(1.0, 2.0).shard("Math.Multiply", 2.0).shard("Set", "x");
+  mesh->schedule(broadcast);
+  REQUIRE(mesh->tick());
+  REQUIRE(broadcast->variables["x"] == Var(2.0, 4.0));
+  REQUIRE(broadcast->shards[1]->inlineShardId == InlineShard::MathMultiply);
+  mesh->terminate();
+}
+
+TEST_CASE("Shard-Profiler") {
+  auto mesh = SHMesh::make();
+  mesh->profiler->enable(true);
+  std::shared_ptr<SHWire> wire =
+      shards::Wire("test-wire-profile").looped(true).let(2).shard("Math.Multiply", 3).shard("Set", "x");
+  mesh->schedule(wire);
+  for (int i = 0; i < 3; i++) {
+    REQUIRE(mesh->tick());
+  }
+
+  SeqVar results;
+  mesh->profiler->results(results);
+  bool found = false;
+  for (auto &entry : results) {
+    auto &table = asTable(entry);
+    if (table[Var("Path")] == Var("test-wire-profile;Math.Multiply")) {
+      REQUIRE(table[Var("Shard")] == Var("Math.Multiply"));
+      REQUIRE(table[Var("Calls")] == Var(3));
+      REQUIRE(table[Var("InclusiveNs")].payload.intValue >= table[Var("ExclusiveNs")].payload.intValue);
+      found = true;
+    }
+  }
+  REQUIRE(found);
+  REQUIRE(mesh->profiler->collapsed().find("test-wire-profile;Set ") != std::string::npos);
+
+  // disabled, nothing more is recorded
+  mesh->profiler->reset();
+  mesh->profiler->enable(false);
+  REQUIRE(mesh->tick());
+  mesh->profiler->results(results);
+  REQUIRE(results.size() == 0);
+  mesh->terminate();
+}
+
+TEST_CASE("Stack-Pool") {
+  trimStackPool();
+
+  auto mesh = SHMesh::make();
+  mesh->stackSize = 64 * 1024;
+  std::shared_ptr<SHWire> wire = shards::Wire("test-wire-stack").let(1).shard("Pause", 0.0);
+  mesh->schedule(wire);
+  REQUIRE(wire->stack.size == mesh->stackSize);
+  auto mem = wire->stack.mem;
+  REQUIRE(mem);
+
+  // stopping gives the stack back to the pool, the next wire of the same size reuses it
+  stop(wire.get());
+  REQUIRE(!wire->stack.mem);
+  std::shared_ptr<SHWire> other = shards::Wire("test-wire-stack-2").let(1).shard("Pause", 0.0);
+  mesh->schedule(other);
+  REQUIRE(other->stack.mem == mem);
+  mesh->terminate();
+
+  auto guarded = acquireStack(10000, true);
+  REQUIRE(guarded.size >= 10000);
+  guarded.mem[0] = 1;
+  guarded.mem[guarded.size - 1] = 1;
+  releaseStack(guarded);
+  REQUIRE(!guarded.mem);
+  REQUIRE(trimStackPool() > 0);
+}
+
 TEST_CASE("linalg compatibility") {
   static_assert(sizeof(linalg::aliases::double2) == 32);
   static_assert(sizeof(linalg::aliases::float3) == 32);
@@ -1335,11 +1847,15 @@ TEST_CASE("AWAIT/AWAITNE") {
 
   std::this_thread::sleep_for(std::chrono::milliseconds(2000));
   // number of workers should be increased
-  CHECK(getTidePool()._workers.size() > TidePool::NumWorkers);
+  CHECK(getTidePool().metrics().workers > TidePool::NumWorkers);
 
   std::this_thread::sleep_for(std::chrono::milliseconds(15000));
   // number should be back now to normal
-  CHECK(getTidePool()._workers.size() == TidePool::NumWorkers);
+  auto metrics = getTidePool().metrics();
+  CHECK(metrics.workers == TidePool::NumWorkers);
+  CHECK(metrics.queued == 0);
+  CHECK(metrics.completed >= works.size());
+  CHECK(metrics.totalRun >= std::chrono::seconds(4) * works.size());
 #endif
 }
 